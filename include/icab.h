@@ -15,12 +15,30 @@
 #include <stdlib.h>
 #include <zlib.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 #ifndef ICAB_H
 #define ICAB_H
 
 #define ACTION_LISTONLY 1
 #define ACTION_UNPACK   2
+#define ACTION_PIPE     3
+#define ACTION_INDEX    4
+#define ACTION_TEST     5
+
+#define PROGRESS_TEXT   0
+#define PROGRESS_QUIET  1
+#define PROGRESS_JSON   2
+
+#define PROGRESS_INTERVAL_MS 250
+
+#define LIST_FORMAT_TEXT 0
+#define LIST_FORMAT_JSON 1
+#define LIST_FORMAT_CSV  2
+
+#define COPY_RANGE      1
+#define COPY_SENDFILE   2
+#define COPY_WRITE      3
 
 #ifndef NULL
 #define NULL ((void*)0)
@@ -38,8 +56,88 @@
 
 #define ICAB_VERSION "2.0.01"
 
+#define MSZIP_WINDOW_SIZE 32768
+#define CFDATA_MAX_UNCOMP 65535
+
+#define UNPACK_WRITE_SIZE 1048576
+#define MAP_OUTPUT_MIN 262144
+
+#define HUGE_PAGE_SIZE 2097152
+#define ARENA_ALIGN 64
+
+#define ZPOOL_INFLATE 1
+#define ZPOOL_DEFLATE 2
+#define ZPOOL_SLOTS 4
+#define ZPOOL_ARENA_SIZE 2097152
+#define ZPOOL_SLOT_ARENA_SIZE ( ZPOOL_ARENA_SIZE / ZPOOL_SLOTS )
+
+#define STREAM_SECTOR_SIZE 65544
+
+#define CAB_FLAG_PREV    0x0001
+#define CAB_FLAG_NEXT    0x0002
+#define CAB_FLAG_RESERVE 0x0004
+
+#define IFOLD_FROM_PREV     0xFFFD
+#define IFOLD_TO_NEXT       0xFFFE
+#define IFOLD_PREV_AND_NEXT 0xFFFF
+
+#define CABSET_MAX_VOLUMES 65535
+
+#define CAB_MAX_SIZE 0xFFFFFFFFUL
+#define CAB_MAX_COUNT 0xFFFF
+#define PACK_MIN_VOLUME_SIZE 1024
+
+#define READAHEAD_DISTANCE 16777216
+#define READAHEAD_CHUNK 1048576
+
+#define LIST_BUFFER_SIZE 4194304
+#define LIST_CHUNK_SIZE 4096
+
+#define LZX_FRAME_SIZE 32768
+#define LZX_MIN_WINDOW_BITS 15
+#define LZX_MAX_WINDOW_BITS 21
+#define LZX_NUM_CHARS 256
+#define LZX_PRETREE_SYMBOLS 20
+#define LZX_ALIGNED_SYMBOLS 8
+#define LZX_LENGTH_SYMBOLS 249
+#define LZX_MAIN_SYMBOLS (LZX_NUM_CHARS + 50 * 8)
+#define LZX_PRETREE_BITS 6
+#define LZX_ALIGNED_BITS 7
+#define LZX_LENGTH_BITS 12
+#define LZX_MAIN_BITS 12
+#define LZX_MAX_CODE_LEN 16
+#define LZX_LENS_SAFETY 64
+#define LZX_E8_FRAMES 32768
+
+#define LZX_BLOCK_VERBATIM 1
+#define LZX_BLOCK_ALIGNED 2
+#define LZX_BLOCK_UNCOMPRESSED 3
+
+#define LZX_E8_FILESIZE 12000000
+#define LZX_HASH_BITS 16
+#define LZX_MIN_MATCH 2
+#define LZX_MAX_MATCH 257
+#define LZX_TOO_FAR 4096
+#define LZX_BLOCK_FRAMES 4
+#define LZX_FRAME_SLACK 32
+#define LZX_PRESETS 10
+
+#define QTM_FRAME_SIZE 32768
+#define QTM_MIN_WINDOW_BITS 10
+#define QTM_MAX_WINDOW_BITS 21
+#define QTM_LITERAL_SYMBOLS 64
+#define QTM_POSITION_SYMBOLS 42
+#define QTM_LENGTH_SYMBOLS 27
+#define QTM_SELECTOR_SYMBOLS 7
+#define QTM_FREQ_LIMIT 3800
+#define QTM_SHIFTS 4
+#define QTM_RESORT_SHIFTS 50
+
+#define CABIDX_VERSION 2
+#define CABIDX_INTERVAL 32
+
 #define PTR_ASSERT(p,n,b,s) \
-    if ((unsigned char*) p + n >= (unsigned char*) b + s) { \
+    if ((unsigned char*) p + n > (unsigned char*) b + s) { \
         return ERANGE; \
     } \
 
@@ -95,6 +193,7 @@ struct CFFILE_FN
     unsigned short time;
     unsigned short attribs;
     const char *filename;
+    const char *path;
 };
 
 /* Cabinet data strcuture */
@@ -105,6 +204,61 @@ struct CFDATA
     unsigned short cbUncomp;
 };
 
+/* Sidecar index header structure */
+struct CABIDX_HEADER
+{
+    unsigned char signature[4];
+    unsigned int version;
+    unsigned int cbCabinet;
+    unsigned short setID;
+    unsigned short cFolders;
+    unsigned int interval;
+    unsigned int digest;
+};
+
+/* Sidecar index folder structure */
+struct CABIDX_FOLDER
+{
+    unsigned long long coffSectors;
+    unsigned long long coffCheckpoints;
+    unsigned int cSectors;
+    unsigned int cCheckpoints;
+};
+
+/* Sidecar index sector structure */
+struct CABIDX_SECTOR
+{
+    unsigned int coffCabData;
+    unsigned int uoffFolderData;
+};
+
+/* Sidecar index checkpoint structure */
+struct CABIDX_CHECKPOINT
+{
+    unsigned int iCFData;
+    unsigned int cbWindow;
+    unsigned char window[MSZIP_WINDOW_SIZE];
+};
+
+/* Sidecar index mapping */
+struct cabidx_t
+{
+    const unsigned char *base;
+    size_t size;
+    const struct CABIDX_HEADER *header;
+    const struct CABIDX_FOLDER *folders;
+};
+
+/* Cabinet header extension layout */
+struct cab_layout
+{
+    size_t folders_offset;
+    size_t folder_size;
+    size_t data_reserve;
+    const char *prev_cabinet;
+    const char *next_cabinet;
+};
+
 /* Cabinet data managment context */
 struct cfdata_ctx
 {
@@ -112,26 +266,486 @@ struct cfdata_ctx
     size_t uncompressed_size;
 };
 
+/* Cabinet sector index entry */
+struct cfdata_idx
+{
+    size_t cab_offset;
+    size_t folder_offset;
+    unsigned short volume;
+    unsigned short pieces;
+};
+
+/* Cabinet file table entry */
+struct cffile_entry
+{
+    const struct CFFILE *file;
+    const char *filename;
+    unsigned int offset;
+    unsigned int length;
+    unsigned short folder;
+    unsigned int nfile;
+    int selected;
+};
+
+/* Cabinet file table sorted by folder and offset */
+struct cffile_table
+{
+    struct cffile_entry *entries;
+    size_t n_entries;
+    size_t *buckets;
+    size_t n_buckets;
+};
+
+/* Cabinet file extraction context */
+struct cffile_ctx
+{
+    const struct cffile_entry *entry;
+    size_t first_sector;
+    size_t last_sector;
+    int fd;
+    unsigned char *map;
+    int done;
+};
+
+/* Mapped volume of cabinet set */
+struct cab_volume
+{
+    const unsigned char *base;
+    size_t size;
+    const struct CFHEADER *header;
+    struct cab_layout layout;
+    size_t first_folder;
+    int from_prev;
+    int to_next;
+};
+
+/* Folder part stored in one volume */
+struct cab_segment
+{
+    const struct CFFOLDER *folder;
+    unsigned short volume;
+};
+
+/* Cabinet set with folders merged across volumes */
+struct cab_set
+{
+    struct cab_volume *volumes;
+    size_t n_volumes;
+    struct cab_segment *segments;
+    size_t n_segments;
+    size_t *folders;
+    size_t n_folders;
+};
+
 /* Cabinet folder managment context */
 struct cffolder_ctx
 {
-    struct cfdata_ctx *sectors;
+    unsigned char *window;
+    size_t window_size;
+    size_t window_fill;
+    size_t window_pending;
+    size_t pending_sector;
+    struct cffile_ctx *direct;
+    size_t direct_from;
+    struct cfdata_idx *index;
     size_t n_sectors;
+    size_t n_needed;
+    struct CABIDX_CHECKPOINT *checkpoints;
+    size_t n_checkpoints;
+    struct cffile_ctx *files;
+    size_t n_files;
+    size_t next_file;
+};
+
+/* LZX decoder state kept across folder blocks */
+struct lzx_state
+{
+    unsigned char *window;
+    unsigned int window_size;
+    unsigned int window_posn;
+    unsigned int frame_posn;
+    unsigned int main_symbols;
+    unsigned int R0;
+    unsigned int R1;
+    unsigned int R2;
+    int header_read;
+    int block_type;
+    unsigned int block_length;
+    unsigned int block_remaining;
+    int intel_started;
+    int intel_filesize;
+    unsigned int intel_curpos;
+    unsigned int frame;
+    int length_empty;
+    unsigned char pretree_len[LZX_PRETREE_SYMBOLS + LZX_LENS_SAFETY];
+    unsigned char aligned_len[LZX_ALIGNED_SYMBOLS];
+    unsigned char length_len[LZX_LENGTH_SYMBOLS + LZX_LENS_SAFETY];
+    unsigned char main_len[LZX_MAIN_SYMBOLS + LZX_LENS_SAFETY];
+    unsigned short pretree_table[( 1 << LZX_PRETREE_BITS ) + LZX_PRETREE_SYMBOLS * 2];
+    unsigned short aligned_table[( 1 << LZX_ALIGNED_BITS ) + LZX_ALIGNED_SYMBOLS * 2];
+    unsigned short length_table[( 1 << LZX_LENGTH_BITS ) + LZX_LENGTH_SYMBOLS * 2];
+    unsigned short main_table[( 1 << LZX_MAIN_BITS ) + LZX_MAIN_SYMBOLS * 2];
+};
+
+/* LZX match finder effort for one compression level */
+struct lzx_preset
+{
+    unsigned int good;
+    unsigned int lazy;
+    unsigned int nice;
+    unsigned int chain;
+    int greedy;
+};
+
+/* LZX literal or match waiting for block trees */
+struct lzx_token
+{
+    unsigned int footer;
+    unsigned short length;
+    unsigned short main;
+};
+
+/* LZX encoder state kept across folder frames */
+struct lzx_encoder
+{
+    unsigned int window_size;
+    unsigned int main_symbols;
+    struct lzx_preset preset;
+    unsigned int R0;
+    unsigned int R1;
+    unsigned int R2;
+    unsigned int hashed;
+    unsigned int *head;
+    unsigned int *prev;
+    struct lzx_token *tokens;
+    unsigned int frame_tokens[LZX_BLOCK_FRAMES];
+    unsigned int frame_len[LZX_BLOCK_FRAMES];
+    unsigned int frame_R[LZX_BLOCK_FRAMES][3];
+    unsigned char main_len[LZX_MAIN_SYMBOLS];
+    unsigned char length_len[LZX_LENGTH_SYMBOLS];
+    unsigned char *input;
+    size_t input_size;
+    size_t input_len;
+    size_t position;
+    int started;
+};
+
+/* Quantum adaptive model, zeroed past entries */
+struct quantum_model
+{
+    int shiftsleft;
+    int entries;
+    unsigned short sym[QTM_LITERAL_SYMBOLS + 1];
+    unsigned short cumfreq[QTM_LITERAL_SYMBOLS + 1];
+};
+
+/* Quantum decoder state kept across folder blocks */
+struct quantum_state
+{
+    unsigned char *window;
+    unsigned int window_size;
+    unsigned int window_posn;
+    struct quantum_model literal[4];
+    struct quantum_model position4;
+    struct quantum_model position5;
+    struct quantum_model position6;
+    struct quantum_model length6;
+    struct quantum_model selector;
 };
 
-/* Unpack progress info */
+/* Folder decoder other than inflate */
+struct decoder_ctx
+{
+    struct lzx_state *lzx;
+    struct quantum_state *quantum;
+};
+
+/* Input read-ahead context */
+struct readahead_t
+{
+    int fd;
+    const unsigned char *base;
+    size_t size;
+    size_t distance;
+    size_t position;
+    size_t issued;
+    int drop;
+    int stop;
+    int running;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+/* Pack and unpack progress info */
 struct progress_t
 {
-    unsigned short file;
-    unsigned short n_files;
+    unsigned int file;
+    unsigned int n_files;
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned int folder;
+    int mode;
+    int fd;
+    long long next_report;
+    pthread_mutex_t mutex;
+};
+
+/* Unpack files selection */
+struct selection_t
+{
+    const char **patterns;
+    size_t n_patterns;
+    unsigned int *indices;
+    size_t n_indices;
+};
+
+/* Unpack options */
+struct unpack_opts_t
+{
+    const char *prefix;
+    int cab_fd;
+    int pipe_fd;
+    int stream_fd;
+    size_t write_size;
+    size_t readahead;
+    int map_output;
+    int test;
+    int progress_mode;
+    int progress_fd;
+    unsigned int n_jobs;
+    const struct selection_t *selection;
+    const char *cabidx_path;
+    unsigned int interval;
+    const struct cab_set *set;
 };
 
-/* Cabinet folder data context */
-struct folder_mem_ctx
+/* Unpack workers shared context */
+struct unpack_jobs_t
 {
-    unsigned short n_cfdata;
-    unsigned char *compressed;
+    const unsigned char *base;
+    size_t size;
+    const char *prefix;
+    int cab_fd;
+    int pipe_fd;
+    int stream_fd;
+    size_t write_size;
+    size_t window_size;
+    struct readahead_t *readahead;
+    struct cab_layout layout;
+    const struct cab_set *set;
+    int map_output;
+    int test;
+    unsigned long long n_bytes;
+    const struct cffile_table *table;
+    const struct cabidx_t *cabidx;
+    unsigned int interval;
+    struct cffolder_ctx *folders;
+    unsigned long long *order;
+    unsigned short n_folders;
+    unsigned short next_folder;
+    unsigned short failed_folder;
+    int error_status;
+    pthread_mutex_t mutex;
+    struct progress_t progress;
+};
+
+/* Cabinet folder being packed sector by sector */
+struct folder_pack_ctx
+{
+    const struct CFFILE_FN *files;
+    size_t n_files;
+    size_t size;
+    unsigned short type_compress;
+    unsigned int n_cfdata;
+    unsigned int sector;
+    size_t offset;
+    size_t next;
     size_t compressed_size;
+    int fd;
+    size_t file;
+    size_t file_left;
 };
 
+/* Cabinet volume being filled by packer */
+struct pack_volume
+{
+    const char *path;
+    int fd;
+    int split;
+    size_t limit;
+    unsigned int index;
+    unsigned short set_id;
+    size_t head_len;
+    size_t files_len;
+    size_t reserve;
+    size_t meta_left;
+    size_t meta_prev;
+    struct CFFOLDER *folders;
+    size_t n_folders;
+    size_t folders_alloc;
+    struct CFFILE_FN *files;
+    size_t n_files;
+    size_t files_alloc;
+    size_t folder_files;
+    size_t data_len;
+};
+
+/* Bump allocator over one mapping */
+struct arena_t
+{
+    unsigned char *base;
+    size_t size;
+    size_t used;
+    int huge;
+};
+
+/* Pooled zlib stream */
+struct zpool_slot
+{
+    z_stream stream;
+    struct arena_t arena;
+    int kind;
+    int level;
+    int in_use;
+};
+
+/* Per thread zlib streams pool */
+struct zpool_t
+{
+    struct arena_t arena;
+    struct zpool_slot slots[ZPOOL_SLOTS];
+};
+
+/* Cached uncompressed block */
+struct block_slot
+{
+    unsigned char *data;
+    size_t size;
+    unsigned short folder;
+    size_t sector;
+    int prev;
+    int next;
+};
+
+/* Random access folder state */
+struct archive_folder
+{
+    const struct CFFOLDER *cffolder;
+    struct cffolder_ctx ctx;
+    int *slots;
+    struct decoder_ctx decoder;
+    size_t next_sector;
+};
+
+/* Random access cabinet handle */
+struct icab_archive
+{
+    const unsigned char *base;
+    size_t size;
+    const struct CFHEADER *header;
+    struct cffile_table table;
+    struct cabidx_t cabidx;
+    struct archive_folder *folders;
+    struct block_slot *slots;
+    size_t n_slots;
+    int lru_head;
+    int lru_tail;
+    unsigned char *window;
+    struct arena_t arena;
+    z_stream stream;
+    int stream_ready;
+    pthread_mutex_t mutex;
+};
+
+/* Shared archive routines */
+extern int uncompress_data ( int type, const unsigned char *compressed, size_t compressed_size,
+    struct cfdata_ctx *sector, z_stream * stream, struct decoder_ctx *decoder );
+extern size_t file_name_len ( const unsigned char *offset, const unsigned char *limit );
+extern int parse_layout ( const unsigned char *base, size_t size, struct cab_layout *layout );
+extern const struct CFFOLDER *layout_folder ( const unsigned char *base, size_t size,
+    const struct cab_layout *layout, size_t nfolder );
+extern int index_folder ( const struct CFFOLDER *folder, struct cffolder_ctx *folder_ctx,
+    const unsigned char *base, size_t size, const struct cabidx_t *cabidx, size_t nfolder );
+extern size_t find_sector ( const struct cffolder_ctx *folder_ctx, size_t folder_offset );
+extern int read_stream ( int fd, void *buf, size_t len );
+extern int load_metadata ( int fd, size_t size, unsigned char **meta, size_t *meta_size );
+extern int read_cfdata ( int fd, size_t offset, struct CFDATA *data );
+extern int load_file_table ( const unsigned char *base, size_t size,
+    struct cffile_table *table );
+extern void bucket_file_table ( struct cffile_table *table );
+extern void free_file_table ( struct cffile_table *table );
+extern const struct CABIDX_CHECKPOINT *find_checkpoint ( const struct cabidx_t *cabidx,
+    size_t nfolder, size_t nsector );
+extern int digest_cabinet ( const unsigned char *base, size_t size, unsigned int *digest );
+extern int load_cabidx ( const char *path, const unsigned char *base, size_t size,
+    struct cabidx_t *cabidx );
+extern void unload_cabidx ( struct cabidx_t *cabidx );
+
+/* Cabinet sets */
+extern int open_cabinet_set ( const char *path, struct cab_set *set );
+extern int load_set_table ( const struct cab_set *set, struct cffile_table *table );
+extern int index_set_folder ( const struct cab_set *set, size_t nfolder,
+    struct cffolder_ctx *folder_ctx );
+extern int gather_sector ( const struct cab_set *set, const struct cfdata_idx *idx,
+    unsigned char *scratch, const unsigned char **data, size_t *len, int *valid );
+extern void close_cabinet_set ( struct cab_set *set );
+
+/* LZX decoder */
+extern int lzx_init ( struct lzx_state **lzx, unsigned int window_bits );
+extern int lzx_decompress ( struct lzx_state *lzx, const unsigned char *in, size_t in_len,
+    unsigned char *out, size_t out_len );
+extern void lzx_free ( struct lzx_state *lzx );
+
+/* LZX encoder */
+extern int lzx_encoder_init ( struct lzx_encoder **lzx, unsigned int window_bits,
+    unsigned int level );
+extern size_t lzx_compress_bound ( size_t len );
+extern int lzx_compress ( struct lzx_encoder *lzx, const unsigned char *data, size_t len,
+    unsigned char *out, size_t out_size, size_t *out_len, unsigned int *n_cfdata );
+extern void lzx_encoder_free ( struct lzx_encoder *lzx );
+
+/* Quantum decoder */
+extern int quantum_init ( struct quantum_state **quantum, unsigned int window_bits );
+extern int quantum_decompress ( struct quantum_state *quantum, const unsigned char *in,
+    size_t in_len, unsigned char *out, size_t out_len );
+extern void quantum_free ( struct quantum_state *quantum );
+
+/* Arena allocator */
+extern int arena_init ( struct arena_t *arena, size_t size );
+extern void *arena_alloc ( struct arena_t *arena, size_t len );
+extern void arena_reset ( struct arena_t *arena );
+extern void arena_free ( struct arena_t *arena );
+
+/* Cfdata checksum */
+extern unsigned int checksum ( const unsigned char *p, unsigned int size );
+
+/* Progress reporter */
+extern void progress_init ( struct progress_t *progress, int mode, int fd, unsigned int n_files );
+extern void progress_add ( struct progress_t *progress, unsigned int files, size_t bytes_in,
+    size_t bytes_out, unsigned int folder );
+extern void progress_finish ( struct progress_t *progress );
+
+/* Input read-ahead */
+extern int readahead_start ( struct readahead_t *ra, int fd, const unsigned char *base,
+    size_t size, size_t distance, int drop );
+extern void readahead_advance ( struct readahead_t *ra, size_t position );
+extern void readahead_stop ( struct readahead_t *ra );
+
+/* Structured listing */
+extern int list_files_structured ( const unsigned char *base, size_t size, int cab_fd,
+    int sectors, int format, int fd );
+
+/* Thread local zlib streams pool */
+extern int zpool_acquire ( int kind, int level, z_stream ** stream );
+extern void zpool_release ( z_stream * stream );
+
+/* Random access read api */
+extern int icab_open ( const char *path, size_t cache_blocks, struct icab_archive **archive );
+extern const struct cffile_entry *icab_find ( const struct icab_archive *archive,
+    const char *name );
+extern ssize_t icab_pread ( struct icab_archive *archive, const struct cffile_entry *file,
+    void *buf, size_t len, size_t offset );
+extern void icab_close ( struct icab_archive *archive );
+
 #endif
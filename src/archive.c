@@ -0,0 +1,1460 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - Shared Archive Access Routines
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+/* Uncompress data */
+int uncompress_data ( int type, const unsigned char *compressed, size_t compressed_size,
+    struct cfdata_ctx *sector, z_stream * stream, struct decoder_ctx *decoder )
+{
+    int error_status;
+
+    /* Supported compression types are none, ms-zip, quantum and lzx */
+    if ( !( type & 0x000F ) )
+    {
+        /* On none compression type copy data */
+        if ( compressed_size != sector->uncompressed_size )
+        {
+            return ENODATA;
+        }
+        memcpy ( sector->uncompressed, compressed, compressed_size );
+
+        return 0;
+
+    } else if ( ( type & 0x000F ) == 2 && decoder != NULL && decoder->quantum != NULL )
+    {
+        /* Quantum models and window carry across blocks */
+        return quantum_decompress ( decoder->quantum, compressed, compressed_size,
+            sector->uncompressed, sector->uncompressed_size );
+
+    } else if ( ( type & 0x000F ) == 3 && decoder != NULL && decoder->lzx != NULL )
+    {
+        /* Lzx state carries window across blocks */
+        return lzx_decompress ( decoder->lzx, compressed, compressed_size,
+            sector->uncompressed, sector->uncompressed_size );
+
+    } else if ( ( type & 0x000F ) != 1 )
+    {
+        return ENOTSUP;
+    }
+
+    /* Validate compressed data length */
+    if ( compressed_size < 2 )
+    {
+        return ENODATA;
+    }
+
+    /* Validate ms-zip header */
+    if ( compressed[0] != 0x43 || compressed[1] != 0x4b )
+    {
+        return EINVAL;
+    }
+
+    /* Prepare decompression parameters */
+    stream->avail_in = compressed_size - 2;
+    stream->next_in = ( unsigned char * ) compressed + 2;
+
+    stream->avail_out = sector->uncompressed_size;
+    stream->next_out = sector->uncompressed;
+
+    /* Decompress data with RFC 1951 inflate */
+    error_status = inflate ( stream, Z_FINISH );
+    if ( error_status != Z_OK && error_status != Z_STREAM_END )
+    {
+        fprintf ( stderr, "Failed to inflate data: %s\n", stream->msg );
+        return error_status;
+    }
+
+    if ( stream->total_out != sector->uncompressed_size )
+    {
+        return ENODATA;
+    }
+
+    return 0;
+}
+
+/* Calculate file name length */
+size_t file_name_len ( const unsigned char *offset, const unsigned char *limit )
+{
+    const unsigned char *finish = offset;
+
+    while ( finish < limit && *finish != '\0' )
+    {
+        finish++;
+    }
+
+    return finish - offset + 1;
+}
+
+/* Parse set name following header, one nul terminated string */
+static const char *parse_name ( const unsigned char **offset, const unsigned char *limit )
+{
+    const char *name = ( const char * ) *offset;
+    size_t len;
+
+    len = file_name_len ( *offset, limit );
+    if ( *offset + len > limit )
+    {
+        return NULL;
+    }
+
+    *offset += len;
+
+    return name;
+}
+
+/* Locate folder table past optional reserve area and set names */
+int parse_layout ( const unsigned char *base, size_t size, struct cab_layout *layout )
+{
+    const unsigned char *offset;
+    const unsigned char *limit = base + size;
+    const struct CFHEADER *header;
+
+    memset ( layout, '\0', sizeof ( struct cab_layout ) );
+    layout->folder_size = sizeof ( struct CFFOLDER );
+
+    /* Header may be all that is read so far */
+    if ( size < sizeof ( struct CFHEADER ) )
+    {
+        return ERANGE;
+    }
+
+    header = ( const struct CFHEADER * ) base;
+    offset = base + sizeof ( struct CFHEADER );
+
+    /* Reserve sizes of header, each folder and each sector */
+    if ( header->flags & CAB_FLAG_RESERVE )
+    {
+        PTR_ASSERT ( offset, 4, base, size );
+        layout->folder_size += offset[2];
+        layout->data_reserve = offset[3];
+        offset += 4 + ( offset[0] | offset[1] << 8 );
+    }
+
+    /* Previous and next cabinet names, each followed by disk name */
+    if ( header->flags & CAB_FLAG_PREV )
+    {
+        if ( ( layout->prev_cabinet = parse_name ( &offset, limit ) ) == NULL
+            || parse_name ( &offset, limit ) == NULL )
+        {
+            return ERANGE;
+        }
+    }
+
+    if ( header->flags & CAB_FLAG_NEXT )
+    {
+        if ( ( layout->next_cabinet = parse_name ( &offset, limit ) ) == NULL
+            || parse_name ( &offset, limit ) == NULL )
+        {
+            return ERANGE;
+        }
+    }
+
+    if ( offset > limit )
+    {
+        return ERANGE;
+    }
+
+    layout->folders_offset = offset - base;
+
+    return 0;
+}
+
+/* Locate folder structure, null if outside cabinet */
+const struct CFFOLDER *layout_folder ( const unsigned char *base, size_t size,
+    const struct cab_layout *layout, size_t nfolder )
+{
+    size_t offset;
+
+    offset = layout->folders_offset + nfolder * layout->folder_size;
+    if ( offset + sizeof ( struct CFFOLDER ) > size )
+    {
+        return NULL;
+    }
+
+    return ( const struct CFFOLDER * ) ( base + offset );
+}
+
+/* Load folder sectors index from sidecar */
+static int index_folder_cabidx ( const struct CFFOLDER *folder, struct cffolder_ctx *folder_ctx,
+    const struct cabidx_t *cabidx, size_t nfolder, size_t size )
+{
+    size_t i;
+    const struct CABIDX_SECTOR *sectors;
+
+    sectors =
+        ( const struct CABIDX_SECTOR * ) ( cabidx->base + cabidx->folders[nfolder].coffSectors );
+
+    for ( i = 0; i <= folder->cCFData; i++ )
+    {
+        /* Sidecar entries must stay ordered and inside cabinet */
+        if ( sectors[i].coffCabData > size || ( i
+                && ( sectors[i].coffCabData < sectors[i - 1].coffCabData + sizeof ( struct CFDATA )
+                    || sectors[i].uoffFolderData < sectors[i - 1].uoffFolderData ) ) )
+        {
+            return ERANGE;
+        }
+
+        folder_ctx->index[i].cab_offset = sectors[i].coffCabData;
+        folder_ctx->index[i].folder_offset = sectors[i].uoffFolderData;
+    }
+
+    folder_ctx->n_sectors = folder->cCFData;
+
+    return 0;
+}
+
+/* Build cumulative offset index of folder sectors */
+int index_folder ( const struct CFFOLDER *folder, struct cffolder_ctx *folder_ctx,
+    const unsigned char *base, size_t size, const struct cabidx_t *cabidx, size_t nfolder )
+{
+    size_t i;
+    size_t cab_offset;
+    size_t folder_offset = 0;
+    const struct CFDATA *sector;
+
+    /* Allocate index with closing entry */
+    if ( ( folder_ctx->index =
+            ( struct cfdata_idx * ) malloc ( ( folder->cCFData +
+                    1 ) * sizeof ( struct cfdata_idx ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    /* Take ready index from sidecar if present */
+    if ( cabidx != NULL )
+    {
+        return index_folder_cabidx ( folder, folder_ctx, cabidx, nfolder, size );
+    }
+
+    /* Walk sector headers and sum uncompressed sizes */
+    for ( i = 0, cab_offset = folder->coffCabStart; i < folder->cCFData; i++ )
+    {
+        sector = ( const struct CFDATA * ) ( base + cab_offset );
+        PTR_ASSERT ( sector, sizeof ( struct CFDATA ), base, size );
+
+        /* Sector data must fit in cabinet */
+        if ( cab_offset + sizeof ( struct CFDATA ) + sector->cbData > size )
+        {
+            return ERANGE;
+        }
+
+        folder_ctx->index[i].cab_offset = cab_offset;
+        folder_ctx->index[i].folder_offset = folder_offset;
+
+        cab_offset += sizeof ( struct CFDATA ) + sector->cbData;
+        folder_offset += sector->cbUncomp;
+    }
+
+    /* Closing entry holds folder totals */
+    folder_ctx->index[i].cab_offset = cab_offset;
+    folder_ctx->index[i].folder_offset = folder_offset;
+    folder_ctx->n_sectors = folder->cCFData;
+
+    return 0;
+}
+
+/* Find sector holding given folder offset */
+size_t find_sector ( const struct cffolder_ctx *folder_ctx, size_t folder_offset )
+{
+    size_t lo = 0;
+    size_t hi = folder_ctx->n_sectors;
+    size_t mid;
+
+    /* Offsets past folder data map to closing entry */
+    if ( folder_offset >= folder_ctx->index[hi].folder_offset )
+    {
+        return hi;
+    }
+
+    /* Last sector starting at or before offset */
+    while ( hi - lo > 1 )
+    {
+        mid = lo + ( hi - lo ) / 2;
+
+        if ( folder_ctx->index[mid].folder_offset <= folder_offset )
+        {
+            lo = mid;
+        } else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* Compare file entries by folder and offset */
+static int compare_entries ( const void *a, const void *b )
+{
+    const struct cffile_entry *entry_a = ( const struct cffile_entry * ) a;
+    const struct cffile_entry *entry_b = ( const struct cffile_entry * ) b;
+
+    if ( entry_a->folder != entry_b->folder )
+    {
+        return entry_a->folder < entry_b->folder ? -1 : 1;
+    }
+
+    if ( entry_a->offset != entry_b->offset )
+    {
+        return entry_a->offset < entry_b->offset ? -1 : 1;
+    }
+
+    return entry_a->nfile < entry_b->nfile ? -1 : entry_a->nfile > entry_b->nfile;
+}
+
+/* Read exact range from cabinet file */
+static int read_range ( int fd, void *buf, size_t len, size_t offset )
+{
+    ssize_t len_read;
+
+    while ( len )
+    {
+        if ( ( len_read = pread ( fd, buf, len, offset ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        if ( !len_read )
+        {
+            return ERANGE;
+        }
+
+        buf = ( unsigned char * ) buf + len_read;
+        len -= len_read;
+        offset += len_read;
+    }
+
+    return 0;
+}
+
+/* Read exact length from current stream position */
+int read_stream ( int fd, void *buf, size_t len )
+{
+    ssize_t len_read;
+
+    while ( len )
+    {
+        if ( ( len_read = read ( fd, buf, len ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        if ( !len_read )
+        {
+            return ERANGE;
+        }
+
+        buf = ( unsigned char * ) buf + len_read;
+        len -= len_read;
+    }
+
+    return 0;
+}
+
+/* Extend metadata buffer with next stream bytes */
+static int extend_metadata ( int fd, unsigned char **meta, size_t *meta_size, size_t meta_end )
+{
+    int error_status;
+    unsigned char *extended;
+
+    if ( meta_end <= *meta_size )
+    {
+        return 0;
+    }
+
+    if ( ( extended = ( unsigned char * ) realloc ( *meta, meta_end ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    *meta = extended;
+    if ( ( error_status = read_stream ( fd, *meta + *meta_size, meta_end - *meta_size ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    *meta_size = meta_end;
+
+    return 0;
+}
+
+/* Read header, folder and file regions in one forward pass without touching sector data */
+int load_metadata ( int fd, size_t size, unsigned char **meta, size_t *meta_size )
+{
+    int error_status;
+    unsigned short i;
+    size_t folders_end;
+    size_t meta_end;
+    const struct CFHEADER *header;
+    const struct CFFOLDER *folder;
+    struct cab_layout layout;
+
+    *meta = NULL;
+    *meta_size = 0;
+
+    /* Read fixed header first */
+    if ( ( error_status =
+            extend_metadata ( fd, meta, meta_size, sizeof ( struct CFHEADER ) ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Reserve area and set names precede folders, file table follows them */
+    header = ( const struct CFHEADER * ) *meta;
+    if ( ( header->flags & ( CAB_FLAG_PREV | CAB_FLAG_NEXT | CAB_FLAG_RESERVE ) )
+        && ( error_status =
+            extend_metadata ( fd, meta, meta_size,
+                header->coffFiles < size ? header->coffFiles : size ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    if ( ( error_status = parse_layout ( *meta, *meta_size, &layout ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Metadata ends where first sector starts, read folders to find out */
+    header = ( const struct CFHEADER * ) *meta;
+    folders_end = layout.folders_offset + header->cFolders * layout.folder_size;
+    if ( ( error_status =
+            extend_metadata ( fd, meta, meta_size,
+                folders_end < size ? folders_end : size ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    header = ( const struct CFHEADER * ) *meta;
+    meta_end = size;
+    for ( i = 0; i < header->cFolders && folders_end <= size; i++ )
+    {
+        folder = ( const struct CFFOLDER * ) ( *meta + layout.folders_offset +
+            i * layout.folder_size );
+        if ( folder->coffCabStart > folders_end && folder->coffCabStart < meta_end )
+        {
+            meta_end = folder->coffCabStart;
+        }
+    }
+
+    /* File table must fit before sector data */
+    if ( header->coffFiles > meta_end && header->coffFiles < size )
+    {
+        meta_end = size;
+    }
+
+    /* Cabinet without folders has no sector data, file table runs to its end */
+    if ( !header->cFolders )
+    {
+        meta_end = header->cbCabinet < size ? header->cbCabinet : size;
+    }
+
+    /* Stream of unknown size needs file table before data */
+    if ( meta_end == ( size_t ) -1 )
+    {
+        error_status = EINVAL;
+        goto exit;
+    }
+
+    /* Read rest of metadata region */
+    error_status = extend_metadata ( fd, meta, meta_size, meta_end );
+
+  exit:
+
+    if ( error_status )
+    {
+        free ( *meta );
+        *meta = NULL;
+        *meta_size = 0;
+    }
+
+    return error_status;
+}
+
+/* Read single sector header on demand */
+int read_cfdata ( int fd, size_t offset, struct CFDATA *data )
+{
+    return read_range ( fd, data, sizeof ( struct CFDATA ), offset );
+}
+
+/* Parse file table once and bucket entries by folder */
+int load_file_table ( const unsigned char *base, size_t size,
+    struct cffile_table *table )
+{
+    unsigned short i;
+    size_t suboffset;
+    const struct CFHEADER *header;
+    const struct CFFILE *file;
+    const unsigned char *offset;
+    struct cffile_entry *entry;
+
+    /* Reset file table */
+    memset ( table, '\0', sizeof ( struct cffile_table ) );
+
+    /* Assign header structure pointer */
+    header = ( const struct CFHEADER * ) base;
+    PTR_ASSERT ( header, sizeof ( struct CFHEADER ), base, size );
+
+    /* Allocate entries table */
+    if ( ( table->entries =
+            ( struct cffile_entry * ) malloc ( ( header->cFiles +
+                    1 ) * sizeof ( struct cffile_entry ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    /* Allocate folder buckets with closing entry */
+    table->n_buckets = header->cFolders;
+    if ( ( table->buckets =
+            ( size_t * ) calloc ( table->n_buckets + 1, sizeof ( size_t ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    /* File table follows folders and any set names, empty one may end cabinet */
+    offset = base + header->coffFiles;
+    if ( header->coffFiles > size )
+    {
+        return ERANGE;
+    }
+
+    /* Parse each file structure */
+    for ( i = 0; i < header->cFiles; i++ )
+    {
+        /* Assign file structure pointer */
+        file = ( const struct CFFILE * ) offset;
+        PTR_ASSERT ( file, sizeof ( struct CFFILE ), base, size );
+
+        /* Calculate file entry length */
+        suboffset =
+            sizeof ( struct CFFILE ) + file_name_len ( offset + sizeof ( struct CFFILE ),
+            base + size );
+
+        /* Validate data range */
+        if ( offset + suboffset > base + size )
+        {
+            return ERANGE;
+        }
+
+        entry = &table->entries[table->n_entries++];
+        entry->file = file;
+        entry->filename = ( const char * ) offset + sizeof ( struct CFFILE );
+        entry->offset = file->uoffFolderStart;
+        entry->length = file->cbFile;
+        entry->folder = file->iFolder;
+        entry->nfile = i;
+        entry->selected = FALSE;
+
+        offset += suboffset;
+    }
+
+    bucket_file_table ( table );
+
+    return 0;
+}
+
+/* Order entries by folder and offset and mark where each folder starts */
+void bucket_file_table ( struct cffile_table *table )
+{
+    size_t i;
+    size_t j;
+
+    qsort ( table->entries, table->n_entries, sizeof ( struct cffile_entry ), compare_entries );
+
+    for ( i = 0, j = 0; i <= table->n_buckets; i++ )
+    {
+        while ( j < table->n_entries && table->entries[j].folder < i )
+        {
+            j++;
+        }
+
+        table->buckets[i] = j;
+    }
+}
+
+/* Free file table */
+void free_file_table ( struct cffile_table *table )
+{
+    if ( table->entries != NULL )
+    {
+        free ( table->entries );
+    }
+
+    if ( table->buckets != NULL )
+    {
+        free ( table->buckets );
+    }
+}
+
+/* Find sidecar checkpoint to start decoding from */
+const struct CABIDX_CHECKPOINT *find_checkpoint ( const struct cabidx_t *cabidx,
+    size_t nfolder, size_t nsector )
+{
+    size_t lo = 0;
+    size_t hi;
+    size_t mid;
+    const struct CABIDX_CHECKPOINT *checkpoints;
+
+    if ( cabidx == NULL || !( hi = cabidx->folders[nfolder].cCheckpoints ) )
+    {
+        return NULL;
+    }
+
+    checkpoints =
+        ( const struct CABIDX_CHECKPOINT * ) ( cabidx->base +
+        cabidx->folders[nfolder].coffCheckpoints );
+
+    /* Checkpoints are ordered by sector */
+    while ( lo < hi )
+    {
+        mid = lo + ( hi - lo ) / 2;
+
+        if ( checkpoints[mid].iCFData <= nsector )
+        {
+            lo = mid + 1;
+        } else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo ? &checkpoints[lo - 1] : NULL;
+}
+
+/* Digest folder table and sector headers, sidecar must match cabinet content */
+int digest_cabinet ( const unsigned char *base, size_t size, unsigned int *digest )
+{
+    int error_status;
+    size_t i;
+    size_t j;
+    size_t offset;
+    uLong crc;
+    const struct CFHEADER *header = ( const struct CFHEADER * ) base;
+    const struct CFFOLDER *folder;
+    const struct CFDATA *cfdata;
+    struct cab_layout layout;
+
+    if ( ( error_status = parse_layout ( base, size, &layout ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    crc = crc32 ( 0L, Z_NULL, 0 );
+
+    for ( i = 0; i < header->cFolders; i++ )
+    {
+        if ( ( folder = layout_folder ( base, size, &layout, i ) ) == NULL )
+        {
+            return ERANGE;
+        }
+
+        crc = crc32 ( crc, ( const Bytef * ) folder, layout.folder_size );
+
+        /* Sector headers carry checksums of compressed data */
+        for ( j = 0, offset = folder->coffCabStart; j < folder->cCFData; j++ )
+        {
+            if ( offset + sizeof ( struct CFDATA ) > size )
+            {
+                return ERANGE;
+            }
+
+            cfdata = ( const struct CFDATA * ) ( base + offset );
+            crc = crc32 ( crc, ( const Bytef * ) cfdata, sizeof ( struct CFDATA ) );
+            offset += sizeof ( struct CFDATA ) + layout.data_reserve + cfdata->cbData;
+        }
+    }
+
+    *digest = crc;
+
+    return 0;
+}
+
+/* Map and validate sidecar index */
+int load_cabidx ( const char *path, const unsigned char *base, size_t size,
+    struct cabidx_t *cabidx )
+{
+    int fd;
+    size_t i;
+    size_t tables_end;
+    unsigned int digest;
+    struct stat statbuf;
+    const struct CFHEADER *header;
+    const struct CFFOLDER *folder;
+    const struct CABIDX_FOLDER *cabidx_folder;
+    struct cab_layout layout;
+
+    /* Reset sidecar mapping */
+    memset ( cabidx, '\0', sizeof ( struct cabidx_t ) );
+
+    /* Assign header structure pointer */
+    header = ( const struct CFHEADER * ) base;
+    PTR_ASSERT ( header, sizeof ( struct CFHEADER ), base, size );
+
+    /* Open sidecar file */
+    if ( ( fd = open ( path, O_RDONLY ) ) < 0 )
+    {
+        return errno;
+    }
+
+    /* Obtain sidecar length */
+    if ( fstat ( fd, &statbuf ) < 0 )
+    {
+        close ( fd );
+        return errno;
+    }
+
+    cabidx->size = statbuf.st_size;
+
+    /* Validate sidecar length */
+    if ( cabidx->size < sizeof ( struct CABIDX_HEADER ) )
+    {
+        close ( fd );
+        return EINVAL;
+    }
+
+    /* Map sidecar content, windows are faulted in on demand */
+    if ( ( cabidx->base =
+            ( const unsigned char * ) mmap ( NULL, cabidx->size, PROT_READ, MAP_PRIVATE, fd,
+                0 ) ) == MAP_FAILED )
+    {
+        cabidx->base = NULL;
+        close ( fd );
+        return errno;
+    }
+
+    close ( fd );
+
+    /* Sidecar must belong to this cabinet */
+    cabidx->header = ( const struct CABIDX_HEADER * ) cabidx->base;
+    if ( memcmp ( cabidx->header->signature, "ICIX", 4 )
+        || cabidx->header->version != CABIDX_VERSION
+        || cabidx->header->cbCabinet != header->cbCabinet
+        || cabidx->header->setID != header->setID
+        || cabidx->header->cFolders != header->cFolders )
+    {
+        return EINVAL;
+    }
+
+    /* Rebuilt cabinet of same size would seed wrong dictionaries */
+    if ( digest_cabinet ( base, size, &digest ) != 0 || cabidx->header->digest != digest )
+    {
+        return EINVAL;
+    }
+
+    /* Validate folder tables */
+    cabidx->folders =
+        ( const struct CABIDX_FOLDER * ) ( cabidx->base + sizeof ( struct CABIDX_HEADER ) );
+    if ( sizeof ( struct CABIDX_HEADER ) + header->cFolders * sizeof ( struct CABIDX_FOLDER ) >
+        cabidx->size )
+    {
+        return EINVAL;
+    }
+
+    if ( parse_layout ( base, size, &layout ) != 0 )
+    {
+        return EINVAL;
+    }
+
+    for ( i = 0; i < header->cFolders; i++ )
+    {
+        if ( ( folder = layout_folder ( base, size, &layout, i ) ) == NULL )
+        {
+            return ERANGE;
+        }
+        cabidx_folder = &cabidx->folders[i];
+
+        if ( cabidx_folder->cSectors != folder->cCFData )
+        {
+            return EINVAL;
+        }
+
+        tables_end =
+            cabidx_folder->coffSectors + ( cabidx_folder->cSectors +
+            1 ) * sizeof ( struct CABIDX_SECTOR );
+        if ( cabidx_folder->coffSectors > cabidx->size || tables_end > cabidx->size )
+        {
+            return EINVAL;
+        }
+
+        tables_end =
+            cabidx_folder->coffCheckpoints +
+            cabidx_folder->cCheckpoints * sizeof ( struct CABIDX_CHECKPOINT );
+        if ( cabidx_folder->coffCheckpoints > cabidx->size || tables_end > cabidx->size )
+        {
+            return EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+/* Unmap sidecar index */
+void unload_cabidx ( struct cabidx_t *cabidx )
+{
+    if ( cabidx->base != NULL )
+    {
+        munmap ( ( void * ) cabidx->base, cabidx->size );
+        cabidx->base = NULL;
+    }
+}
+
+/* Unlink cache slot from LRU list */
+static void lru_unlink ( struct icab_archive *archive, int slot )
+{
+    struct block_slot *entry = &archive->slots[slot];
+
+    if ( entry->prev >= 0 )
+    {
+        archive->slots[entry->prev].next = entry->next;
+    } else
+    {
+        archive->lru_head = entry->next;
+    }
+
+    if ( entry->next >= 0 )
+    {
+        archive->slots[entry->next].prev = entry->prev;
+    } else
+    {
+        archive->lru_tail = entry->prev;
+    }
+}
+
+/* Place cache slot at most recently used end */
+static void lru_push ( struct icab_archive *archive, int slot )
+{
+    struct block_slot *entry = &archive->slots[slot];
+
+    entry->prev = -1;
+    entry->next = archive->lru_head;
+
+    if ( archive->lru_head >= 0 )
+    {
+        archive->slots[archive->lru_head].prev = slot;
+    } else
+    {
+        archive->lru_tail = slot;
+    }
+
+    archive->lru_head = slot;
+}
+
+/* Store decoded block in least recently used slot */
+static void cache_block ( struct icab_archive *archive, unsigned short nfolder, size_t nsector,
+    const unsigned char *data, size_t size )
+{
+    int slot;
+    struct block_slot *entry;
+
+    /* Block decoded again while walking forward keeps its slot */
+    if ( ( slot = archive->folders[nfolder].slots[nsector] ) >= 0 )
+    {
+        lru_unlink ( archive, slot );
+        lru_push ( archive, slot );
+        return;
+    }
+
+    /* Reuse least recently used slot */
+    slot = archive->lru_tail;
+    entry = &archive->slots[slot];
+    lru_unlink ( archive, slot );
+
+    /* Drop evicted block from its folder map */
+    if ( entry->size != ( size_t ) -1 )
+    {
+        archive->folders[entry->folder].slots[entry->sector] = -1;
+    }
+
+    entry->folder = nfolder;
+    entry->sector = nsector;
+    entry->size = size;
+    memcpy ( entry->data, data, size );
+    archive->folders[nfolder].slots[nsector] = slot;
+
+    lru_push ( archive, slot );
+}
+
+/* Assemble dictionary preceding sector from cached blocks */
+static size_t cached_dictionary ( struct icab_archive *archive,
+    const struct archive_folder *folder, size_t nsector )
+{
+    size_t want;
+    size_t len = 0;
+    size_t copy_len;
+    int slot;
+    const struct block_slot *entry;
+
+    /* Dictionary spans at most window size of preceding output */
+    want = folder->ctx.index[nsector].folder_offset;
+    if ( want > MSZIP_WINDOW_SIZE )
+    {
+        want = MSZIP_WINDOW_SIZE;
+    }
+
+    /* Gather tails of preceding blocks going backwards */
+    while ( len < want && nsector > 0 )
+    {
+        if ( ( slot = folder->slots[--nsector] ) < 0 )
+        {
+            return 0;
+        }
+
+        entry = &archive->slots[slot];
+        copy_len = want - len < entry->size ? want - len : entry->size;
+        memcpy ( archive->window + want - len - copy_len, entry->data + entry->size - copy_len,
+            copy_len );
+        len += copy_len;
+    }
+
+    return len;
+}
+
+/* Load folder sector index on first use */
+static int prepare_folder ( struct icab_archive *archive, unsigned short nfolder )
+{
+    int error_status;
+    size_t i;
+    struct archive_folder *folder = &archive->folders[nfolder];
+
+    if ( folder->slots != NULL )
+    {
+        return 0;
+    }
+
+    /* Index folder sectors */
+    if ( ( error_status =
+            index_folder ( folder->cffolder, &folder->ctx, archive->base, archive->size,
+                archive->cabidx.base != NULL ? &archive->cabidx : NULL, nfolder ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    /* Allocate sector to cache slot map */
+    if ( ( folder->slots = ( int * ) malloc ( ( folder->ctx.n_sectors +
+                    1 ) * sizeof ( int ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    for ( i = 0; i <= folder->ctx.n_sectors; i++ )
+    {
+        folder->slots[i] = -1;
+    }
+
+    return 0;
+}
+
+/* Release folder decoder state */
+static void free_folder_decoder ( struct archive_folder *folder )
+{
+    if ( folder->decoder.lzx != NULL )
+    {
+        lzx_free ( folder->decoder.lzx );
+        folder->decoder.lzx = NULL;
+    }
+
+    if ( folder->decoder.quantum != NULL )
+    {
+        quantum_free ( folder->decoder.quantum );
+        folder->decoder.quantum = NULL;
+    }
+}
+
+/* Restart folder decoder at folder start */
+static int reset_folder_decoder ( struct archive_folder *folder )
+{
+    unsigned int window_bits = ( folder->cffolder->typeCompress >> 8 ) & 0x001F;
+
+    free_folder_decoder ( folder );
+    folder->next_sector = 0;
+
+    if ( ( folder->cffolder->typeCompress & 0x000F ) == 2 )
+    {
+        return quantum_init ( &folder->decoder.quantum, window_bits );
+    }
+
+    return lzx_init ( &folder->decoder.lzx, window_bits );
+}
+
+/* Decode folder sectors forward from last decoded one, caching each */
+static int load_stateful_block ( struct icab_archive *archive, unsigned short nfolder,
+    size_t nsector )
+{
+    int error_status;
+    size_t i;
+    const struct CFDATA *sector;
+    struct archive_folder *folder = &archive->folders[nfolder];
+    struct cfdata_ctx block;
+
+    /* Decoder state only moves forward, going back restarts it */
+    if ( ( folder->decoder.lzx == NULL && folder->decoder.quantum == NULL )
+        || nsector < folder->next_sector )
+    {
+        if ( ( error_status = reset_folder_decoder ( folder ) ) != 0 )
+        {
+            return error_status;
+        }
+    }
+
+    for ( i = folder->next_sector; i <= nsector; i++ )
+    {
+        sector = ( const struct CFDATA * ) ( archive->base + folder->ctx.index[i].cab_offset );
+
+        block.uncompressed = archive->window;
+        block.uncompressed_size = sector->cbUncomp;
+
+        /* Failed block leaves decoder unusable, next read restarts it */
+        if ( ( error_status =
+                uncompress_data ( folder->cffolder->typeCompress,
+                    ( const unsigned char * ) sector + sizeof ( struct CFDATA ), sector->cbData,
+                    &block, &archive->stream, &folder->decoder ) ) != 0 )
+        {
+            free_folder_decoder ( folder );
+            return error_status;
+        }
+
+        cache_block ( archive, nfolder, i, block.uncompressed, block.uncompressed_size );
+        folder->next_sector = i + 1;
+    }
+
+    return 0;
+}
+
+/* Decode folder sector into cache */
+static int load_block ( struct icab_archive *archive, unsigned short nfolder, size_t nsector,
+    int *slot )
+{
+    int error_status;
+    size_t i;
+    size_t start;
+    size_t floor = 0;
+    size_t dict_len = 0;
+    const struct CFDATA *sector;
+    const struct CABIDX_CHECKPOINT *checkpoint = NULL;
+    struct archive_folder *folder = &archive->folders[nfolder];
+    struct cfdata_ctx block;
+
+    /* Serve cached block */
+    if ( ( *slot = folder->slots[nsector] ) >= 0 )
+    {
+        lru_unlink ( archive, *slot );
+        lru_push ( archive, *slot );
+        return 0;
+    }
+
+    /* Quantum and lzx state carries across blocks, decode forward from folder start */
+    if ( ( folder->cffolder->typeCompress & 0x000F ) == 2
+        || ( folder->cffolder->typeCompress & 0x000F ) == 3 )
+    {
+        if ( ( error_status = load_stateful_block ( archive, nfolder, nsector ) ) != 0 )
+        {
+            return error_status;
+        }
+
+        *slot = folder->slots[nsector];
+        return 0;
+    }
+
+    /* Stored blocks need no dictionary */
+    if ( !( folder->cffolder->typeCompress & 0x000F ) )
+    {
+        floor = nsector;
+
+    } else if ( archive->cabidx.base != NULL
+        && ( checkpoint = find_checkpoint ( &archive->cabidx, nfolder, nsector ) ) != NULL )
+    {
+        floor = checkpoint->iCFData;
+    }
+
+    /* Walk back to closest block with cached dictionary */
+    for ( start = nsector; start > floor; start-- )
+    {
+        if ( ( dict_len = cached_dictionary ( archive, folder, start ) ) > 0 )
+        {
+            break;
+        }
+    }
+
+    /* Otherwise start from checkpoint window or folder start */
+    if ( start == floor && checkpoint != NULL )
+    {
+        memcpy ( archive->window, checkpoint->window, checkpoint->cbWindow );
+        dict_len = checkpoint->cbWindow;
+    }
+
+    /* Decode blocks up to requested one and cache each */
+    for ( i = start; i <= nsector; i++ )
+    {
+        sector = ( const struct CFDATA * ) ( archive->base + folder->ctx.index[i].cab_offset );
+
+        /* Keep only dictionary window before block */
+        if ( dict_len > MSZIP_WINDOW_SIZE )
+        {
+            memmove ( archive->window, archive->window + dict_len - MSZIP_WINDOW_SIZE,
+                MSZIP_WINDOW_SIZE );
+            dict_len = MSZIP_WINDOW_SIZE;
+        }
+
+        block.uncompressed = archive->window + dict_len;
+        block.uncompressed_size = sector->cbUncomp;
+
+        /* Reset inflate stream and apply dictionary if any */
+        if ( ( error_status = inflateReset ( &archive->stream ) ) != Z_OK )
+        {
+            return error_status;
+        }
+
+        /* Let inflate refer back to dictionary in place */
+        archive->stream.next_out = block.uncompressed;
+        if ( dict_len
+            && ( error_status =
+                inflateSetDictionaryRef ( &archive->stream, archive->window,
+                    dict_len ) ) != Z_OK )
+        {
+            return error_status;
+        }
+
+        /* Uncompress data into block buffer */
+        if ( ( error_status =
+                uncompress_data ( folder->cffolder->typeCompress,
+                    ( const unsigned char * ) sector + sizeof ( struct CFDATA ), sector->cbData,
+                    &block, &archive->stream, NULL ) ) != 0 )
+        {
+            return error_status;
+        }
+
+        cache_block ( archive, nfolder, i, block.uncompressed, block.uncompressed_size );
+        dict_len += block.uncompressed_size;
+    }
+
+    *slot = folder->slots[nsector];
+
+    return 0;
+}
+
+/* Open cabinet for random access reads */
+int icab_open ( const char *path, size_t cache_blocks, struct icab_archive **archive )
+{
+    int error_status = 0;
+    int fd;
+    size_t i;
+    struct stat statbuf;
+    struct icab_archive *handle;
+    struct cab_layout layout;
+    char cabidx_path[2048];
+
+    /* Cache needs room for dictionary chain */
+    if ( cache_blocks < 2 )
+    {
+        cache_blocks = 2;
+    }
+
+    /* Allocate archive handle */
+    if ( ( handle =
+            ( struct icab_archive * ) calloc ( 1, sizeof ( struct icab_archive ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    handle->lru_head = -1;
+    handle->lru_tail = -1;
+    pthread_mutex_init ( &handle->mutex, NULL );
+
+    /* Open cabinet file */
+    if ( ( fd = open ( path, O_RDONLY ) ) < 0 )
+    {
+        error_status = errno;
+        goto exit;
+    }
+
+    /* Obtain file length */
+    if ( fstat ( fd, &statbuf ) < 0 )
+    {
+        error_status = errno;
+        close ( fd );
+        goto exit;
+    }
+
+    handle->size = statbuf.st_size;
+
+    /* Map file, blocks are faulted in as they are read */
+    if ( ( handle->base =
+            ( const unsigned char * ) mmap ( NULL, handle->size, PROT_READ, MAP_PRIVATE, fd,
+                0 ) ) == MAP_FAILED )
+    {
+        handle->base = NULL;
+        error_status = errno;
+        close ( fd );
+        goto exit;
+    }
+
+    close ( fd );
+
+    /* Verify header signature */
+    handle->header = ( const struct CFHEADER * ) handle->base;
+    if ( handle->size < sizeof ( struct CFHEADER )
+        || memcmp ( handle->header->signature, "MSCF", 4 ) )
+    {
+        error_status = EINVAL;
+        goto exit;
+    }
+
+    /* Parse file table */
+    if ( ( error_status = load_file_table ( handle->base, handle->size, &handle->table ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Use sidecar index if present and matching */
+    snprintf ( cabidx_path, sizeof ( cabidx_path ), "%s.cabidx", path );
+    if ( load_cabidx ( cabidx_path, handle->base, handle->size, &handle->cabidx ) != 0 )
+    {
+        unload_cabidx ( &handle->cabidx );
+    }
+
+    /* Allocate folders table */
+    if ( ( handle->folders =
+            ( struct archive_folder * ) calloc ( handle->header->cFolders + 1,
+                sizeof ( struct archive_folder ) ) ) == NULL )
+    {
+        error_status = ENOMEM;
+        goto exit;
+    }
+
+    if ( ( error_status = parse_layout ( handle->base, handle->size, &layout ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Sector index assumes no per sector reserve */
+    if ( layout.data_reserve )
+    {
+        error_status = ENOTSUP;
+        goto exit;
+    }
+
+    for ( i = 0; i < handle->header->cFolders; i++ )
+    {
+        if ( ( handle->folders[i].cffolder =
+                layout_folder ( handle->base, handle->size, &layout, i ) ) == NULL )
+        {
+            error_status = ERANGE;
+            goto exit;
+        }
+    }
+
+    /* Map window and cached blocks in one arena */
+    if ( ( error_status =
+            arena_init ( &handle->arena,
+                MSZIP_WINDOW_SIZE + CFDATA_MAX_UNCOMP + cache_blocks * ( CFDATA_MAX_UNCOMP +
+                    ARENA_ALIGN ) ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Allocate dictionary window followed by current block */
+    handle->window =
+        ( unsigned char * ) arena_alloc ( &handle->arena,
+        MSZIP_WINDOW_SIZE + CFDATA_MAX_UNCOMP );
+
+    /* Allocate cache slots, all initially free */
+    handle->n_slots = cache_blocks;
+    if ( ( handle->slots =
+            ( struct block_slot * ) calloc ( handle->n_slots,
+                sizeof ( struct block_slot ) ) ) == NULL )
+    {
+        error_status = ENOMEM;
+        goto exit;
+    }
+
+    for ( i = 0; i < handle->n_slots; i++ )
+    {
+        handle->slots[i].data =
+            ( unsigned char * ) arena_alloc ( &handle->arena, CFDATA_MAX_UNCOMP );
+        handle->slots[i].size = ( size_t ) -1;
+        lru_push ( handle, i );
+    }
+
+    /* Initialize inflate stream for raw data */
+    if ( ( error_status = inflateInit2 ( &handle->stream, -15 ) ) != Z_OK )
+    {
+        goto exit;
+    }
+
+    handle->stream_ready = TRUE;
+
+  exit:
+
+    if ( error_status )
+    {
+        icab_close ( handle );
+        return error_status;
+    }
+
+    *archive = handle;
+
+    return 0;
+}
+
+/* Find file entry by name */
+const struct cffile_entry *icab_find ( const struct icab_archive *archive, const char *name )
+{
+    size_t i;
+
+    for ( i = 0; i < archive->table.n_entries; i++ )
+    {
+        if ( !strcmp ( archive->table.entries[i].filename, name ) )
+        {
+            return &archive->table.entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Read file byte range through block cache */
+ssize_t icab_pread ( struct icab_archive *archive, const struct cffile_entry *file, void *buf,
+    size_t len, size_t offset )
+{
+    int error_status = 0;
+    int slot;
+    size_t done = 0;
+    size_t position;
+    size_t nsector;
+    size_t block_off;
+    size_t copy_len;
+    struct archive_folder *folder;
+
+    /* Clamp range to file length */
+    if ( offset >= file->length )
+    {
+        return 0;
+    }
+
+    if ( len > file->length - offset )
+    {
+        len = file->length - offset;
+    }
+
+    /* Files continued from other cabinets are not reachable */
+    if ( file->folder >= archive->header->cFolders )
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    folder = &archive->folders[file->folder];
+    position = ( size_t ) file->offset + offset;
+
+    pthread_mutex_lock ( &archive->mutex );
+
+    /* Index folder on first access */
+    if ( ( error_status = prepare_folder ( archive, file->folder ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    while ( done < len )
+    {
+        /* Locate sector holding current position */
+        if ( ( nsector = find_sector ( &folder->ctx, position ) ) >= folder->ctx.n_sectors )
+        {
+            break;
+        }
+
+        /* Bring sector into cache */
+        if ( ( error_status = load_block ( archive, file->folder, nsector, &slot ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        /* Copy requested part of block */
+        block_off = position - folder->ctx.index[nsector].folder_offset;
+        if ( block_off >= archive->slots[slot].size )
+        {
+            break;
+        }
+
+        copy_len = archive->slots[slot].size - block_off;
+        if ( copy_len > len - done )
+        {
+            copy_len = len - done;
+        }
+
+        memcpy ( ( unsigned char * ) buf + done, archive->slots[slot].data + block_off, copy_len );
+        done += copy_len;
+        position += copy_len;
+    }
+
+  exit:
+
+    pthread_mutex_unlock ( &archive->mutex );
+
+    if ( error_status )
+    {
+        errno = error_status > 0 ? error_status : EIO;
+        return -1;
+    }
+
+    return done;
+}
+
+/* Close random access cabinet */
+void icab_close ( struct icab_archive *archive )
+{
+    size_t i;
+
+    if ( archive->stream_ready )
+    {
+        inflateEnd ( &archive->stream );
+    }
+
+    if ( archive->slots != NULL )
+    {
+        free ( archive->slots );
+    }
+
+    if ( archive->folders != NULL )
+    {
+        for ( i = 0; i < archive->header->cFolders; i++ )
+        {
+            if ( archive->folders[i].ctx.index != NULL )
+            {
+                free ( archive->folders[i].ctx.index );
+            }
+
+            if ( archive->folders[i].slots != NULL )
+            {
+                free ( archive->folders[i].slots );
+            }
+
+            free_folder_decoder ( &archive->folders[i] );
+        }
+
+        free ( archive->folders );
+    }
+
+    arena_free ( &archive->arena );
+
+    free_file_table ( &archive->table );
+    unload_cabidx ( &archive->cabidx );
+
+    if ( archive->base != NULL )
+    {
+        munmap ( ( void * ) archive->base, archive->size );
+    }
+
+    pthread_mutex_destroy ( &archive->mutex );
+    free ( archive );
+}
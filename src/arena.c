@@ -0,0 +1,113 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - Huge Page Backed Arena Allocator
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+/* Map anonymous memory aligned to huge page boundary */
+static unsigned char *map_aligned ( size_t size )
+{
+    unsigned char *base;
+    size_t head;
+
+    /* Over-allocate so aligned range fits */
+    if ( ( base =
+            ( unsigned char * ) mmap ( NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 ) ) == MAP_FAILED )
+    {
+        return NULL;
+    }
+
+    /* Trim unaligned head and spare tail */
+    head = ( HUGE_PAGE_SIZE - ( ( size_t ) base & ( HUGE_PAGE_SIZE - 1 ) ) ) & ( HUGE_PAGE_SIZE -
+        1 );
+    if ( head )
+    {
+        munmap ( base, head );
+    }
+
+    if ( HUGE_PAGE_SIZE - head )
+    {
+        munmap ( base + head + size, HUGE_PAGE_SIZE - head );
+    }
+
+    return base + head;
+}
+
+/* Map arena memory, huge pages preferred for large arenas */
+int arena_init ( struct arena_t *arena, size_t size )
+{
+    memset ( arena, '\0', sizeof ( struct arena_t ) );
+
+    if ( size >= HUGE_PAGE_SIZE / 2 )
+    {
+        /* Round up to whole huge pages */
+        size = ( size + HUGE_PAGE_SIZE - 1 ) & ~( ( size_t ) HUGE_PAGE_SIZE - 1 );
+
+        /* Try reserved huge pages first */
+        if ( ( arena->base =
+                ( unsigned char * ) mmap ( NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 ) ) != MAP_FAILED )
+        {
+            arena->huge = TRUE;
+
+        } else if ( ( arena->base = map_aligned ( size ) ) != NULL )
+        {
+            /* Otherwise ask for transparent huge pages */
+            madvise ( arena->base, size, MADV_HUGEPAGE );
+
+        } else
+        {
+            arena->base = NULL;
+            return errno;
+        }
+
+    } else if ( ( arena->base =
+            ( unsigned char * ) mmap ( NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 ) ) == MAP_FAILED )
+    {
+        arena->base = NULL;
+        return errno;
+    }
+
+    arena->size = size;
+
+    return 0;
+}
+
+/* Take aligned chunk from arena */
+void *arena_alloc ( struct arena_t *arena, size_t len )
+{
+    void *ptr;
+    size_t used;
+
+    used = ( arena->used + ARENA_ALIGN - 1 ) & ~( ( size_t ) ARENA_ALIGN - 1 );
+
+    if ( used > arena->size || len > arena->size - used )
+    {
+        return NULL;
+    }
+
+    ptr = arena->base + used;
+    arena->used = used + len;
+
+    return ptr;
+}
+
+/* Release all chunks at once keeping memory mapped */
+void arena_reset ( struct arena_t *arena )
+{
+    arena->used = 0;
+}
+
+/* Unmap arena memory */
+void arena_free ( struct arena_t *arena )
+{
+    if ( arena->base != NULL )
+    {
+        munmap ( arena->base, arena->size );
+        arena->base = NULL;
+    }
+}
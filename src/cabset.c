@@ -0,0 +1,593 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - Cabinet Set Volumes
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+/* Note files continued from previous or into next volume */
+static int scan_continued ( struct cab_volume *volume )
+{
+    unsigned short i;
+    const struct CFFILE *file;
+    const unsigned char *offset;
+    const unsigned char *limit = volume->base + volume->size;
+
+    if ( volume->header->cFiles && volume->header->coffFiles >= volume->size )
+    {
+        return ERANGE;
+    }
+
+    offset = volume->base + volume->header->coffFiles;
+
+    for ( i = 0; i < volume->header->cFiles; i++ )
+    {
+        file = ( const struct CFFILE * ) offset;
+        PTR_ASSERT ( file, sizeof ( struct CFFILE ), volume->base, volume->size );
+
+        if ( file->iFolder == IFOLD_FROM_PREV || file->iFolder == IFOLD_PREV_AND_NEXT )
+        {
+            volume->from_prev = TRUE;
+        }
+
+        if ( file->iFolder == IFOLD_TO_NEXT || file->iFolder == IFOLD_PREV_AND_NEXT )
+        {
+            volume->to_next = TRUE;
+        }
+
+        offset += sizeof ( struct CFFILE );
+        offset += file_name_len ( offset, limit );
+    }
+
+    return offset > limit ? ERANGE : 0;
+}
+
+/* Unmap single volume */
+static void unmap_volume ( struct cab_volume *volume )
+{
+    if ( volume->base != NULL )
+    {
+        munmap ( ( void * ) volume->base, volume->size );
+        volume->base = NULL;
+    }
+}
+
+/* Map single volume and locate its folders and files */
+static int map_volume ( const char *path, struct cab_volume *volume )
+{
+    int error_status;
+    int fd;
+    struct stat statbuf;
+
+    memset ( volume, '\0', sizeof ( struct cab_volume ) );
+
+    /* Open volume file */
+    if ( ( fd = open ( path, O_RDONLY ) ) < 0 )
+    {
+        return errno;
+    }
+
+    /* Obtain volume length */
+    if ( fstat ( fd, &statbuf ) < 0 )
+    {
+        error_status = errno;
+        close ( fd );
+        return error_status;
+    }
+
+    if ( ( size_t ) statbuf.st_size <= sizeof ( struct CFHEADER ) )
+    {
+        close ( fd );
+        return EINVAL;
+    }
+
+    /* Map volume, each worker walks its folders front to back */
+    volume->size = statbuf.st_size;
+    if ( ( volume->base =
+            ( const unsigned char * ) mmap ( NULL, volume->size, PROT_READ, MAP_PRIVATE, fd,
+                0 ) ) == MAP_FAILED )
+    {
+        volume->base = NULL;
+        error_status = errno;
+        close ( fd );
+        return error_status;
+    }
+
+    close ( fd );
+    madvise ( ( void * ) volume->base, volume->size, MADV_SEQUENTIAL );
+
+    /* Verify header signature */
+    volume->header = ( const struct CFHEADER * ) volume->base;
+    if ( memcmp ( volume->header->signature, "MSCF", 4 ) )
+    {
+        return EINVAL;
+    }
+
+    if ( ( error_status = parse_layout ( volume->base, volume->size, &volume->layout ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    /* Sector index assumes no per sector reserve */
+    if ( volume->layout.data_reserve )
+    {
+        return ENOTSUP;
+    }
+
+    return scan_continued ( volume );
+}
+
+/* Map volume named in neighbour header, looked up next to given cabinet */
+static int add_volume ( struct cab_set *set, const char *path, size_t dir_len,
+    const char *name, size_t *n_alloc )
+{
+    int error_status;
+    struct cab_volume *volumes;
+    char volume_path[2048];
+
+    /* Sequence numbers are sixteen bits */
+    if ( set->n_volumes >= CABSET_MAX_VOLUMES )
+    {
+        return ELOOP;
+    }
+
+    /* Grow volumes table */
+    if ( set->n_volumes == *n_alloc )
+    {
+        if ( ( volumes =
+                ( struct cab_volume * ) realloc ( set->volumes,
+                    *n_alloc * 2 * sizeof ( struct cab_volume ) ) ) == NULL )
+        {
+            return ENOMEM;
+        }
+
+        set->volumes = volumes;
+        *n_alloc *= 2;
+    }
+
+    snprintf ( volume_path, sizeof ( volume_path ), "%.*s%s", ( int ) dir_len, path, name );
+
+    if ( ( error_status = map_volume ( volume_path, &set->volumes[set->n_volumes] ) ) != 0 )
+    {
+        fprintf ( stderr, "Failed to open cabinet volume %s: %i\n", volume_path,
+            error_status );
+        unmap_volume ( &set->volumes[set->n_volumes] );
+        return error_status;
+    }
+
+    set->n_volumes++;
+
+    return 0;
+}
+
+/* Check volume follows the one before it, which keeps name chain from looping */
+static int check_sequence ( const struct cab_volume *prev, const struct cab_volume *volume )
+{
+    if ( volume->header->setID != prev->header->setID
+        || volume->header->iCabinet != prev->header->iCabinet + 1
+        || prev->layout.next_cabinet == NULL || volume->layout.prev_cabinet == NULL )
+    {
+        fprintf ( stderr, "Error: Cabinet %u of set 0x%.4x does not follow cabinet %u\n",
+            volume->header->iCabinet, volume->header->setID, prev->header->iCabinet );
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+/* Check continued file markers pair up across volume boundary */
+static int check_continued ( const struct cab_volume *prev, const struct cab_volume *volume )
+{
+    if ( volume->from_prev != prev->to_next
+        || ( volume->from_prev && ( !prev->header->cFolders || !volume->header->cFolders ) ) )
+    {
+        fprintf ( stderr, "Error: Cabinet %s does not continue folder of previous one\n",
+            prev->layout.next_cabinet );
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+/* Join continued folders into set folders */
+static int merge_folders ( struct cab_set *set )
+{
+    size_t i;
+    size_t j;
+    size_t n_segments = 0;
+    struct cab_volume *volume;
+    const struct CFFOLDER *folder;
+
+    for ( i = 0; i < set->n_volumes; i++ )
+    {
+        n_segments += set->volumes[i].header->cFolders;
+    }
+
+    /* Allocate segments and set folders with closing entry */
+    if ( ( set->segments =
+            ( struct cab_segment * ) malloc ( ( n_segments +
+                    1 ) * sizeof ( struct cab_segment ) ) ) == NULL
+        || ( set->folders =
+            ( size_t * ) malloc ( ( n_segments + 1 ) * sizeof ( size_t ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    for ( i = 0; i < set->n_volumes; i++ )
+    {
+        volume = &set->volumes[i];
+        volume->first_folder = set->n_folders;
+
+        for ( j = 0; j < volume->header->cFolders; j++ )
+        {
+            if ( ( folder =
+                    layout_folder ( volume->base, volume->size, &volume->layout, j ) ) == NULL )
+            {
+                return ERANGE;
+            }
+
+            /* First folder may carry on last one of previous volume */
+            if ( !j && volume->from_prev )
+            {
+                if ( folder->typeCompress !=
+                    set->segments[set->n_segments - 1].folder->typeCompress )
+                {
+                    return EINVAL;
+                }
+
+                volume->first_folder--;
+
+            } else
+            {
+                set->folders[set->n_folders++] = set->n_segments;
+            }
+
+            set->segments[set->n_segments].folder = folder;
+            set->segments[set->n_segments].volume = i;
+            set->n_segments++;
+        }
+    }
+
+    set->folders[set->n_folders] = set->n_segments;
+
+    /* File entries index folders in sixteen bits below continuation markers */
+    if ( set->n_folders >= IFOLD_FROM_PREV )
+    {
+        return EFBIG;
+    }
+
+    return 0;
+}
+
+/* Map every volume of set the given cabinet belongs to */
+int open_cabinet_set ( const char *path, struct cab_set *set )
+{
+    int error_status;
+    size_t i;
+    size_t dir_len = 0;
+    size_t n_alloc = 4;
+    const char *slash;
+    struct cab_volume volume;
+
+    memset ( set, '\0', sizeof ( struct cab_set ) );
+
+    /* Volumes are looked up in directory of given one */
+    if ( ( slash = strrchr ( path, '/' ) ) != NULL )
+    {
+        dir_len = slash - path + 1;
+    }
+
+    if ( ( set->volumes =
+            ( struct cab_volume * ) malloc ( n_alloc * sizeof ( struct cab_volume ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    if ( ( error_status = add_volume ( set, path, 0, path, &n_alloc ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Walk back to first volume, then put volumes in order */
+    while ( set->volumes[set->n_volumes - 1].layout.prev_cabinet != NULL )
+    {
+        if ( ( error_status =
+                add_volume ( set, path, dir_len,
+                    set->volumes[set->n_volumes - 1].layout.prev_cabinet, &n_alloc ) ) != 0
+            || ( error_status =
+                check_sequence ( &set->volumes[set->n_volumes - 1],
+                    &set->volumes[set->n_volumes - 2] ) ) != 0 )
+        {
+            goto exit;
+        }
+    }
+
+    for ( i = 0; i < set->n_volumes / 2; i++ )
+    {
+        volume = set->volumes[i];
+        set->volumes[i] = set->volumes[set->n_volumes - 1 - i];
+        set->volumes[set->n_volumes - 1 - i] = volume;
+    }
+
+    /* Walk forward to last volume */
+    while ( set->volumes[set->n_volumes - 1].layout.next_cabinet != NULL )
+    {
+        if ( ( error_status =
+                add_volume ( set, path, dir_len,
+                    set->volumes[set->n_volumes - 1].layout.next_cabinet, &n_alloc ) ) != 0
+            || ( error_status =
+                check_sequence ( &set->volumes[set->n_volumes - 2],
+                    &set->volumes[set->n_volumes - 1] ) ) != 0 )
+        {
+            goto exit;
+        }
+    }
+
+    /* Ends of set continue nothing */
+    if ( set->volumes[0].from_prev || set->volumes[set->n_volumes - 1].to_next )
+    {
+        fprintf ( stderr, "Error: Cabinet set has files continued past its ends\n" );
+        error_status = EINVAL;
+        goto exit;
+    }
+
+    for ( i = 1; i < set->n_volumes; i++ )
+    {
+        if ( ( error_status =
+                check_continued ( &set->volumes[i - 1], &set->volumes[i] ) ) != 0 )
+        {
+            goto exit;
+        }
+    }
+
+    error_status = merge_folders ( set );
+
+  exit:
+
+    if ( error_status )
+    {
+        close_cabinet_set ( set );
+    }
+
+    return error_status;
+}
+
+/* Parse file tables of all volumes into one, continued files are listed once */
+int load_set_table ( const struct cab_set *set, struct cffile_table *table )
+{
+    size_t i;
+    size_t n_files = 0;
+    size_t suboffset;
+    unsigned short j;
+    unsigned short nfolder;
+    const struct cab_volume *volume;
+    const struct CFFILE *file;
+    const unsigned char *offset;
+    struct cffile_entry *entry;
+
+    /* Reset file table */
+    memset ( table, '\0', sizeof ( struct cffile_table ) );
+
+    for ( i = 0; i < set->n_volumes; i++ )
+    {
+        n_files += set->volumes[i].header->cFiles;
+    }
+
+    /* Allocate entries table and folder buckets with closing entries */
+    table->n_buckets = set->n_folders;
+    if ( ( table->entries =
+            ( struct cffile_entry * ) malloc ( ( n_files +
+                    1 ) * sizeof ( struct cffile_entry ) ) ) == NULL
+        || ( table->buckets =
+            ( size_t * ) calloc ( table->n_buckets + 1, sizeof ( size_t ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    for ( i = 0, n_files = 0; i < set->n_volumes; i++ )
+    {
+        volume = &set->volumes[i];
+        offset = volume->base + volume->header->coffFiles;
+
+        for ( j = 0; j < volume->header->cFiles; j++, n_files++ )
+        {
+            /* Assign file structure pointer, table was walked once on open */
+            file = ( const struct CFFILE * ) offset;
+            suboffset =
+                sizeof ( struct CFFILE ) + file_name_len ( offset + sizeof ( struct CFFILE ),
+                volume->base + volume->size );
+            offset += suboffset;
+
+            /* File continued from previous volume was listed where it starts */
+            if ( file->iFolder == IFOLD_FROM_PREV || file->iFolder == IFOLD_PREV_AND_NEXT )
+            {
+                continue;
+            }
+
+            /* Map volume folder to set folder, bad ones go past last bucket */
+            nfolder = file->iFolder == IFOLD_TO_NEXT ? volume->header->cFolders - 1 :
+                file->iFolder;
+            nfolder = nfolder < volume->header->cFolders ?
+                volume->first_folder + nfolder : set->n_folders;
+
+            entry = &table->entries[table->n_entries++];
+            entry->file = file;
+            entry->filename = ( const char * ) file + sizeof ( struct CFFILE );
+            entry->offset = file->uoffFolderStart;
+            entry->length = file->cbFile;
+            entry->folder = nfolder;
+            entry->nfile = n_files;
+            entry->selected = FALSE;
+        }
+    }
+
+    bucket_file_table ( table );
+
+    return 0;
+}
+
+/* Build sector index of set folder, blocks split across volumes take one entry */
+int index_set_folder ( const struct cab_set *set, size_t nfolder,
+    struct cffolder_ctx *folder_ctx )
+{
+    int split = FALSE;
+    size_t i;
+    size_t j;
+    size_t n_sectors = 0;
+    size_t cab_offset = 0;
+    size_t folder_offset = 0;
+    const struct cab_segment *segment;
+    const struct cab_volume *volume = NULL;
+    const struct CFDATA *sector;
+    struct cfdata_idx *idx;
+
+    for ( i = set->folders[nfolder]; i < set->folders[nfolder + 1]; i++ )
+    {
+        n_sectors += set->segments[i].folder->cCFData;
+    }
+
+    /* Allocate index with closing entry */
+    if ( ( folder_ctx->index =
+            ( struct cfdata_idx * ) malloc ( ( n_sectors +
+                    1 ) * sizeof ( struct cfdata_idx ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    folder_ctx->n_sectors = 0;
+
+    for ( i = set->folders[nfolder]; i < set->folders[nfolder + 1]; i++ )
+    {
+        segment = &set->segments[i];
+        volume = &set->volumes[segment->volume];
+
+        for ( j = 0, cab_offset = segment->folder->coffCabStart; j < segment->folder->cCFData;
+            j++ )
+        {
+            /* Sector data must fit in volume */
+            sector = ( const struct CFDATA * ) ( volume->base + cab_offset );
+            PTR_ASSERT ( sector, sizeof ( struct CFDATA ), volume->base, volume->size );
+            if ( cab_offset + sizeof ( struct CFDATA ) + sector->cbData > volume->size )
+            {
+                return ERANGE;
+            }
+
+            /* Split block starts where its first part lies */
+            idx = &folder_ctx->index[folder_ctx->n_sectors];
+            if ( !split )
+            {
+                idx->cab_offset = cab_offset;
+                idx->folder_offset = folder_offset;
+                idx->volume = segment->volume;
+                idx->pieces = 0;
+            }
+
+            idx->pieces++;
+            cab_offset += sizeof ( struct CFDATA ) + sector->cbData;
+
+            /* Empty last block of volume is continued in next one */
+            split = !sector->cbUncomp && j + 1 == segment->folder->cCFData
+                && i + 1 < set->folders[nfolder + 1];
+            if ( !split )
+            {
+                folder_offset += sector->cbUncomp;
+                folder_ctx->n_sectors++;
+            }
+        }
+    }
+
+    /* Closing entry holds folder totals */
+    idx = &folder_ctx->index[folder_ctx->n_sectors];
+    idx->cab_offset = cab_offset;
+    idx->folder_offset = folder_offset;
+    idx->volume = volume != NULL ? volume - set->volumes : 0;
+    idx->pieces = 0;
+
+    return 0;
+}
+
+/* Locate sector data, parts of split block are joined in scratch buffer */
+int gather_sector ( const struct cab_set *set, const struct cfdata_idx *idx,
+    unsigned char *scratch, const unsigned char **data, size_t *len, int *valid )
+{
+    size_t i;
+    const struct cab_volume *volume = &set->volumes[idx->volume];
+    const struct CFDATA *sector;
+
+    sector = ( const struct CFDATA * ) ( volume->base + idx->cab_offset );
+    *data = ( const unsigned char * ) sector + sizeof ( struct CFDATA );
+    *len = 0;
+    *valid = TRUE;
+
+    for ( i = 0; i < idx->pieces; i++ )
+    {
+        /* Next part opens first folder of next volume */
+        if ( i )
+        {
+            volume++;
+            sector = ( const struct CFDATA * ) ( volume->base +
+                layout_folder ( volume->base, volume->size, &volume->layout, 0 )->coffCabStart );
+        }
+
+        /* Each part carries own checksum */
+        if ( sector->csum
+            && sector->csum != checksum ( ( const unsigned char * ) sector +
+                sizeof ( struct CFDATA ) - sizeof ( unsigned int ),
+                sector->cbData + sizeof ( unsigned int ) ) )
+        {
+            *valid = FALSE;
+        }
+
+        /* Whole block lies in one volume */
+        if ( idx->pieces == 1 )
+        {
+            *len = sector->cbData;
+            return 0;
+        }
+
+        if ( *len + sector->cbData > STREAM_SECTOR_SIZE )
+        {
+            return ERANGE;
+        }
+
+        memcpy ( scratch + *len, ( const unsigned char * ) sector + sizeof ( struct CFDATA ),
+            sector->cbData );
+        *len += sector->cbData;
+    }
+
+    *data = scratch;
+
+    return 0;
+}
+
+/* Unmap volumes and free set tables */
+void close_cabinet_set ( struct cab_set *set )
+{
+    size_t i;
+
+    if ( set->volumes != NULL )
+    {
+        for ( i = 0; i < set->n_volumes; i++ )
+        {
+            unmap_volume ( &set->volumes[i] );
+        }
+
+        free ( set->volumes );
+        set->volumes = NULL;
+    }
+
+    if ( set->segments != NULL )
+    {
+        free ( set->segments );
+        set->segments = NULL;
+    }
+
+    if ( set->folders != NULL )
+    {
+        free ( set->folders );
+        set->folders = NULL;
+    }
+
+    set->n_volumes = 0;
+}
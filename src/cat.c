@@ -0,0 +1,154 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - Random Access CAB File Reader
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+#define CAT_CHUNK_SIZE 65536
+#define CAT_CACHE_BLOCKS 64
+
+/* Show program usage */
+static void show_usage ( void )
+{
+    fprintf ( stderr,
+        "icab-cat [-o offset] [-n length] [-s chunk] [-c cache] file.cab name\n" );
+}
+
+/* Write whole buffer to stream */
+static int write_all ( int fd, const unsigned char *buf, size_t len )
+{
+    ssize_t len_written;
+
+    while ( len )
+    {
+        if ( ( len_written = write ( fd, buf, len ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        buf += len_written;
+        len -= len_written;
+    }
+
+    return 0;
+}
+
+/* Main program */
+int main ( int argc, char *argv[] )
+{
+    int error_status = 0;
+    int i;
+    unsigned long long offset = 0;
+    unsigned long long length = ( unsigned long long ) -1;
+    unsigned int chunk_size = CAT_CHUNK_SIZE;
+    unsigned int cache_blocks = CAT_CACHE_BLOCKS;
+    ssize_t len_read;
+    unsigned char *buffer = NULL;
+    struct icab_archive *archive = NULL;
+    const struct cffile_entry *file;
+
+    /* Parse options */
+    for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++ )
+    {
+        if ( !strcmp ( argv[i], "-o" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%llu", &offset ) > 0 )
+        {
+            i++;
+
+        } else if ( !strcmp ( argv[i], "-n" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%llu", &length ) > 0 )
+        {
+            i++;
+
+        } else if ( !strcmp ( argv[i], "-s" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%u", &chunk_size ) > 0 && chunk_size > 0 )
+        {
+            i++;
+
+        } else if ( !strcmp ( argv[i], "-c" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%u", &cache_blocks ) > 0 )
+        {
+            i++;
+
+        } else
+        {
+            break;
+        }
+    }
+
+    /* Validate arguments count */
+    if ( argc - i != 2 )
+    {
+        show_usage (  );
+        return 1;
+    }
+
+    /* Open cabinet for random access */
+    if ( ( error_status = icab_open ( argv[i], cache_blocks, &archive ) ) != 0 )
+    {
+        fprintf ( stderr, "Failed to open cabinet file: %i\n", error_status );
+        goto exit;
+    }
+
+    /* Look up file by name */
+    if ( ( file = icab_find ( archive, argv[i + 1] ) ) == NULL )
+    {
+        fprintf ( stderr, "File not found in cabinet: %s\n", argv[i + 1] );
+        error_status = ENOENT;
+        goto exit;
+    }
+
+    /* Allocate read buffer */
+    if ( ( buffer = ( unsigned char * ) malloc ( chunk_size ) ) == NULL )
+    {
+        error_status = ENOMEM;
+        goto exit;
+    }
+
+    /* Copy requested range to stdout in chunks */
+    while ( length )
+    {
+        if ( ( len_read =
+                icab_pread ( archive, file, buffer,
+                    length < chunk_size ? ( size_t ) length : chunk_size, offset ) ) < 0 )
+        {
+            fprintf ( stderr, "Failed to read file data: %i\n", errno );
+            error_status = errno;
+            goto exit;
+        }
+
+        if ( !len_read )
+        {
+            break;
+        }
+
+        if ( ( error_status = write_all ( STDOUT_FILENO, buffer, len_read ) ) != 0 )
+        {
+            fprintf ( stderr, "Failed to write output: %i\n", error_status );
+            goto exit;
+        }
+
+        offset += len_read;
+        length -= len_read;
+    }
+
+  exit:
+
+    if ( buffer != NULL )
+    {
+        free ( buffer );
+    }
+
+    if ( archive != NULL )
+    {
+        icab_close ( archive );
+    }
+
+    return error_status;
+}
@@ -0,0 +1,175 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - CFDATA Checksum Routines
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+
+#define GetUi32(p) ( \
+             ((const Byte *)(p))[0]        | \
+    ((unsigned int)((const Byte *)(p))[1] <<  8) | \
+    ((unsigned int)((const Byte *)(p))[2] << 16) | \
+((unsigned int)((const Byte *)(p))[3] << 24))
+
+/* Fold remaining words and tail bytes into checksum */
+static unsigned int checksum_tail ( const unsigned char *p, unsigned int size, unsigned int sum )
+{
+    for ( ; size >= 8; size -= 8 )
+    {
+        sum ^= GetUi32 ( p ) ^ GetUi32 ( p + 4 );
+        p += 8;
+    }
+
+    if ( size >= 4 )
+    {
+        sum ^= GetUi32 ( p );
+        p += 4;
+    }
+
+    size &= 3;
+    if ( size > 2 )
+        sum ^= ( unsigned int ) ( *p++ ) << 16;
+    if ( size > 1 )
+        sum ^= ( unsigned int ) ( *p++ ) << 8;
+    if ( size > 0 )
+        sum ^= ( unsigned int ) ( *p++ );
+
+    return sum;
+}
+
+/* Calculate checksum with plain word loads */
+static unsigned int checksum_scalar ( const unsigned char *p, unsigned int size )
+{
+    return checksum_tail ( p, size, 0 );
+}
+
+#ifdef CHECKSUM_X86
+
+/* Reduce vector lanes to one little endian word */
+__attribute__ ( ( target ( "sse2" ) ) )
+static inline unsigned int checksum_fold128 ( __m128i acc )
+{
+    acc = _mm_xor_si128 ( acc, _mm_srli_si128 ( acc, 8 ) );
+    acc = _mm_xor_si128 ( acc, _mm_srli_si128 ( acc, 4 ) );
+    return ( unsigned int ) _mm_cvtsi128_si32 ( acc );
+}
+
+/* Calculate checksum 16 bytes at a time */
+__attribute__ ( ( target ( "sse2" ) ) )
+static unsigned int checksum_sse2 ( const unsigned char *p, unsigned int size )
+{
+    __m128i acc0 = _mm_setzero_si128 (  );
+    __m128i acc1 = _mm_setzero_si128 (  );
+
+    for ( ; size >= 64; size -= 64, p += 64 )
+    {
+        acc0 = _mm_xor_si128 ( acc0, _mm_loadu_si128 ( ( const __m128i * ) p ) );
+        acc1 = _mm_xor_si128 ( acc1, _mm_loadu_si128 ( ( const __m128i * ) ( p + 16 ) ) );
+        acc0 = _mm_xor_si128 ( acc0, _mm_loadu_si128 ( ( const __m128i * ) ( p + 32 ) ) );
+        acc1 = _mm_xor_si128 ( acc1, _mm_loadu_si128 ( ( const __m128i * ) ( p + 48 ) ) );
+    }
+
+    for ( ; size >= 16; size -= 16, p += 16 )
+    {
+        acc0 = _mm_xor_si128 ( acc0, _mm_loadu_si128 ( ( const __m128i * ) p ) );
+    }
+
+    return checksum_tail ( p, size, checksum_fold128 ( _mm_xor_si128 ( acc0, acc1 ) ) );
+}
+
+/* Calculate checksum 32 bytes at a time */
+__attribute__ ( ( target ( "avx2" ) ) )
+static unsigned int checksum_avx2 ( const unsigned char *p, unsigned int size )
+{
+    __m256i acc0 = _mm256_setzero_si256 (  );
+    __m256i acc1 = _mm256_setzero_si256 (  );
+
+    for ( ; size >= 128; size -= 128, p += 128 )
+    {
+        acc0 = _mm256_xor_si256 ( acc0, _mm256_loadu_si256 ( ( const __m256i * ) p ) );
+        acc1 = _mm256_xor_si256 ( acc1, _mm256_loadu_si256 ( ( const __m256i * ) ( p + 32 ) ) );
+        acc0 = _mm256_xor_si256 ( acc0, _mm256_loadu_si256 ( ( const __m256i * ) ( p + 64 ) ) );
+        acc1 = _mm256_xor_si256 ( acc1, _mm256_loadu_si256 ( ( const __m256i * ) ( p + 96 ) ) );
+    }
+
+    for ( ; size >= 32; size -= 32, p += 32 )
+    {
+        acc0 = _mm256_xor_si256 ( acc0, _mm256_loadu_si256 ( ( const __m256i * ) p ) );
+    }
+
+    acc0 = _mm256_xor_si256 ( acc0, acc1 );
+
+    return checksum_tail ( p, size,
+        checksum_fold128 ( _mm_xor_si128 ( _mm256_castsi256_si128 ( acc0 ),
+                _mm256_extracti128_si256 ( acc0, 1 ) ) ) );
+}
+
+/* Calculate checksum 64 bytes at a time */
+__attribute__ ( ( target ( "avx512f" ) ) )
+static unsigned int checksum_avx512 ( const unsigned char *p, unsigned int size )
+{
+    __m512i acc0 = _mm512_setzero_si512 (  );
+    __m512i acc1 = _mm512_setzero_si512 (  );
+    __m256i acc;
+
+    for ( ; size >= 256; size -= 256, p += 256 )
+    {
+        acc0 = _mm512_xor_si512 ( acc0, _mm512_loadu_si512 ( p ) );
+        acc1 = _mm512_xor_si512 ( acc1, _mm512_loadu_si512 ( p + 64 ) );
+        acc0 = _mm512_xor_si512 ( acc0, _mm512_loadu_si512 ( p + 128 ) );
+        acc1 = _mm512_xor_si512 ( acc1, _mm512_loadu_si512 ( p + 192 ) );
+    }
+
+    for ( ; size >= 64; size -= 64, p += 64 )
+    {
+        acc0 = _mm512_xor_si512 ( acc0, _mm512_loadu_si512 ( p ) );
+    }
+
+    acc0 = _mm512_xor_si512 ( acc0, acc1 );
+    acc = _mm256_xor_si256 ( _mm512_castsi512_si256 ( acc0 ),
+        _mm512_extracti64x4_epi64 ( acc0, 1 ) );
+
+    return checksum_tail ( p, size,
+        checksum_fold128 ( _mm_xor_si128 ( _mm256_castsi256_si128 ( acc ),
+                _mm256_extracti128_si256 ( acc, 1 ) ) ) );
+}
+
+#endif
+
+static unsigned int ( *checksum_impl ) ( const unsigned char *, unsigned int ) = checksum_scalar;
+static pthread_once_t checksum_once = PTHREAD_ONCE_INIT;
+
+/* Pick widest checksum kernel supported by cpu */
+static void checksum_select ( void )
+{
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init (  );
+
+    if ( __builtin_cpu_supports ( "avx512f" ) )
+    {
+        checksum_impl = checksum_avx512;
+
+    } else if ( __builtin_cpu_supports ( "avx2" ) )
+    {
+        checksum_impl = checksum_avx2;
+
+    } else if ( __builtin_cpu_supports ( "sse2" ) )
+    {
+        checksum_impl = checksum_sse2;
+    }
+#endif
+}
+
+/* Calculate cfdata checksum */
+unsigned int checksum ( const unsigned char *p, unsigned int size )
+{
+    pthread_once ( &checksum_once, checksum_select );
+
+    return checksum_impl ( p, size );
+}
@@ -12,19 +12,6 @@ static void show_usage ( void )
     printf ( "icab-clone input.cab output.cab\n" );
 }
 
-/* Calculate file name length */
-static size_t file_name_len ( const unsigned char *offset, const unsigned char *limit )
-{
-    const unsigned char *finish = offset;
-
-    while ( finish < limit && *finish != '\0' )
-    {
-        finish++;
-    }
-
-    return finish - offset + 1;
-}
-
 /* Clone archive info */
 static int icab_clone ( const unsigned char *imem, size_t ilen, unsigned char *omem, size_t olen )
 {
@@ -307,9 +294,9 @@ int main ( int argc, char *argv[] )
 
     olen = statbuf.st_size;
 
-    /* Map input file */
+    /* Map input file, only metadata pages are faulted in */
     if ( ( imem =
-            ( unsigned char * ) mmap ( NULL, ilen, PROT_READ, MAP_PRIVATE | MAP_POPULATE, ifd,
+            ( unsigned char * ) mmap ( NULL, ilen, PROT_READ, MAP_PRIVATE, ifd,
                 0 ) ) == NULL )
     {
         fprintf ( stderr, "Failed to map input file: %i\n", errno );
@@ -0,0 +1,487 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - Structured JSON / CSV Listing
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+/* Listing output buffer */
+struct list_buf
+{
+    unsigned char *data;
+    size_t len;
+    int fd;
+    int error_status;
+};
+
+/* Write buffered output to stream */
+static void list_flush ( struct list_buf *out )
+{
+    size_t off = 0;
+    ssize_t len_written;
+
+    while ( off < out->len && !out->error_status )
+    {
+        if ( ( len_written = write ( out->fd, out->data + off, out->len - off ) ) < 0 )
+        {
+            if ( errno != EINTR )
+            {
+                out->error_status = errno;
+            }
+            continue;
+        }
+
+        off += len_written;
+    }
+
+    out->len = 0;
+}
+
+/* Make room for given number of bytes */
+static inline unsigned char *list_reserve ( struct list_buf *out, size_t len )
+{
+    if ( out->len + len > LIST_BUFFER_SIZE )
+    {
+        list_flush ( out );
+    }
+
+    return out->data + out->len;
+}
+
+/* Append short raw string */
+static void list_put ( struct list_buf *out, const char *str, size_t len )
+{
+    memcpy ( list_reserve ( out, len ), str, len );
+    out->len += len;
+}
+
+/* Append string literal */
+#define list_puts(out, str) list_put ( out, str, sizeof ( str ) - 1 )
+
+/* Append decimal number */
+static void list_putu ( struct list_buf *out, unsigned long long value )
+{
+    char digits[20];
+    unsigned char *ptr;
+    size_t n = 0;
+
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while ( value );
+
+    ptr = list_reserve ( out, n );
+    out->len += n;
+
+    while ( n )
+    {
+        *ptr++ = digits[--n];
+    }
+}
+
+/* Render zero padded decimal number */
+static inline unsigned char *put_pad ( unsigned char *ptr, unsigned int value, size_t width )
+{
+    size_t n = width;
+
+    while ( n )
+    {
+        ptr[--n] = '0' + value % 10;
+        value /= 10;
+    }
+
+    return ptr + width;
+}
+
+/* Append hexadecimal number with fixed width */
+static void list_putx ( struct list_buf *out, unsigned int value, size_t width )
+{
+    unsigned char *ptr;
+    static const char hex[] = "0123456789abcdef";
+
+    ptr = list_reserve ( out, width + 2 );
+    out->len += width + 2;
+    *ptr++ = '0';
+    *ptr++ = 'x';
+
+    while ( width )
+    {
+        ptr[--width] = hex[value & 0xF];
+        value >>= 4;
+    }
+}
+
+/* Append dos date and time as iso 8601 timestamp */
+static void list_put_date ( struct list_buf *out, unsigned short date, unsigned short time )
+{
+    unsigned char *ptr;
+
+    ptr = list_reserve ( out, 19 );
+    out->len += 19;
+
+    ptr = put_pad ( ptr, ( date >> 9 ) + 1980, 4 );
+    *ptr++ = '-';
+    ptr = put_pad ( ptr, ( date >> 5 ) & 0xF, 2 );
+    *ptr++ = '-';
+    ptr = put_pad ( ptr, date & 0x1F, 2 );
+    *ptr++ = 'T';
+    ptr = put_pad ( ptr, time >> 11, 2 );
+    *ptr++ = ':';
+    ptr = put_pad ( ptr, ( time >> 5 ) & 0x3F, 2 );
+    *ptr++ = ':';
+    put_pad ( ptr, ( time & 0x1F ) << 1, 2 );
+}
+
+/* Append file attributes as flags string */
+static void list_put_attribs ( struct list_buf *out, unsigned short attribs )
+{
+    unsigned char *ptr;
+
+    ptr = list_reserve ( out, 6 );
+    out->len += 6;
+    ptr[0] = attribs & _BV ( 6 ) ? 'r' : '-';
+    ptr[1] = attribs & _BV ( 5 ) ? 'h' : '-';
+    ptr[2] = attribs & _BV ( 4 ) ? 's' : '-';
+    ptr[3] = attribs & _BV ( 1 ) ? 'a' : '-';
+    ptr[4] = attribs & _BV ( 0 ) ? 'e' : '-';
+    ptr[5] = attribs & _BV ( 15 ) ? 'u' : '-';
+}
+
+/* Append quoted json string */
+static void list_put_json_str ( struct list_buf *out, const unsigned char *str, size_t len )
+{
+    size_t chunk = 0;
+    unsigned char *ptr;
+    static const char hex[] = "0123456789abcdef";
+
+    ptr = list_reserve ( out, 2 );
+    *ptr++ = '"';
+
+    for ( ; len; len--, str++, chunk-- )
+    {
+        /* Reserve room in chunks, each byte expands to at most six */
+        if ( !chunk )
+        {
+            out->len = ptr - out->data;
+            chunk = len < LIST_CHUNK_SIZE ? len : LIST_CHUNK_SIZE;
+            ptr = list_reserve ( out, chunk * 6 + 1 );
+        }
+
+        if ( *str == '"' || *str == '\\' )
+        {
+            *ptr++ = '\\';
+            *ptr++ = *str;
+
+        } else if ( *str < 0x20 )
+        {
+            *ptr++ = '\\';
+            *ptr++ = 'u';
+            *ptr++ = '0';
+            *ptr++ = '0';
+            *ptr++ = hex[*str >> 4];
+            *ptr++ = hex[*str & 0xF];
+
+        } else
+        {
+            *ptr++ = *str;
+        }
+    }
+
+    *ptr++ = '"';
+    out->len = ptr - out->data;
+}
+
+/* Append quoted csv field */
+static void list_put_csv_str ( struct list_buf *out, const unsigned char *str, size_t len )
+{
+    size_t chunk = 0;
+    unsigned char *ptr;
+
+    ptr = list_reserve ( out, 2 );
+    *ptr++ = '"';
+
+    for ( ; len; len--, str++, chunk-- )
+    {
+        /* Reserve room in chunks, each byte expands to at most two */
+        if ( !chunk )
+        {
+            out->len = ptr - out->data;
+            chunk = len < LIST_CHUNK_SIZE ? len : LIST_CHUNK_SIZE;
+            ptr = list_reserve ( out, chunk * 2 + 1 );
+        }
+
+        if ( *str == '"' )
+        {
+            *ptr++ = '"';
+        }
+        *ptr++ = *str;
+    }
+
+    *ptr++ = '"';
+    out->len = ptr - out->data;
+}
+
+/* Obtain compression method name */
+static const char *compression_name ( unsigned short type_compress )
+{
+    switch ( type_compress & 0x000F )
+    {
+    case 0:
+        return "none";
+    case 1:
+        return "ms-zip";
+    case 2:
+        return "quantum";
+    case 3:
+        return "lzx";
+    }
+
+    return "unknown";
+}
+
+/* Render cabinet header, folders and sectors as json */
+static int list_json_head ( struct list_buf *out, const unsigned char *base, size_t size,
+    int cab_fd, int sectors )
+{
+    int error_status;
+    unsigned short i;
+    unsigned short j;
+    size_t sector;
+    const char *name;
+    const struct CFHEADER *header;
+    const struct CFFOLDER *folder;
+    struct CFDATA data;
+    struct cab_layout layout;
+
+    header = ( const struct CFHEADER * ) base;
+    if ( ( error_status = parse_layout ( base, size, &layout ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    list_puts ( out, "{\"cabinet\":{\"size\":" );
+    list_putu ( out, header->cbCabinet );
+    list_puts ( out, ",\"version_major\":" );
+    list_putu ( out, header->versionMajor );
+    list_puts ( out, ",\"version_minor\":" );
+    list_putu ( out, header->versionMinor );
+    list_puts ( out, ",\"folders\":" );
+    list_putu ( out, header->cFolders );
+    list_puts ( out, ",\"files\":" );
+    list_putu ( out, header->cFiles );
+    list_puts ( out, ",\"flags\":" );
+    list_putu ( out, header->flags );
+    list_puts ( out, ",\"set_id\":" );
+    list_putu ( out, header->setID );
+    list_puts ( out, ",\"seq_number\":" );
+    list_putu ( out, header->iCabinet );
+
+    /* Neighbour volumes of cabinet set */
+    if ( layout.prev_cabinet != NULL )
+    {
+        list_puts ( out, ",\"prev_cabinet\":" );
+        list_put_json_str ( out, ( const unsigned char * ) layout.prev_cabinet,
+            strlen ( layout.prev_cabinet ) );
+    }
+
+    if ( layout.next_cabinet != NULL )
+    {
+        list_puts ( out, ",\"next_cabinet\":" );
+        list_put_json_str ( out, ( const unsigned char * ) layout.next_cabinet,
+            strlen ( layout.next_cabinet ) );
+    }
+
+    list_puts ( out, "},\n\"folders\":[" );
+
+    for ( i = 0; i < header->cFolders; i++ )
+    {
+        if ( ( folder = layout_folder ( base, size, &layout, i ) ) == NULL )
+        {
+            return ERANGE;
+        }
+
+        if ( i )
+        {
+            list_puts ( out, "," );
+        }
+        list_puts ( out, "\n{\"folder\":" );
+        list_putu ( out, i );
+        list_puts ( out, ",\"offset\":" );
+        list_putu ( out, folder->coffCabStart );
+        list_puts ( out, ",\"sectors\":" );
+        list_putu ( out, folder->cCFData );
+        list_puts ( out, ",\"compression\":\"" );
+        name = compression_name ( folder->typeCompress );
+        list_put ( out, name, strlen ( name ) );
+        list_puts ( out, "\",\"type_compress\":" );
+        list_putu ( out, folder->typeCompress );
+
+        /* Sector details are read on request only */
+        if ( !sectors )
+        {
+            list_puts ( out, "}" );
+            continue;
+        }
+
+        list_puts ( out, ",\"data\":[" );
+
+        /* Walk sector headers */
+        sector = folder->coffCabStart;
+        for ( j = 0; j < folder->cCFData; j++ )
+        {
+            if ( ( error_status = read_cfdata ( cab_fd, sector, &data ) ) != 0 )
+            {
+                return error_status;
+            }
+
+            if ( j )
+            {
+                list_puts ( out, "," );
+            }
+            list_puts ( out, "{\"csum\":\"" );
+            list_putx ( out, data.csum, 8 );
+            list_puts ( out, "\",\"compressed_size\":" );
+            list_putu ( out, data.cbData );
+            list_puts ( out, ",\"uncompressed_size\":" );
+            list_putu ( out, data.cbUncomp );
+            list_puts ( out, "}" );
+
+            sector += sizeof ( struct CFDATA ) + layout.data_reserve + data.cbData;
+        }
+
+        list_puts ( out, "]}" );
+    }
+
+    list_puts ( out, "],\n\"files\":[" );
+
+    return 0;
+}
+
+/* Render cabinet listing as json or csv */
+int list_files_structured ( const unsigned char *base, size_t size, int cab_fd, int sectors,
+    int format, int fd )
+{
+    int error_status = 0;
+    unsigned short i;
+    size_t name_len;
+    const char *name;
+    const struct CFHEADER *header;
+    const struct CFFOLDER *folder;
+    const struct CFFILE *file;
+    const unsigned char *offset;
+    struct list_buf out;
+    struct cab_layout layout;
+
+    /* Assign header structure pointer */
+    PTR_ASSERT ( base, sizeof ( struct CFHEADER ), base, size );
+    header = ( const struct CFHEADER * ) base;
+
+    /* Allocate output buffer */
+    memset ( &out, '\0', sizeof ( out ) );
+    out.fd = fd;
+    if ( ( out.data = ( unsigned char * ) malloc ( LIST_BUFFER_SIZE ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    /* Render header part */
+    if ( format == LIST_FORMAT_JSON )
+    {
+        if ( ( error_status = list_json_head ( &out, base, size, cab_fd, sectors ) ) != 0 )
+        {
+            goto exit;
+        }
+
+    } else
+    {
+        list_puts ( &out, "name,size,offset,folder,compression,datetime,attribs\n" );
+    }
+
+    /* Render file entries */
+    if ( ( error_status = parse_layout ( base, size, &layout ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    offset = base + header->coffFiles;
+    for ( i = 0; i < header->cFiles; i++ )
+    {
+        if ( ( unsigned char * ) offset + sizeof ( struct CFFILE ) >= base + size )
+        {
+            error_status = ERANGE;
+            goto exit;
+        }
+
+        file = ( const struct CFFILE * ) offset;
+        offset += sizeof ( struct CFFILE );
+        name_len = file_name_len ( offset, base + size );
+
+        /* Look up folder of file */
+        folder = file->iFolder < header->cFolders ?
+            layout_folder ( base, size, &layout, file->iFolder ) : NULL;
+
+        if ( format == LIST_FORMAT_JSON )
+        {
+            if ( i )
+            {
+                list_puts ( &out, "," );
+            }
+            list_puts ( &out, "\n{\"name\":" );
+            list_put_json_str ( &out, offset, name_len - 1 );
+            list_puts ( &out, ",\"size\":" );
+            list_putu ( &out, file->cbFile );
+            list_puts ( &out, ",\"offset\":" );
+            list_putu ( &out, file->uoffFolderStart );
+            list_puts ( &out, ",\"folder\":" );
+            list_putu ( &out, file->iFolder );
+            list_puts ( &out, ",\"datetime\":\"" );
+            list_put_date ( &out, file->date, file->time );
+            list_puts ( &out, "\",\"attribs\":\"" );
+            list_put_attribs ( &out, file->attribs );
+            list_puts ( &out, "\"}" );
+
+        } else
+        {
+            list_put_csv_str ( &out, offset, name_len - 1 );
+            list_puts ( &out, "," );
+            list_putu ( &out, file->cbFile );
+            list_puts ( &out, "," );
+            list_putu ( &out, file->uoffFolderStart );
+            list_puts ( &out, "," );
+            list_putu ( &out, file->iFolder );
+            list_puts ( &out, "," );
+            if ( folder != NULL )
+            {
+                name = compression_name ( folder->typeCompress );
+                list_put ( &out, name, strlen ( name ) );
+            }
+            list_puts ( &out, "," );
+            list_put_date ( &out, file->date, file->time );
+            list_puts ( &out, "," );
+            list_put_attribs ( &out, file->attribs );
+            list_puts ( &out, "\n" );
+        }
+
+        offset += name_len;
+    }
+
+    if ( format == LIST_FORMAT_JSON )
+    {
+        list_puts ( &out, "]}\n" );
+    }
+
+  exit:
+
+    /* Write out remaining buffered data */
+    list_flush ( &out );
+    if ( !error_status )
+    {
+        error_status = out.error_status;
+    }
+
+    free ( out.data );
+
+    return error_status;
+}
@@ -0,0 +1,746 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - LZX Folder Decoder
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+/* Bit stream reader over one cfdata block */
+struct lzx_bits
+{
+    const unsigned char *ptr;
+    const unsigned char *end;
+    unsigned int buf;
+    unsigned int left;
+    unsigned int overrun;
+};
+
+/* Position slots per window size from 2^15 to 2^21 */
+static const unsigned char lzx_position_slots[] = { 30, 32, 34, 36, 38, 42, 50 };
+
+/* Verbatim bits per position slot */
+static const unsigned char lzx_extra_bits[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12,
+    13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17
+};
+
+/* Match offset base per position slot */
+static const unsigned int lzx_position_base[] = {
+    0, 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536,
+    2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768, 49152, 65536, 98304, 131072,
+    196608, 262144, 393216, 524288, 655360, 786432, 917504, 1048576, 1179648, 1310720,
+    1441792, 1572864, 1703936, 1835008, 1966080
+};
+
+/* Top up bit buffer with 16-bit little endian words */
+static inline void lzx_ensure ( struct lzx_bits *bits, unsigned int n )
+{
+    unsigned int word;
+
+    while ( bits->left < n )
+    {
+        /* Past input end zeros are fed, checked once frame is done */
+        if ( bits->ptr + 1 < bits->end )
+        {
+            word = bits->ptr[0] | ( bits->ptr[1] << 8 );
+            bits->ptr += 2;
+
+        } else if ( bits->ptr < bits->end )
+        {
+            word = bits->ptr[0];
+            bits->ptr++;
+            bits->overrun++;
+
+        } else
+        {
+            word = 0;
+            bits->overrun += 2;
+        }
+
+        bits->buf |= word << ( 16 - bits->left );
+        bits->left += 16;
+    }
+}
+
+/* Read up to 17 bits from stream */
+static inline unsigned int lzx_read ( struct lzx_bits *bits, unsigned int n )
+{
+    unsigned int value;
+
+    if ( !n )
+    {
+        return 0;
+    }
+
+    lzx_ensure ( bits, n );
+    value = bits->buf >> ( 32 - n );
+    bits->buf <<= n;
+    bits->left -= n;
+
+    return value;
+}
+
+/* Decode one huffman symbol, long codes walk overflow tree */
+static inline int lzx_symbol ( struct lzx_bits *bits, const unsigned short *table,
+    const unsigned char *lens, unsigned int n_symbols, unsigned int table_bits )
+{
+    unsigned int sym;
+    unsigned int mask;
+
+    lzx_ensure ( bits, LZX_MAX_CODE_LEN );
+    sym = table[bits->buf >> ( 32 - table_bits )];
+
+    if ( sym >= n_symbols )
+    {
+        mask = 1u << ( 32 - table_bits );
+        do
+        {
+            if ( !( mask >>= 1 ) )
+            {
+                return -1;
+            }
+            sym = table[( sym << 1 ) | ( ( bits->buf & mask ) ? 1 : 0 )];
+        } while ( sym >= n_symbols );
+    }
+
+    bits->buf <<= lens[sym];
+    bits->left -= lens[sym];
+
+    return ( int ) sym;
+}
+
+/* Build decoding table from code lengths */
+static int lzx_make_table ( unsigned int n_symbols, unsigned int table_bits,
+    const unsigned char *lens, unsigned short *table )
+{
+    unsigned int sym;
+    unsigned int bit_num;
+    unsigned int leaf;
+    unsigned int fill;
+    unsigned int next_symbol;
+    unsigned int pos = 0;
+    unsigned int table_mask = 1u << table_bits;
+    unsigned int bit_mask = table_mask >> 1;
+
+    /* Short codes map directly to table entries */
+    for ( bit_num = 1; bit_num <= table_bits; bit_num++ )
+    {
+        for ( sym = 0; sym < n_symbols; sym++ )
+        {
+            if ( lens[sym] != bit_num )
+            {
+                continue;
+            }
+
+            leaf = pos;
+            if ( ( pos += bit_mask ) > table_mask )
+            {
+                return EINVAL;
+            }
+
+            for ( fill = bit_mask; fill-- > 0; )
+            {
+                table[leaf++] = sym;
+            }
+        }
+        bit_mask >>= 1;
+    }
+
+    if ( pos == table_mask )
+    {
+        return 0;
+    }
+
+    /* Mark remaining entries unused */
+    for ( sym = pos; sym < table_mask; sym++ )
+    {
+        table[sym] = 0xFFFF;
+    }
+
+    /* Long codes allocate tree nodes past the table */
+    next_symbol = ( table_mask >> 1 ) < n_symbols ? n_symbols : ( table_mask >> 1 );
+    pos <<= 16;
+    table_mask <<= 16;
+    bit_mask = 1u << 15;
+
+    for ( bit_num = table_bits + 1; bit_num <= LZX_MAX_CODE_LEN; bit_num++ )
+    {
+        for ( sym = 0; sym < n_symbols; sym++ )
+        {
+            if ( lens[sym] != bit_num )
+            {
+                continue;
+            }
+
+            if ( pos >= table_mask )
+            {
+                return EINVAL;
+            }
+
+            leaf = pos >> 16;
+            for ( fill = 0; fill < bit_num - table_bits; fill++ )
+            {
+                if ( table[leaf] == 0xFFFF )
+                {
+                    table[next_symbol << 1] = 0xFFFF;
+                    table[( next_symbol << 1 ) + 1] = 0xFFFF;
+                    table[leaf] = next_symbol++;
+                }
+
+                leaf = table[leaf] << 1;
+                if ( ( pos >> ( 15 - fill ) ) & 1 )
+                {
+                    leaf++;
+                }
+            }
+
+            table[leaf] = sym;
+            pos += bit_mask;
+        }
+        bit_mask >>= 1;
+    }
+
+    /* Incomplete code would leave entries undecodable */
+    return pos == table_mask ? 0 : EINVAL;
+}
+
+/* Read code lengths coded as deltas through pretree */
+static int lzx_read_lens ( struct lzx_state *lzx, struct lzx_bits *bits, unsigned char *lens,
+    unsigned int first, unsigned int last, unsigned int capacity )
+{
+    int error_status;
+    int sym;
+    unsigned int i;
+    unsigned int run;
+    unsigned char len;
+
+    /* Pretree is sent in plain 4-bit lengths */
+    for ( i = 0; i < LZX_PRETREE_SYMBOLS; i++ )
+    {
+        lzx->pretree_len[i] = lzx_read ( bits, 4 );
+    }
+
+    if ( ( error_status =
+            lzx_make_table ( LZX_PRETREE_SYMBOLS, LZX_PRETREE_BITS, lzx->pretree_len,
+                lzx->pretree_table ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    for ( i = first; i < last; )
+    {
+        if ( ( sym =
+                lzx_symbol ( bits, lzx->pretree_table, lzx->pretree_len, LZX_PRETREE_SYMBOLS,
+                    LZX_PRETREE_BITS ) ) < 0 )
+        {
+            return EINVAL;
+        }
+
+        /* Runs may spill past range like reference encoder does */
+        if ( sym == 17 || sym == 18 )
+        {
+            run = sym == 17 ? lzx_read ( bits, 4 ) + 4 : lzx_read ( bits, 5 ) + 20;
+            if ( i + run > capacity )
+            {
+                return EINVAL;
+            }
+            memset ( lens + i, '\0', run );
+            i += run;
+
+        } else if ( sym == 19 )
+        {
+            run = lzx_read ( bits, 1 ) + 4;
+            if ( i + run > capacity || ( sym =
+                    lzx_symbol ( bits, lzx->pretree_table, lzx->pretree_len,
+                        LZX_PRETREE_SYMBOLS, LZX_PRETREE_BITS ) ) < 0 || sym > 16 )
+            {
+                return EINVAL;
+            }
+            len = ( lens[i] + 17 - sym ) % 17;
+            memset ( lens + i, len, run );
+            i += run;
+
+        } else
+        {
+            lens[i] = ( lens[i] + 17 - sym ) % 17;
+            i++;
+        }
+    }
+
+    return 0;
+}
+
+/* Read block header and its trees */
+static int lzx_read_block ( struct lzx_state *lzx, struct lzx_bits *bits )
+{
+    int error_status;
+    unsigned int i;
+
+    /* Odd sized uncompressed block is padded to word */
+    if ( lzx->block_type == LZX_BLOCK_UNCOMPRESSED && ( lzx->block_length & 1 ) )
+    {
+        if ( bits->ptr >= bits->end )
+        {
+            return ENODATA;
+        }
+        bits->ptr++;
+    }
+
+    lzx->block_type = lzx_read ( bits, 3 );
+    lzx->block_length = lzx_read ( bits, 16 ) << 8;
+    lzx->block_length |= lzx_read ( bits, 8 );
+    lzx->block_remaining = lzx->block_length;
+
+    switch ( lzx->block_type )
+    {
+    case LZX_BLOCK_ALIGNED:
+        /* Aligned offset tree precedes verbatim trees */
+        for ( i = 0; i < LZX_ALIGNED_SYMBOLS; i++ )
+        {
+            lzx->aligned_len[i] = lzx_read ( bits, 3 );
+        }
+
+        if ( ( error_status =
+                lzx_make_table ( LZX_ALIGNED_SYMBOLS, LZX_ALIGNED_BITS, lzx->aligned_len,
+                    lzx->aligned_table ) ) != 0 )
+        {
+            return error_status;
+        }
+
+        /* fall through */
+    case LZX_BLOCK_VERBATIM:
+        /* Main tree is sent as literals and then matches */
+        if ( ( error_status =
+                lzx_read_lens ( lzx, bits, lzx->main_len, 0, LZX_NUM_CHARS,
+                    LZX_MAIN_SYMBOLS + LZX_LENS_SAFETY ) ) != 0
+            || ( error_status =
+                lzx_read_lens ( lzx, bits, lzx->main_len, LZX_NUM_CHARS, lzx->main_symbols,
+                    LZX_MAIN_SYMBOLS + LZX_LENS_SAFETY ) ) != 0
+            || ( error_status =
+                lzx_make_table ( lzx->main_symbols, LZX_MAIN_BITS, lzx->main_len,
+                    lzx->main_table ) ) != 0 )
+        {
+            return error_status;
+        }
+
+        /* Call translation starts once 0xE8 can be coded */
+        if ( lzx->main_len[0xE8] )
+        {
+            lzx->intel_started = TRUE;
+        }
+
+        if ( ( error_status =
+                lzx_read_lens ( lzx, bits, lzx->length_len, 0, LZX_LENGTH_SYMBOLS,
+                    LZX_LENGTH_SYMBOLS + LZX_LENS_SAFETY ) ) != 0 )
+        {
+            return error_status;
+        }
+
+        /* Length tree is empty if block has no long matches */
+        for ( i = 0; i < LZX_LENGTH_SYMBOLS && !lzx->length_len[i]; i++ )
+        {
+        }
+
+        lzx->length_empty = i == LZX_LENGTH_SYMBOLS;
+        if ( !lzx->length_empty
+            && ( error_status =
+                lzx_make_table ( LZX_LENGTH_SYMBOLS, LZX_LENGTH_BITS, lzx->length_len,
+                    lzx->length_table ) ) != 0 )
+        {
+            return error_status;
+        }
+        break;
+
+    case LZX_BLOCK_UNCOMPRESSED:
+        /* Stored data starts at next word boundary */
+        lzx->intel_started = TRUE;
+        if ( !bits->left )
+        {
+            lzx_ensure ( bits, 16 );
+        }
+        bits->buf = 0;
+        bits->left = 0;
+
+        /* Repeated offsets are stored in plain */
+        if ( bits->overrun || bits->ptr + 12 > bits->end )
+        {
+            return ENODATA;
+        }
+
+        lzx->R0 = bits->ptr[0] | bits->ptr[1] << 8 | bits->ptr[2] << 16
+            | ( unsigned int ) bits->ptr[3] << 24;
+        lzx->R1 = bits->ptr[4] | bits->ptr[5] << 8 | bits->ptr[6] << 16
+            | ( unsigned int ) bits->ptr[7] << 24;
+        lzx->R2 = bits->ptr[8] | bits->ptr[9] << 8 | bits->ptr[10] << 16
+            | ( unsigned int ) bits->ptr[11] << 24;
+        bits->ptr += 12;
+        break;
+
+    default:
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+/* Copy match from window, source may wrap around window start */
+static inline int lzx_copy_match ( unsigned char *window, unsigned int window_size,
+    unsigned int *posn, unsigned int offset, unsigned int length )
+{
+    unsigned int i;
+    unsigned int back;
+    unsigned char *dest;
+    const unsigned char *src;
+
+    if ( *posn + length > window_size || offset > window_size )
+    {
+        return EINVAL;
+    }
+
+    dest = window + *posn;
+    *posn += length;
+
+    if ( offset > dest - window )
+    {
+        /* Take the part that lies at window end first, it may lie just past dest */
+        back = offset - ( unsigned int ) ( dest - window );
+        src = window + window_size - back;
+        if ( back >= length )
+        {
+            memmove ( dest, src, length );
+            return 0;
+        }
+
+        memmove ( dest, src, back );
+        dest += back;
+        length -= back;
+        src = window;
+
+    } else
+    {
+        src = dest - offset;
+    }
+
+    /* Overlapping match repeats its own output */
+    if ( offset >= length )
+    {
+        memcpy ( dest, src, length );
+
+    } else
+    {
+        for ( i = 0; i < length; i++ )
+        {
+            dest[i] = src[i];
+        }
+    }
+
+    return 0;
+}
+
+/* Decode literals and matches of verbatim or aligned block */
+static int lzx_decode_run ( struct lzx_state *lzx, struct lzx_bits *bits, int *run )
+{
+    int error_status = 0;
+    int sym;
+    int footer;
+    int this_run = *run;
+    unsigned int slot;
+    unsigned int extra;
+    unsigned int length;
+    unsigned int offset;
+    unsigned int R0 = lzx->R0;
+    unsigned int R1 = lzx->R1;
+    unsigned int R2 = lzx->R2;
+    unsigned int posn = lzx->window_posn;
+    unsigned char *window = lzx->window;
+    struct lzx_bits b = *bits;
+
+    /* Hot state stays in locals, window stores cannot alias it */
+    while ( this_run > 0 )
+    {
+        if ( ( sym =
+                lzx_symbol ( &b, lzx->main_table, lzx->main_len, lzx->main_symbols,
+                    LZX_MAIN_BITS ) ) < 0 )
+        {
+            error_status = EINVAL;
+            break;
+        }
+
+        /* Literal goes straight to window */
+        if ( sym < LZX_NUM_CHARS )
+        {
+            window[posn++] = sym;
+            this_run--;
+            continue;
+        }
+
+        /* Match length header, long ones continue in length tree */
+        sym -= LZX_NUM_CHARS;
+        length = sym & 7;
+        if ( length == 7 )
+        {
+            if ( lzx->length_empty || ( footer =
+                    lzx_symbol ( &b, lzx->length_table, lzx->length_len,
+                        LZX_LENGTH_SYMBOLS, LZX_LENGTH_BITS ) ) < 0 )
+            {
+                error_status = EINVAL;
+                break;
+            }
+            length += footer;
+        }
+        length += 2;
+
+        /* First three slots repeat recent offsets */
+        slot = sym >> 3;
+        if ( slot == 0 )
+        {
+            offset = R0;
+
+        } else if ( slot == 1 )
+        {
+            offset = R1;
+            R1 = R0;
+            R0 = offset;
+
+        } else if ( slot == 2 )
+        {
+            offset = R2;
+            R2 = R0;
+            R0 = offset;
+
+        } else
+        {
+            /* Aligned blocks code low three offset bits separately */
+            extra = lzx_extra_bits[slot];
+            offset = lzx_position_base[slot] - 2;
+            if ( lzx->block_type == LZX_BLOCK_ALIGNED && extra >= 3 )
+            {
+                offset += lzx_read ( &b, extra - 3 ) << 3;
+                if ( ( footer =
+                        lzx_symbol ( &b, lzx->aligned_table, lzx->aligned_len,
+                            LZX_ALIGNED_SYMBOLS, LZX_ALIGNED_BITS ) ) < 0 )
+                {
+                    error_status = EINVAL;
+                    break;
+                }
+                offset += footer;
+
+            } else
+            {
+                offset += lzx_read ( &b, extra );
+            }
+
+            R2 = R1;
+            R1 = R0;
+            R0 = offset;
+        }
+
+        if ( ( error_status =
+                lzx_copy_match ( window, lzx->window_size, &posn, offset, length ) ) != 0 )
+        {
+            break;
+        }
+
+        this_run -= length;
+    }
+
+    lzx->R0 = R0;
+    lzx->R1 = R1;
+    lzx->R2 = R2;
+    lzx->window_posn = posn;
+    *bits = b;
+    *run = this_run;
+
+    return error_status;
+}
+
+/* Undo call instruction translation on frame output */
+static void lzx_translate ( const struct lzx_state *lzx, unsigned char *data, size_t len )
+{
+    int curpos;
+    int abs_off;
+    int rel_off;
+    unsigned char *end;
+
+    curpos = ( int ) lzx->intel_curpos;
+    end = data + len - 10;
+
+    while ( data < end )
+    {
+        if ( *data++ != 0xE8 )
+        {
+            curpos++;
+            continue;
+        }
+
+        abs_off = ( int ) ( data[0] | data[1] << 8 | data[2] << 16
+            | ( unsigned int ) data[3] << 24 );
+        if ( abs_off >= -curpos && abs_off < lzx->intel_filesize )
+        {
+            rel_off = abs_off >= 0 ? abs_off - curpos : abs_off + lzx->intel_filesize;
+            data[0] = rel_off;
+            data[1] = rel_off >> 8;
+            data[2] = rel_off >> 16;
+            data[3] = rel_off >> 24;
+        }
+
+        data += 4;
+        curpos += 5;
+    }
+}
+
+/* Decode one cfdata block holding single LZX frame */
+int lzx_decompress ( struct lzx_state *lzx, const unsigned char *in, size_t in_len,
+    unsigned char *out, size_t out_len )
+{
+    int error_status;
+    int this_run;
+    int todo;
+    unsigned int frame_end;
+    struct lzx_bits bits;
+
+    /* Frames never exceed 32K and never cross window end */
+    if ( !out_len || out_len > LZX_FRAME_SIZE
+        || lzx->frame_posn + out_len > lzx->window_size )
+    {
+        return EINVAL;
+    }
+
+    bits.ptr = in;
+    bits.end = in + in_len;
+    bits.buf = 0;
+    bits.left = 0;
+    bits.overrun = 0;
+
+    /* Stream header tells translation file size */
+    if ( !lzx->header_read )
+    {
+        if ( lzx_read ( &bits, 1 ) )
+        {
+            lzx->intel_filesize = lzx_read ( &bits, 16 ) << 16;
+            lzx->intel_filesize |= lzx_read ( &bits, 16 );
+        }
+        lzx->header_read = TRUE;
+    }
+
+    /* Match of previous frame may already cover part of this one */
+    frame_end = lzx->frame_posn + out_len;
+    todo = ( int ) frame_end - ( int ) lzx->window_posn;
+
+    while ( todo > 0 )
+    {
+        if ( !lzx->block_remaining
+            && ( error_status = lzx_read_block ( lzx, &bits ) ) != 0 )
+        {
+            return error_status;
+        }
+
+        this_run = lzx->block_remaining < ( unsigned int ) todo ?
+            ( int ) lzx->block_remaining : todo;
+        todo -= this_run;
+        lzx->block_remaining -= this_run;
+
+        if ( lzx->block_type == LZX_BLOCK_UNCOMPRESSED )
+        {
+            /* Stored bytes are copied as is */
+            if ( bits.ptr + this_run > bits.end )
+            {
+                return ENODATA;
+            }
+            memcpy ( lzx->window + lzx->window_posn, bits.ptr, this_run );
+            lzx->window_posn += this_run;
+            bits.ptr += this_run;
+            continue;
+        }
+
+        if ( ( error_status = lzx_decode_run ( lzx, &bits, &this_run ) ) != 0 )
+        {
+            return error_status;
+        }
+
+        /* Match running past frame end is taken from block */
+        if ( this_run < 0 )
+        {
+            if ( ( unsigned int ) -this_run > lzx->block_remaining )
+            {
+                return EINVAL;
+            }
+            lzx->block_remaining -= -this_run;
+            todo += this_run;
+        }
+    }
+
+    /* Frame must have been decoded from data actually present */
+    if ( bits.overrun * 8 > bits.left )
+    {
+        return ENODATA;
+    }
+
+    memcpy ( out, lzx->window + lzx->frame_posn, out_len );
+
+    /* Translate calls within first frames once enabled */
+    if ( lzx->intel_started && lzx->intel_filesize && lzx->frame < LZX_E8_FRAMES
+        && out_len > 10 )
+    {
+        lzx_translate ( lzx, out, out_len );
+    }
+
+    lzx->intel_curpos += out_len;
+    lzx->frame++;
+
+    /* Wrap window once full */
+    lzx->frame_posn = frame_end;
+    if ( lzx->frame_posn == lzx->window_size )
+    {
+        lzx->frame_posn = 0;
+    }
+
+    if ( lzx->window_posn == lzx->window_size )
+    {
+        lzx->window_posn = 0;
+    }
+
+    return 0;
+}
+
+/* Allocate decoder for folder window size */
+int lzx_init ( struct lzx_state **lzx, unsigned int window_bits )
+{
+    struct lzx_state *state;
+
+    if ( window_bits < LZX_MIN_WINDOW_BITS || window_bits > LZX_MAX_WINDOW_BITS )
+    {
+        return ENOTSUP;
+    }
+
+    if ( ( state = ( struct lzx_state * ) calloc ( 1, sizeof ( struct lzx_state ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    /* Zeroed window keeps corrupt back references deterministic */
+    state->window_size = 1u << window_bits;
+    if ( ( state->window = ( unsigned char * ) calloc ( 1, state->window_size ) ) == NULL )
+    {
+        free ( state );
+        return ENOMEM;
+    }
+
+    state->main_symbols =
+        LZX_NUM_CHARS + lzx_position_slots[window_bits - LZX_MIN_WINDOW_BITS] * 8;
+    state->R0 = 1;
+    state->R1 = 1;
+    state->R2 = 1;
+
+    *lzx = state;
+
+    return 0;
+}
+
+/* Release decoder */
+void lzx_free ( struct lzx_state *lzx )
+{
+    free ( lzx->window );
+    free ( lzx );
+}
@@ -0,0 +1,1014 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - LZX Folder Encoder
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+/* Bit stream writer over consecutive cfdata records */
+struct lzx_writer
+{
+    unsigned char *record;
+    unsigned char *ptr;
+    unsigned char *end;
+    unsigned int buf;
+    unsigned int left;
+    unsigned int frames;
+    int overflow;
+};
+
+/* Position slots per window size from 2^15 to 2^21 */
+static const unsigned char lzx_position_slots[] = { 30, 32, 34, 36, 38, 42, 50 };
+
+/* Verbatim bits per position slot */
+static const unsigned char lzx_extra_bits[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12,
+    13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17
+};
+
+/* Match offset base per position slot */
+static const unsigned int lzx_position_base[] = {
+    0, 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536,
+    2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768, 49152, 65536, 98304, 131072,
+    196608, 262144, 393216, 524288, 655360, 786432, 917504, 1048576, 1179648, 1310720,
+    1441792, 1572864, 1703936, 1835008, 1966080
+};
+
+/* Match finder effort per level after zlib, chains are shorter since
+   every step over a large window is a cache miss, level 0 stores */
+static const struct lzx_preset lzx_presets[LZX_PRESETS] = {
+    {0, 0, 0, 0, TRUE},
+    {4, 4, 8, 4, TRUE},
+    {4, 5, 16, 8, TRUE},
+    {4, 6, 32, 16, TRUE},
+    {4, 4, 16, 16, FALSE},
+    {8, 16, 32, 32, FALSE},
+    {8, 16, 128, 64, FALSE},
+    {8, 32, 128, 128, FALSE},
+    {32, 128, LZX_MAX_MATCH, 256, FALSE},
+    {32, LZX_MAX_MATCH, LZX_MAX_MATCH, 1024, FALSE}
+};
+
+/* Append up to 17 bits as 16-bit little endian words */
+static inline void lzx_put ( struct lzx_writer *w, unsigned int value, unsigned int n )
+{
+    w->buf = ( w->buf << n ) | value;
+    w->left += n;
+
+    while ( w->left >= 16 )
+    {
+        w->left -= 16;
+
+        if ( w->ptr + 2 > w->end )
+        {
+            w->overflow = TRUE;
+            continue;
+        }
+
+        w->ptr[0] = w->buf >> w->left;
+        w->ptr[1] = w->buf >> ( w->left + 8 );
+        w->ptr += 2;
+    }
+}
+
+/* Pad stream to word boundary */
+static inline void lzx_align ( struct lzx_writer *w )
+{
+    if ( w->left )
+    {
+        lzx_put ( w, 0, 16 - w->left );
+    }
+}
+
+/* Append bytes to aligned stream */
+static void lzx_put_raw ( struct lzx_writer *w, const unsigned char *data, size_t len )
+{
+    if ( w->ptr + len > w->end )
+    {
+        w->overflow = TRUE;
+        return;
+    }
+
+    memcpy ( w->ptr, data, len );
+    w->ptr += len;
+}
+
+/* Close frame record, fails if frame outgrew its budget */
+static int lzx_end_frame ( struct lzx_writer *w, unsigned int frame_len, size_t limit )
+{
+    size_t size;
+    struct CFDATA *cfdata;
+
+    /* Decoder drops partial word at every frame end */
+    lzx_align ( w );
+
+    size = w->ptr - w->record - sizeof ( struct CFDATA );
+    if ( w->overflow || size > limit )
+    {
+        return ERANGE;
+    }
+
+    cfdata = ( struct CFDATA * ) w->record;
+    cfdata->cbData = size;
+    cfdata->cbUncomp = frame_len;
+    cfdata->csum =
+        checksum ( w->record + sizeof ( struct CFDATA ) - sizeof ( unsigned int ),
+        size + sizeof ( unsigned int ) );
+
+    /* Next record header is filled once its frame is done */
+    w->record = w->ptr;
+    w->ptr += sizeof ( struct CFDATA );
+    w->frames++;
+
+    return 0;
+}
+
+/* Build length limited huffman code lengths, frequencies get flattened */
+static void lzx_build_lengths ( unsigned int *freq, unsigned int n_symbols, unsigned int limit,
+    unsigned char *lens )
+{
+    unsigned int i;
+    unsigned int j;
+    unsigned int k;
+    unsigned int n;
+    unsigned int sym;
+    unsigned int leaf;
+    unsigned int node;
+    unsigned int max;
+    unsigned int pick[2];
+    unsigned int order[LZX_MAIN_SYMBOLS];
+    unsigned int weight[LZX_MAIN_SYMBOLS * 2];
+    unsigned int parent[LZX_MAIN_SYMBOLS * 2];
+    unsigned int depth[LZX_MAIN_SYMBOLS * 2];
+
+  again:
+
+    memset ( lens, '\0', n_symbols );
+
+    /* Used symbols sorted by frequency, ties by symbol */
+    for ( i = 0, n = 0; i < n_symbols; i++ )
+    {
+        if ( !freq[i] )
+        {
+            continue;
+        }
+
+        for ( j = n++; j && freq[order[j - 1]] > freq[i]; j-- )
+        {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    for ( i = 0; i < n; i++ )
+    {
+        weight[i] = freq[order[i]];
+    }
+
+    /* Leaves and merged nodes both come out in ascending order */
+    for ( k = n, leaf = 0, node = n; k < 2 * n - 1; k++ )
+    {
+        for ( j = 0; j < 2; j++ )
+        {
+            if ( leaf < n && ( node >= k || weight[leaf] <= weight[node] ) )
+            {
+                pick[j] = leaf++;
+
+            } else
+            {
+                pick[j] = node++;
+            }
+        }
+
+        weight[k] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = k;
+        parent[pick[1]] = k;
+    }
+
+    /* Parents always follow children */
+    depth[2 * n - 2] = 0;
+    for ( k = 2 * n - 2, max = 0; k--; )
+    {
+        depth[k] = depth[parent[k]] + 1;
+        if ( k < n && depth[k] > max )
+        {
+            max = depth[k];
+        }
+    }
+
+    if ( max > limit )
+    {
+        for ( i = 0; i < n_symbols; i++ )
+        {
+            if ( freq[i] )
+            {
+                freq[i] = ( freq[i] >> 1 ) + 1;
+            }
+        }
+        goto again;
+    }
+
+    for ( i = 0; i < n; i++ )
+    {
+        sym = order[i];
+        lens[sym] = depth[i];
+    }
+}
+
+/* Keep at least two codes so every tree is complete */
+static void lzx_pad_freq ( unsigned int *freq, unsigned int n_symbols )
+{
+    unsigned int i;
+    unsigned int used;
+
+    for ( i = 0, used = 0; i < n_symbols; i++ )
+    {
+        used += freq[i] != 0;
+    }
+
+    for ( i = 0; used < 2; i++ )
+    {
+        if ( !freq[i] )
+        {
+            freq[i] = 1;
+            used++;
+        }
+    }
+}
+
+/* Assign canonical codes, shorter codes and lower symbols first */
+static void lzx_build_codes ( const unsigned char *lens, unsigned int n_symbols,
+    unsigned short *codes )
+{
+    unsigned int i;
+    unsigned int code;
+    unsigned int count[LZX_MAX_CODE_LEN + 1];
+    unsigned int next[LZX_MAX_CODE_LEN + 1];
+
+    memset ( count, '\0', sizeof ( count ) );
+
+    for ( i = 0; i < n_symbols; i++ )
+    {
+        count[lens[i]]++;
+    }
+
+    count[0] = 0;
+    for ( i = 1, code = 0; i <= LZX_MAX_CODE_LEN; i++ )
+    {
+        code = ( code + count[i - 1] ) << 1;
+        next[i] = code;
+    }
+
+    for ( i = 0; i < n_symbols; i++ )
+    {
+        codes[i] = lens[i] ? next[lens[i]]++ : 0;
+    }
+}
+
+/* Write code lengths of symbol range as pretree coded deltas */
+static void lzx_write_lens ( struct lzx_writer *w, const unsigned char *prev,
+    const unsigned char *lens, unsigned int first, unsigned int last )
+{
+    unsigned int i;
+    unsigned int j;
+    unsigned int n_items;
+    unsigned int freq[LZX_PRETREE_SYMBOLS];
+    unsigned char pre_len[LZX_PRETREE_SYMBOLS];
+    unsigned short pre_code[LZX_PRETREE_SYMBOLS];
+    unsigned short items[LZX_MAIN_SYMBOLS];
+
+    memset ( freq, '\0', sizeof ( freq ) );
+
+    /* Zero runs get own codes, other lengths are sent as delta */
+    for ( i = first, n_items = 0; i < last; i = j )
+    {
+        for ( j = i; j < last && !lens[j] && j - i < 51; j++ )
+        {
+        }
+
+        if ( j - i >= 20 )
+        {
+            items[n_items++] = 18 | ( j - i - 20 ) << 5;
+            freq[18]++;
+            continue;
+        }
+
+        if ( j - i >= 4 )
+        {
+            items[n_items++] = 17 | ( j - i - 4 ) << 5;
+            freq[17]++;
+            continue;
+        }
+
+        j = i + 1;
+        items[n_items] = ( prev[i] + 17 - lens[i] ) % 17;
+        freq[items[n_items++]]++;
+    }
+
+    lzx_pad_freq ( freq, LZX_PRETREE_SYMBOLS );
+    lzx_build_lengths ( freq, LZX_PRETREE_SYMBOLS, 15, pre_len );
+    lzx_build_codes ( pre_len, LZX_PRETREE_SYMBOLS, pre_code );
+
+    for ( i = 0; i < LZX_PRETREE_SYMBOLS; i++ )
+    {
+        lzx_put ( w, pre_len[i], 4 );
+    }
+
+    for ( i = 0; i < n_items; i++ )
+    {
+        j = items[i] & 31;
+        lzx_put ( w, pre_code[j], pre_len[j] );
+
+        if ( j == 17 )
+        {
+            lzx_put ( w, items[i] >> 5, 4 );
+
+        } else if ( j == 18 )
+        {
+            lzx_put ( w, items[i] >> 5, 5 );
+        }
+    }
+}
+
+/* Hash of three bytes at position */
+static inline unsigned int lzx_hash ( const unsigned char *p )
+{
+    return ( ( p[0] << 16 | p[1] << 8 | p[2] ) * 2654435761u ) >> ( 32 - LZX_HASH_BITS );
+}
+
+/* Link positions into hash chains up to given one */
+static inline void lzx_insert ( struct lzx_encoder *lzx, const unsigned char *data,
+    unsigned int upto )
+{
+    unsigned int h;
+
+    for ( ; lzx->hashed < upto; lzx->hashed++ )
+    {
+        h = lzx_hash ( data + lzx->hashed );
+        lzx->prev[lzx->hashed & ( lzx->window_size - 1 )] = lzx->head[h];
+        lzx->head[h] = lzx->hashed;
+    }
+}
+
+/* Count equal bytes, eight at a time */
+static inline unsigned int lzx_match_len ( const unsigned char *a, const unsigned char *b,
+    unsigned int lim )
+{
+    unsigned int len = 0;
+    unsigned long long x;
+    unsigned long long y;
+
+    while ( len + 8 <= lim )
+    {
+        memcpy ( &x, a + len, sizeof ( x ) );
+        memcpy ( &y, b + len, sizeof ( y ) );
+        if ( x != y )
+        {
+            return len + ( __builtin_ctzll ( x ^ y ) >> 3 );
+        }
+        len += 8;
+    }
+
+    while ( len < lim && a[len] == b[len] )
+    {
+        len++;
+    }
+
+    return len;
+}
+
+/* Find best match at position longer than given one, repeated offsets are favoured */
+static unsigned int lzx_find ( struct lzx_encoder *lzx, const unsigned char *data,
+    unsigned int pos, unsigned int lim, unsigned int min_len, int *rep, unsigned int *offset )
+{
+    unsigned int i;
+    unsigned int len;
+    unsigned int best;
+    unsigned int cand;
+    unsigned int next;
+    unsigned int chain;
+    unsigned int hash_len;
+    unsigned int hash_off = 0;
+    unsigned int R[3];
+
+    if ( lim < LZX_MIN_MATCH )
+    {
+        return 0;
+    }
+
+    /* Repeated offsets cost no offset bits */
+    R[0] = lzx->R0;
+    R[1] = lzx->R1;
+    R[2] = lzx->R2;
+
+    for ( i = 0, best = 1, *rep = -1; i < 3; i++ )
+    {
+        if ( R[i] <= pos
+            && ( len = lzx_match_len ( data + pos, data + pos - R[i], lim ) ) > best )
+        {
+            best = len;
+            *rep = i;
+        }
+    }
+
+    /* New offset must beat repeated one by more than a byte */
+    hash_len = best + 1 > 2 ? best + 1 : 2;
+    if ( hash_len < min_len )
+    {
+        hash_len = min_len;
+    }
+
+    if ( best >= lzx->preset.nice || hash_len >= lim )
+    {
+        return *rep >= 0 ? best : 0;
+    }
+
+    /* Good enough match so far shortens search */
+    chain = lzx->preset.chain;
+    if ( hash_len > lzx->preset.good )
+    {
+        chain >>= 2;
+    }
+
+    cand = lzx->head[lzx_hash ( data + pos )];
+
+    for ( ; cand < pos && chain--; cand = next )
+    {
+        if ( pos - cand > lzx->window_size - 3 )
+        {
+            break;
+        }
+
+        if ( data[cand + hash_len] == data[pos + hash_len]
+            && ( len = lzx_match_len ( data + pos, data + cand, lim ) ) > hash_len
+            && ( len > 3 || pos - cand <= LZX_TOO_FAR ) )
+        {
+            hash_len = len;
+            hash_off = pos - cand;
+            if ( len >= lzx->preset.nice || len == lim )
+            {
+                break;
+            }
+        }
+
+        /* Older positions only, overwritten slots end chain */
+        if ( ( next = lzx->prev[cand & ( lzx->window_size - 1 )] ) >= cand )
+        {
+            break;
+        }
+    }
+
+    if ( hash_off )
+    {
+        *rep = -1;
+        *offset = hash_off;
+        return hash_len;
+    }
+
+    return *rep >= 0 ? best : 0;
+}
+
+/* Position slot of formatted offset */
+static inline unsigned int lzx_slot ( unsigned int formatted )
+{
+    unsigned int bit;
+
+    if ( formatted < 4 )
+    {
+        return formatted;
+    }
+
+    if ( formatted >= lzx_position_base[36] )
+    {
+        return 36 + ( ( formatted - lzx_position_base[36] ) >> 17 );
+    }
+
+    bit = 31 - __builtin_clz ( formatted );
+    return bit * 2 + ( ( formatted >> ( bit - 1 ) ) & 1 );
+}
+
+/* Record match token and update repeated offsets */
+static void lzx_emit_match ( struct lzx_encoder *lzx, struct lzx_token *token,
+    unsigned int length, int rep, unsigned int offset )
+{
+    unsigned int slot;
+    unsigned int tmp;
+
+    token->footer = 0;
+
+    if ( rep == 1 )
+    {
+        tmp = lzx->R0;
+        lzx->R0 = lzx->R1;
+        lzx->R1 = tmp;
+
+    } else if ( rep == 2 )
+    {
+        tmp = lzx->R0;
+        lzx->R0 = lzx->R2;
+        lzx->R2 = tmp;
+    }
+
+    if ( rep >= 0 )
+    {
+        slot = rep;
+
+    } else
+    {
+        slot = lzx_slot ( offset + 2 );
+        token->footer = offset + 2 - lzx_position_base[slot];
+        lzx->R2 = lzx->R1;
+        lzx->R1 = lzx->R0;
+        lzx->R0 = offset;
+    }
+
+    token->length = length;
+    token->main = LZX_NUM_CHARS + slot * 8
+        + ( length - LZX_MIN_MATCH < 7 ? length - LZX_MIN_MATCH : 7 );
+}
+
+/* Turn one frame into tokens, matches stay within frame */
+static unsigned int lzx_tokenize ( struct lzx_encoder *lzx, const unsigned char *data,
+    unsigned int len, unsigned int start, unsigned int end, struct lzx_token *tokens )
+{
+    int rep;
+    int next_rep = -1;
+    int have_next = FALSE;
+    unsigned int n;
+    unsigned int pos;
+    unsigned int lim;
+    unsigned int length;
+    unsigned int offset = 0;
+    unsigned int next_len = 0;
+    unsigned int next_offset = 0;
+    unsigned int hash_end;
+
+    /* Hashing needs three bytes */
+    hash_end = len >= 3 ? len - 2 : 0;
+
+    for ( pos = start, n = 0; pos < end; n++ )
+    {
+        lim = end - pos < LZX_MAX_MATCH ? end - pos : LZX_MAX_MATCH;
+
+        if ( have_next )
+        {
+            length = next_len;
+            rep = next_rep;
+            offset = next_offset;
+            have_next = FALSE;
+
+        } else
+        {
+            lzx_insert ( lzx, data, pos < hash_end ? pos : hash_end );
+            length = lzx_find ( lzx, data, pos, lim, 0, &rep, &offset );
+        }
+
+        /* Lazy evaluation defers match if next byte starts longer one */
+        if ( length && !lzx->preset.greedy && length < lzx->preset.lazy && pos + 1 < end )
+        {
+            lzx_insert ( lzx, data, pos + 1 < hash_end ? pos + 1 : hash_end );
+            next_len = lzx_find ( lzx, data, pos + 1, lim - ( lim == end - pos ), length,
+                &next_rep, &next_offset );
+            have_next = next_len > length;
+        }
+
+        if ( !length || have_next )
+        {
+            tokens[n].footer = 0;
+            tokens[n].length = 0;
+            tokens[n].main = data[pos++];
+            continue;
+        }
+
+        lzx_emit_match ( lzx, &tokens[n], length, rep, offset );
+
+        /* Fast levels leave inside of long matches out of hash chains */
+        if ( lzx->preset.greedy && length > lzx->preset.lazy )
+        {
+            lzx_insert ( lzx, data, pos + 1 < hash_end ? pos + 1 : hash_end );
+            lzx->hashed = pos + length;
+        }
+
+        pos += length;
+    }
+
+    return n;
+}
+
+/* Write tokens of given frames as one verbatim block */
+static int lzx_write_verbatim ( struct lzx_encoder *lzx, struct lzx_writer *w,
+    unsigned int first, unsigned int last )
+{
+    int error_status;
+    unsigned int i;
+    unsigned int f;
+    unsigned int slot;
+    unsigned int block_len;
+    const struct lzx_token *start;
+    const struct lzx_token *token;
+    unsigned int main_freq[LZX_MAIN_SYMBOLS];
+    unsigned int length_freq[LZX_LENGTH_SYMBOLS];
+    unsigned char main_len[LZX_MAIN_SYMBOLS];
+    unsigned char length_len[LZX_LENGTH_SYMBOLS];
+    unsigned short main_code[LZX_MAIN_SYMBOLS];
+    unsigned short length_code[LZX_LENGTH_SYMBOLS];
+
+    memset ( main_freq, '\0', sizeof ( main_freq ) );
+    memset ( length_freq, '\0', sizeof ( length_freq ) );
+
+    /* Count symbols of covered frames */
+    start = lzx->tokens + ( first ? lzx->frame_tokens[first - 1] : 0 );
+    for ( token = start; token < lzx->tokens + lzx->frame_tokens[last - 1]; token++ )
+    {
+        main_freq[token->main]++;
+        if ( token->length - LZX_MIN_MATCH >= 7 )
+        {
+            length_freq[token->length - LZX_MIN_MATCH - 7]++;
+        }
+    }
+
+    /* Coded 0xE8 makes decoder start call translation */
+    main_freq[0xE8]++;
+    lzx_pad_freq ( main_freq, lzx->main_symbols );
+    lzx_pad_freq ( length_freq, LZX_LENGTH_SYMBOLS );
+    lzx_build_lengths ( main_freq, lzx->main_symbols, LZX_MAX_CODE_LEN, main_len );
+    lzx_build_lengths ( length_freq, LZX_LENGTH_SYMBOLS, LZX_MAX_CODE_LEN, length_len );
+    lzx_build_codes ( main_len, lzx->main_symbols, main_code );
+    lzx_build_codes ( length_len, LZX_LENGTH_SYMBOLS, length_code );
+
+    for ( f = first, block_len = 0; f < last; f++ )
+    {
+        block_len += lzx->frame_len[f];
+    }
+
+    /* Block header and trees as deltas to previous block */
+    lzx_put ( w, LZX_BLOCK_VERBATIM, 3 );
+    lzx_put ( w, block_len >> 8, 16 );
+    lzx_put ( w, block_len & 0xFF, 8 );
+    lzx_write_lens ( w, lzx->main_len, main_len, 0, LZX_NUM_CHARS );
+    lzx_write_lens ( w, lzx->main_len, main_len, LZX_NUM_CHARS, lzx->main_symbols );
+    lzx_write_lens ( w, lzx->length_len, length_len, 0, LZX_LENGTH_SYMBOLS );
+
+    for ( f = first, token = start; f < last; f++ )
+    {
+        for ( ; token < lzx->tokens + lzx->frame_tokens[f]; token++ )
+        {
+            lzx_put ( w, main_code[token->main], main_len[token->main] );
+
+            if ( !token->length )
+            {
+                continue;
+            }
+
+            if ( token->length - LZX_MIN_MATCH >= 7 )
+            {
+                i = token->length - LZX_MIN_MATCH - 7;
+                lzx_put ( w, length_code[i], length_len[i] );
+            }
+
+            slot = ( token->main - LZX_NUM_CHARS ) >> 3;
+            lzx_put ( w, token->footer, lzx_extra_bits[slot] );
+        }
+
+        /* Frame no smaller than stored one is not worth it */
+        if ( ( error_status =
+                lzx_end_frame ( w, lzx->frame_len[f], lzx->frame_len[f] + 16 ) ) != 0 )
+        {
+            return error_status;
+        }
+    }
+
+    memcpy ( lzx->main_len, main_len, lzx->main_symbols );
+    memcpy ( lzx->length_len, length_len, LZX_LENGTH_SYMBOLS );
+
+    return 0;
+}
+
+/* Write frame as uncompressed block */
+static int lzx_write_stored ( struct lzx_encoder *lzx, struct lzx_writer *w,
+    const unsigned char *data, unsigned int frame )
+{
+    unsigned int i;
+    unsigned char R[12];
+
+    lzx_put ( w, LZX_BLOCK_UNCOMPRESSED, 3 );
+    lzx_put ( w, lzx->frame_len[frame] >> 8, 16 );
+    lzx_put ( w, lzx->frame_len[frame] & 0xFF, 8 );
+
+    /* Stored data starts past one to sixteen padding bits */
+    lzx_put ( w, 0, 16 - w->left );
+
+    /* Offsets as left by matches of frame being replaced */
+    for ( i = 0; i < 12; i++ )
+    {
+        R[i] = lzx->frame_R[frame][i >> 2] >> ( ( i & 3 ) * 8 );
+    }
+
+    lzx_put_raw ( w, R, sizeof ( R ) );
+    lzx_put_raw ( w, data, lzx->frame_len[frame] );
+
+    /* Odd sized block is padded to word */
+    if ( lzx->frame_len[frame] & 1 )
+    {
+        lzx_put_raw ( w, ( const unsigned char * ) "", 1 );
+    }
+
+    return lzx_end_frame ( w, lzx->frame_len[frame], lzx->frame_len[frame] + LZX_FRAME_SLACK );
+}
+
+/* Write each frame as own block, stored as last resort */
+static int lzx_write_frames ( struct lzx_encoder *lzx, struct lzx_writer *w,
+    const unsigned char *data, unsigned int n_frames )
+{
+    int error_status;
+    unsigned int f;
+    struct lzx_writer mark;
+
+    for ( f = 0; f < n_frames; data += lzx->frame_len[f++] )
+    {
+        mark = *w;
+        if ( lzx->preset.chain && lzx_write_verbatim ( lzx, w, f, f + 1 ) == 0 )
+        {
+            continue;
+        }
+
+        *w = mark;
+        if ( ( error_status = lzx_write_stored ( lzx, w, data, f ) ) != 0 )
+        {
+            return error_status;
+        }
+    }
+
+    return 0;
+}
+
+/* Apply call translation that decoder undoes on its output, data begins at given
+   folder offset */
+static void lzx_translate ( unsigned char *data, size_t len, size_t start )
+{
+    int curpos;
+    int rel_off;
+    int abs_off;
+    size_t pos;
+    unsigned char *ptr;
+    unsigned char *end;
+
+    for ( pos = 0; pos + 10 < len && start + pos < ( size_t ) LZX_E8_FRAMES * LZX_FRAME_SIZE;
+        pos += LZX_FRAME_SIZE )
+    {
+        ptr = data + pos;
+        end = data + ( len - pos < LZX_FRAME_SIZE ? len : pos + LZX_FRAME_SIZE ) - 10;
+        curpos = ( int ) ( start + pos );
+
+        while ( ptr < end )
+        {
+            if ( *ptr++ != 0xE8 )
+            {
+                curpos++;
+                continue;
+            }
+
+            rel_off = ( int ) ( ptr[0] | ptr[1] << 8 | ptr[2] << 16
+                | ( unsigned int ) ptr[3] << 24 );
+            if ( rel_off >= -curpos && rel_off < LZX_E8_FILESIZE )
+            {
+                abs_off = rel_off < LZX_E8_FILESIZE - curpos ? rel_off + curpos :
+                    rel_off - LZX_E8_FILESIZE;
+                ptr[0] = abs_off;
+                ptr[1] = abs_off >> 8;
+                ptr[2] = abs_off >> 16;
+                ptr[3] = abs_off >> 24;
+            }
+
+            ptr += 4;
+            curpos += 5;
+        }
+    }
+}
+
+/* Drop oldest input to make room, whole windows keep chain ring slots in place */
+static void lzx_slide ( struct lzx_encoder *lzx, size_t len )
+{
+    unsigned int i;
+    unsigned int shift;
+
+    shift = ( lzx->input_len + len - lzx->input_size + lzx->window_size - 1 )
+        & ~( lzx->window_size - 1 );
+
+    memmove ( lzx->input, lzx->input + shift, lzx->input_len - shift );
+    lzx->input_len -= shift;
+    lzx->position += shift;
+
+    if ( !lzx->preset.chain )
+    {
+        return;
+    }
+
+    /* Positions that left input become empty */
+    lzx->hashed = lzx->hashed > shift ? lzx->hashed - shift : 0;
+
+    for ( i = 0; i < 1u << LZX_HASH_BITS; i++ )
+    {
+        lzx->head[i] = lzx->head[i] == 0xFFFFFFFF || lzx->head[i] < shift ? 0xFFFFFFFF :
+            lzx->head[i] - shift;
+    }
+
+    for ( i = 0; i < lzx->window_size; i++ )
+    {
+        lzx->prev[i] = lzx->prev[i] == 0xFFFFFFFF || lzx->prev[i] < shift ? 0xFFFFFFFF :
+            lzx->prev[i] - shift;
+    }
+}
+
+/* Output size enough for any folder of given length */
+size_t lzx_compress_bound ( size_t len )
+{
+    return ( len + LZX_FRAME_SIZE - 1 ) / LZX_FRAME_SIZE * ( sizeof ( struct CFDATA ) +
+        LZX_FRAME_SIZE + LZX_FRAME_SLACK ) + sizeof ( struct CFDATA );
+}
+
+/* Compress next block of folder data into cfdata records, only last one may end
+   inside a frame */
+int lzx_compress ( struct lzx_encoder *lzx, const unsigned char *data, size_t len,
+    unsigned char *out, size_t out_size, size_t *out_len, unsigned int *n_cfdata )
+{
+    int error_status;
+    unsigned int n_frames;
+    unsigned int n_tokens;
+    size_t pos;
+    size_t block_pos;
+    size_t whole;
+    unsigned char *input;
+    struct lzx_writer w;
+    struct lzx_writer mark;
+    unsigned char main_len[LZX_MAIN_SYMBOLS];
+    unsigned char length_len[LZX_LENGTH_SYMBOLS];
+
+    if ( len > LZX_BLOCK_FRAMES * LZX_FRAME_SIZE || out_size < lzx_compress_bound ( len ) )
+    {
+        return ENOBUFS;
+    }
+
+    /* Window of history stays behind new frames */
+    if ( lzx->input_len + len > lzx->input_size )
+    {
+        lzx_slide ( lzx, len );
+    }
+
+    input = lzx->input;
+    pos = lzx->input_len;
+    memcpy ( input + pos, data, len );
+    lzx->input_len += len;
+
+    lzx_translate ( input + pos, len, lzx->position + pos );
+
+    w.record = out;
+    w.ptr = out + sizeof ( struct CFDATA );
+    w.end = out + out_size;
+    w.buf = 0;
+    w.left = 0;
+    w.frames = 0;
+    w.overflow = FALSE;
+
+    /* Stream header enables call translation, frames end byte aligned */
+    if ( !lzx->started )
+    {
+        lzx_put ( &w, 1, 1 );
+        lzx_put ( &w, LZX_E8_FILESIZE >> 16, 16 );
+        lzx_put ( &w, LZX_E8_FILESIZE & 0xFFFF, 16 );
+        lzx->started = TRUE;
+    }
+
+    len = lzx->input_len;
+
+    while ( pos < len )
+    {
+        /* Tokenize frames of next block */
+        block_pos = pos;
+        for ( n_frames = 0, n_tokens = 0; n_frames < LZX_BLOCK_FRAMES && pos < len; n_frames++ )
+        {
+            lzx->frame_len[n_frames] = len - pos < LZX_FRAME_SIZE ? len - pos : LZX_FRAME_SIZE;
+
+            if ( lzx->preset.chain )
+            {
+                n_tokens +=
+                    lzx_tokenize ( lzx, input, len, pos, pos + lzx->frame_len[n_frames],
+                    lzx->tokens + n_tokens );
+            }
+
+            lzx->frame_tokens[n_frames] = n_tokens;
+            lzx->frame_R[n_frames][0] = lzx->R0;
+            lzx->frame_R[n_frames][1] = lzx->R1;
+            lzx->frame_R[n_frames][2] = lzx->R2;
+            pos += lzx->frame_len[n_frames];
+        }
+
+        /* Trees per frame suit changing data, one block suits uniform data */
+        mark = w;
+        memcpy ( main_len, lzx->main_len, lzx->main_symbols );
+        memcpy ( length_len, lzx->length_len, LZX_LENGTH_SYMBOLS );
+
+        whole = 0;
+        if ( lzx->preset.chain && n_frames > 1
+            && lzx_write_verbatim ( lzx, &w, 0, n_frames ) == 0 )
+        {
+            whole = w.ptr - mark.ptr;
+            memcpy ( lzx->main_len, main_len, lzx->main_symbols );
+            memcpy ( lzx->length_len, length_len, LZX_LENGTH_SYMBOLS );
+        }
+
+        w = mark;
+
+        if ( ( error_status = lzx_write_frames ( lzx, &w, input + block_pos, n_frames ) ) != 0 )
+        {
+            return error_status;
+        }
+
+        /* Writing is cheap next to matching, so smaller layout wins */
+        if ( whole && whole < ( size_t ) ( w.ptr - mark.ptr ) )
+        {
+            w = mark;
+            memcpy ( lzx->main_len, main_len, lzx->main_symbols );
+            memcpy ( lzx->length_len, length_len, LZX_LENGTH_SYMBOLS );
+            lzx_write_verbatim ( lzx, &w, 0, n_frames );
+        }
+    }
+
+    *out_len = w.record - out;
+    *n_cfdata = w.frames;
+
+    return 0;
+}
+
+/* Allocate encoder for folder window size and compression level */
+int lzx_encoder_init ( struct lzx_encoder **lzx, unsigned int window_bits, unsigned int level )
+{
+    struct lzx_encoder *state;
+
+    if ( window_bits < LZX_MIN_WINDOW_BITS || window_bits > LZX_MAX_WINDOW_BITS )
+    {
+        return ENOTSUP;
+    }
+
+    if ( level >= LZX_PRESETS )
+    {
+        return EINVAL;
+    }
+
+    if ( ( state =
+            ( struct lzx_encoder * ) calloc ( 1, sizeof ( struct lzx_encoder ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    state->window_size = 1u << window_bits;
+    state->main_symbols =
+        LZX_NUM_CHARS + lzx_position_slots[window_bits - LZX_MIN_WINDOW_BITS] * 8;
+    state->preset = lzx_presets[level];
+    state->R0 = 1;
+    state->R1 = 1;
+    state->R2 = 1;
+
+    /* Input keeps at least one window of history ahead of a block */
+    state->input_size = 2 * state->window_size + LZX_BLOCK_FRAMES * LZX_FRAME_SIZE;
+    if ( ( state->input = ( unsigned char * ) malloc ( state->input_size ) ) == NULL )
+    {
+        lzx_encoder_free ( state );
+        return ENOMEM;
+    }
+
+    /* Chains span whole window, empty heads never precede a position */
+    if ( state->preset.chain
+        && ( ( state->head =
+                ( unsigned int * ) malloc ( sizeof ( unsigned int ) << LZX_HASH_BITS ) ) == NULL
+            || ( state->prev =
+                ( unsigned int * ) malloc ( sizeof ( unsigned int ) * state->window_size ) ) ==
+            NULL
+            || ( state->tokens =
+                ( struct lzx_token * ) malloc ( sizeof ( struct lzx_token ) * LZX_BLOCK_FRAMES *
+                    LZX_FRAME_SIZE ) ) == NULL ) )
+    {
+        lzx_encoder_free ( state );
+        return ENOMEM;
+    }
+
+    if ( state->head != NULL )
+    {
+        memset ( state->head, 0xFF, sizeof ( unsigned int ) << LZX_HASH_BITS );
+    }
+
+    *lzx = state;
+
+    return 0;
+}
+
+/* Release encoder */
+void lzx_encoder_free ( struct lzx_encoder *lzx )
+{
+    free ( lzx->head );
+    free ( lzx->prev );
+    free ( lzx->tokens );
+    free ( lzx->input );
+    free ( lzx );
+}
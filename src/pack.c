@@ -9,13 +9,14 @@
 /* Show program usage */
 static void show_usage ( void )
 {
-    printf ( "icab-pack schema 0..9 output.cab\n" );
+    printf ( "icab-pack [-q] [--progress-fd fd] [--lzx 15..21] [--volume-size bytes[k|m|g]]"
+        " schema 0..9 output.cab\n" );
 }
 
 /* Obtain files count from folders schema */
-unsigned short get_files_count ( const char *schema )
+size_t get_files_count ( const char *schema )
 {
-    unsigned short n;
+    size_t n;
 
     for ( n = 0; ( schema = strchr ( schema, '\n' ) ) != NULL; schema++ )
     {
@@ -26,7 +27,7 @@ unsigned short get_files_count ( const char *schema )
 }
 
 /* Obtain folders count from folders schema */
-unsigned short get_folders_count ( const char *schema )
+size_t get_folders_count ( const char *schema )
 {
     unsigned int value = 0;
     unsigned int max;
@@ -49,17 +50,43 @@ unsigned short get_folders_count ( const char *schema )
         }
     }
 
-    return ( unsigned short ) ( max + 1 );
+    return ( size_t ) max + 1;
 }
 
-/* Obtain folder statistics */
-int get_folder_stats ( const char *schema, unsigned short folder, unsigned short *n_files,
-    size_t * uncompressed_size )
+/* Skip slashes in file name */
+static void skip_slahses ( const char **filename )
+{
+    const char *slash_ptr;
+    const char *end_ptr;
+
+  again:
+
+    if ( ( slash_ptr = strchr ( *filename, '/' ) ) == NULL )
+    {
+        return;
+    }
+
+    if ( ( end_ptr = strchr ( *filename, '\n' ) ) == NULL )
+    {
+        end_ptr = *filename + strlen ( *filename );
+    }
+
+    if ( slash_ptr < end_ptr )
+    {
+        *filename = slash_ptr + 1;
+        goto again;
+    }
+}
+
+/* Obtain folder statistics and file entries */
+int get_folder_stats ( const char *schema, unsigned short folder, struct CFFILE_FN *files,
+    size_t max_files, size_t *n_files, size_t * uncompressed_size )
 {
     unsigned int chkfolder = 0;
     size_t copy_len;
     const char *separator;
     struct stat statbuf;
+    struct CFFILE_FN *file;
     char path[2048];
 
     for ( *n_files = 0, *uncompressed_size = 0; *schema != '\0'; schema++ )
@@ -78,6 +105,12 @@ int get_folder_stats ( const char *schema, unsigned short folder, unsigned short
             continue;
         }
 
+        if ( *n_files == max_files )
+        {
+            return ENOBUFS;
+        }
+
+        file = files + *n_files;
         *n_files += 1;
 
         if ( ( schema = strchr ( schema, ',' ) ) == NULL )
@@ -110,402 +143,1059 @@ int get_folder_stats ( const char *schema, unsigned short folder, unsigned short
             return EINVAL;
         }
 
+        /* Prepare file structure, content is read while packing */
+        file->uoffFolderStart = *uncompressed_size;
+        file->iFolder = folder;
+        file->date = 0;
+        file->time = 0;
+        file->attribs = 0;
+        file->path = schema;
+        file->filename = schema;
+        skip_slahses ( &file->filename );
+
         *uncompressed_size += statbuf.st_size;
 
-        if ( *separator == '\0' )
+        /* File offsets within folder are thirty two bits wide */
+        if ( *uncompressed_size > CAB_MAX_SIZE )
+        {
+            return EFBIG;
+        }
+
+        file->cbFile = statbuf.st_size;
+
+        if ( *separator == '\0' )
+        {
+            break;
+        }
+
+        schema = separator;
+    }
+
+    return 0;
+}
+
+/* Obtain length of file name ending at schema line end */
+static size_t get_filename_len ( const char *filename )
+{
+    const char *end_ptr;
+
+    if ( ( end_ptr = strchr ( filename, '\n' ) ) == NULL )
+    {
+        return strlen ( filename );
+    }
+
+    return end_ptr - filename;
+}
+
+/* Obtain length of all file entries in folders schema */
+static size_t get_entries_len ( const char *schema )
+{
+    size_t len = 0;
+    const char *filename;
+
+    while ( ( filename = strchr ( schema, ',' ) ) != NULL )
+    {
+        filename++;
+        skip_slahses ( &filename );
+        len += sizeof ( struct CFFILE ) + get_filename_len ( filename ) + 1;
+
+        if ( ( schema = strchr ( filename, '\n' ) ) == NULL )
+        {
+            break;
+        }
+    }
+
+    return len;
+}
+
+/* Read next bytes of folder data, files follow each other */
+static int read_folder ( struct folder_pack_ctx *folder, unsigned char *buf, size_t len )
+{
+    int error_status;
+    ssize_t n;
+    size_t copy_len;
+    const struct CFFILE_FN *file;
+    char path[2048];
+
+    while ( len )
+    {
+        /* Open next file that has data */
+        if ( folder->fd < 0 )
+        {
+            while ( folder->file < folder->n_files && !folder->files[folder->file].cbFile )
+            {
+                folder->file++;
+            }
+
+            if ( folder->file == folder->n_files )
+            {
+                return EIO;
+            }
+
+            file = folder->files + folder->file;
+
+            if ( ( copy_len = get_filename_len ( file->path ) ) >= sizeof ( path ) )
+            {
+                return ENOBUFS;
+            }
+
+            memcpy ( path, file->path, copy_len );
+            path[copy_len] = '\0';
+
+            if ( ( folder->fd = open ( path, O_RDONLY ) ) < 0 )
+            {
+                error_status = errno;
+                fprintf ( stderr, "Failed to open file %s: %i\n", path, error_status );
+                return error_status;
+            }
+
+            folder->file_left = file->cbFile;
+        }
+
+        /* File that shrank since stats is an error */
+        if ( ( n = read ( folder->fd, buf,
+                    len < folder->file_left ? len : folder->file_left ) ) <= 0 )
+        {
+            return n < 0 ? errno : EIO;
+        }
+
+        buf += n;
+        len -= n;
+        folder->file_left -= n;
+
+        if ( !folder->file_left )
+        {
+            close ( folder->fd );
+            folder->fd = -1;
+            folder->file++;
+        }
+    }
+
+    return 0;
+}
+
+/* Obtain output path of volume, further volumes get number before extension */
+static int get_volume_path ( const char *path, unsigned int index, char *buf, size_t size )
+{
+    size_t stem_len;
+    const char *name;
+    const char *dot;
+
+    if ( ( name = strrchr ( path, '/' ) ) == NULL )
+    {
+        name = path;
+    } else
+    {
+        name++;
+    }
+
+    if ( !index || ( dot = strrchr ( name, '.' ) ) == NULL || dot == name )
+    {
+        stem_len = strlen ( path );
+    } else
+    {
+        stem_len = dot - path;
+    }
+
+    if ( !index )
+    {
+        if ( ( size_t ) snprintf ( buf, size, "%s", path ) >= size )
+        {
+            return ENAMETOOLONG;
+        }
+    } else if ( ( size_t ) snprintf ( buf, size, "%.*s%u%s", ( int ) stem_len, path, index + 1,
+            path + stem_len ) >= size )
+    {
+        return ENAMETOOLONG;
+    }
+
+    return 0;
+}
+
+/* Format cabinet and disk names of given volume as stored in set header */
+static int format_volume_names ( const struct pack_volume *vol, unsigned int index, char *buf,
+    size_t size, size_t *len )
+{
+    int error_status;
+    size_t name_len;
+    const char *name;
+    char path[2048];
+
+    if ( ( error_status = get_volume_path ( vol->path, index, path, sizeof ( path ) ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    /* Volumes are looked up next to each other */
+    if ( ( name = strrchr ( path, '/' ) ) == NULL )
+    {
+        name = path;
+    } else
+    {
+        name++;
+    }
+
+    name_len = strlen ( name ) + 1;
+
+    if ( name_len >= size )
+    {
+        return ENAMETOOLONG;
+    }
+
+    memcpy ( buf, name, name_len );
+
+    if ( ( size_t ) snprintf ( buf + name_len, size - name_len, "Disk %u", index + 1 ) >=
+        size - name_len )
+    {
+        return ENAMETOOLONG;
+    }
+
+    *len = name_len + strlen ( buf + name_len ) + 1;
+
+    return 0;
+}
+
+/* Reserve room for tables ahead of sector data, set volumes follow previous one's tables */
+static void plan_volume ( struct pack_volume *vol )
+{
+    size_t cap = vol->limit;
+
+    if ( vol->split )
+    {
+        cap = 2 * vol->meta_prev;
+        if ( cap < vol->limit / 16 )
+        {
+            cap = vol->limit / 16;
+        }
+        if ( cap > vol->limit / 2 )
+        {
+            cap = vol->limit / 2;
+        }
+    }
+
+    vol->reserve = vol->head_len + vol->n_folders * sizeof ( struct CFFOLDER ) + vol->files_len
+        + ( vol->meta_left < cap ? vol->meta_left : cap );
+}
+
+/* Start filling given volume of cabinet */
+static int reset_volume ( struct pack_volume *vol, unsigned int index )
+{
+    int error_status;
+    size_t len;
+    char names[2048 + 32];
+    char path[2048];
+
+    if ( index >= CABSET_MAX_VOLUMES )
+    {
+        return EFBIG;
+    }
+
+    vol->index = index;
+    vol->head_len = sizeof ( struct CFHEADER );
+    vol->files_len = 0;
+    vol->n_folders = 0;
+    vol->n_files = 0;
+    vol->folder_files = 0;
+    vol->data_len = 0;
+
+    /* Previous volume name is known ahead */
+    if ( index )
+    {
+        if ( ( error_status =
+                format_volume_names ( vol, index - 1, names, sizeof ( names ), &len ) ) != 0 )
+        {
+            return error_status;
+        }
+        vol->head_len += len;
+    }
+
+    /* Keep room for next volume name, last volume just ends up shorter */
+    if ( vol->split )
+    {
+        if ( ( error_status =
+                format_volume_names ( vol, index + 1, names, sizeof ( names ), &len ) ) != 0 )
+        {
+            return error_status;
+        }
+        vol->head_len += len;
+    }
+
+    /* Further volumes go to own files, sectors are written as they come */
+    if ( index )
+    {
+        if ( ( error_status = get_volume_path ( vol->path, index, path, sizeof ( path ) ) ) != 0 )
+        {
+            return error_status;
+        }
+
+        if ( ( vol->fd = open ( path, O_CREAT | O_WRONLY | O_TRUNC, 0644 ) ) < 0 )
+        {
+            error_status = errno;
+            fprintf ( stderr, "Failed to open output file %s: %i\n", path, error_status );
+            return error_status;
+        }
+    }
+
+    plan_volume ( vol );
+
+    return 0;
+}
+
+/* Obtain room left for sector data after adding entries and sectors, negative when full */
+static ssize_t get_volume_room ( const struct pack_volume *vol, size_t n_entries,
+    size_t entries_len, size_t n_sectors )
+{
+    size_t meta;
+    size_t used;
+
+    /* Header counters are sixteen bits wide */
+    if ( vol->n_files + n_entries > CAB_MAX_COUNT || ( n_sectors
+            && vol->folders[vol->n_folders - 1].cCFData + n_sectors > CAB_MAX_COUNT ) )
+    {
+        return -1;
+    }
+
+    /* Tables may outgrow their reserve until first sector is written behind it */
+    meta = vol->head_len + vol->n_folders * sizeof ( struct CFFOLDER ) + vol->files_len +
+        entries_len;
+
+    if ( meta > vol->reserve && vol->data_len )
+    {
+        return -1;
+    }
+
+    used = ( meta > vol->reserve ? meta : vol->reserve ) + vol->data_len +
+        n_sectors * sizeof ( struct CFDATA );
+
+    if ( used > vol->limit )
+    {
+        return -1;
+    }
+
+    return vol->limit - used;
+}
+
+/* Fix tables reserve before first sector of volume, with room for entries listed ahead */
+static void fix_volume_reserve ( struct pack_volume *vol, size_t ahead_len )
+{
+    size_t meta;
+
+    meta = vol->head_len + vol->n_folders * sizeof ( struct CFFOLDER ) + vol->files_len +
+        ahead_len;
+
+    if ( !vol->data_len && meta > vol->reserve )
+    {
+        vol->reserve = meta;
+    }
+}
+
+/* Open folder segment in current volume */
+static int add_volume_folder ( struct pack_volume *vol, unsigned short type_compress )
+{
+    size_t alloc;
+    struct CFFOLDER *folders;
+
+    /* Grow folders table */
+    if ( vol->n_folders == vol->folders_alloc )
+    {
+        alloc = vol->folders_alloc ? vol->folders_alloc * 2 : 16;
+        if ( ( folders = ( struct CFFOLDER * ) realloc ( vol->folders,
+                    alloc * sizeof ( struct CFFOLDER ) ) ) == NULL )
+        {
+            return ENOMEM;
+        }
+        vol->folders = folders;
+        vol->folders_alloc = alloc;
+    }
+
+    /* Sectors offset is relative to data until volume is saved */
+    vol->folders[vol->n_folders].coffCabStart = vol->data_len;
+    vol->folders[vol->n_folders].cCFData = 0;
+    vol->folders[vol->n_folders].typeCompress = type_compress;
+    vol->n_folders++;
+    vol->folder_files = vol->n_files;
+
+    return 0;
+}
+
+/* List file entry in current volume */
+static int add_volume_file ( struct pack_volume *vol, const struct CFFILE_FN *file,
+    unsigned short ifolder )
+{
+    size_t alloc;
+    size_t len;
+    struct CFFILE_FN *files;
+
+    /* Grow files table */
+    if ( vol->n_files == vol->files_alloc )
+    {
+        alloc = vol->files_alloc ? vol->files_alloc * 2 : 256;
+        if ( ( files = ( struct CFFILE_FN * ) realloc ( vol->files,
+                    alloc * sizeof ( struct CFFILE_FN ) ) ) == NULL )
+        {
+            return ENOMEM;
+        }
+        vol->files = files;
+        vol->files_alloc = alloc;
+    }
+
+    len = sizeof ( struct CFFILE ) + get_filename_len ( file->filename ) + 1;
+
+    vol->files[vol->n_files] = *file;
+    vol->files[vol->n_files].iFolder = ifolder;
+    vol->n_files++;
+    vol->files_len += len;
+    vol->meta_left -= vol->meta_left < len ? vol->meta_left : len;
+
+    return 0;
+}
+
+/* Append part of compressed sector to volume file, split part header goes over bytes
+   already written */
+static int add_volume_sector ( struct pack_volume *vol, const struct CFDATA *cfdata,
+    unsigned char *data, size_t len, int final )
+{
+    struct CFDATA *sector = ( struct CFDATA * ) ( data - sizeof ( struct CFDATA ) );
+
+    /* Whole sector keeps its checksum, each split part gets own one */
+    if ( len != cfdata->cbData )
+    {
+        sector->cbData = len;
+        sector->cbUncomp = final ? cfdata->cbUncomp : 0;
+        sector->csum = checksum ( data - sizeof ( unsigned int ), len + sizeof ( unsigned int ) );
+    }
+
+    len += sizeof ( struct CFDATA );
+
+    if ( ( size_t ) pwrite ( vol->fd, sector, len, vol->reserve + vol->data_len ) != len )
+    {
+        return errno ? errno : EIO;
+    }
+
+    vol->data_len += len;
+    vol->folders[vol->n_folders - 1].cCFData++;
+
+    return 0;
+}
+
+/* Save header and tables in front of volume sectors */
+static int write_volume ( struct pack_volume *vol, int last )
+{
+    int error_status = 0;
+    size_t i;
+    size_t len;
+    size_t names_len = 0;
+    size_t meta_len;
+    size_t data_off;
+    unsigned char *meta = NULL;
+    unsigned char *ptr;
+    struct CFHEADER header;
+    char names[2 * ( 2048 + 32 )];
+
+    /* Name neighbour volumes */
+    if ( vol->index )
+    {
+        if ( ( error_status =
+                format_volume_names ( vol, vol->index - 1, names, sizeof ( names ),
+                    &len ) ) != 0 )
+        {
+            goto exit;
+        }
+        names_len += len;
+    }
+
+    if ( !last )
+    {
+        if ( ( error_status =
+                format_volume_names ( vol, vol->index + 1, names + names_len,
+                    sizeof ( names ) - names_len, &len ) ) != 0 )
+        {
+            goto exit;
+        }
+        names_len += len;
+    }
+
+    /* Prepare header structure */
+    memset ( &header, '\0', sizeof ( header ) );
+    header.signature[0] = 0x4d;
+    header.signature[1] = 0x53;
+    header.signature[2] = 0x43;
+    header.signature[3] = 0x46;
+    header.versionMinor = 3;
+    header.versionMajor = 1;
+    header.flags = ( vol->index ? CAB_FLAG_PREV : 0 ) | ( last ? 0 : CAB_FLAG_NEXT );
+    header.cFolders = vol->n_folders;
+    header.cFiles = vol->n_files;
+    header.setID = vol->set_id;
+    header.iCabinet = vol->index;
+    header.coffFiles = sizeof ( header ) + names_len + vol->n_folders * sizeof ( struct CFFOLDER );
+
+    /* Sectors stay where reserve put them, unused reserve is a gap readers skip */
+    meta_len = header.coffFiles + vol->files_len;
+    data_off = vol->data_len ? vol->reserve : meta_len;
+    header.cbCabinet = data_off + vol->data_len;
+
+    for ( i = 0; i < vol->n_folders; i++ )
+    {
+        vol->folders[i].coffCabStart += data_off;
+    }
+
+    if ( ( meta = ( unsigned char * ) malloc ( meta_len ) ) == NULL )
+    {
+        error_status = ENOMEM;
+        goto exit;
+    }
+
+    /* Gather header, set names, folders and files structures */
+    memcpy ( meta, &header, sizeof ( header ) );
+    memcpy ( meta + sizeof ( header ), names, names_len );
+    ptr = meta + sizeof ( header ) + names_len;
+    memcpy ( ptr, vol->folders, vol->n_folders * sizeof ( struct CFFOLDER ) );
+    ptr += vol->n_folders * sizeof ( struct CFFOLDER );
+
+    for ( i = 0; i < vol->n_files; i++ )
+    {
+        len = get_filename_len ( vol->files[i].filename );
+        memcpy ( ptr, ( struct CFFILE * ) &vol->files[i], sizeof ( struct CFFILE ) );
+        ptr += sizeof ( struct CFFILE );
+        memcpy ( ptr, vol->files[i].filename, len );
+        ptr += len;
+        *ptr++ = '\0';
+    }
+
+    if ( ( size_t ) pwrite ( vol->fd, meta, meta_len, 0 ) != meta_len )
+    {
+        error_status = errno ? errno : EIO;
+        goto exit;
+    }
+
+    /* Next volume reserve follows these tables */
+    vol->meta_prev = meta_len - sizeof ( header ) - names_len;
+
+  exit:
+
+    if ( meta != NULL )
+    {
+        free ( meta );
+    }
+
+    if ( vol->index )
+    {
+        close ( vol->fd );
+        vol->fd = -1;
+    }
+
+    return error_status;
+}
+
+/* Save current volume and start next one */
+static int next_volume ( struct pack_volume *vol )
+{
+    int error_status;
+
+    /* Single cabinet cannot grow past format limits */
+    if ( !vol->split )
+    {
+        fprintf ( stderr, "Cabinet exceeds format limits, use --volume-size\n" );
+        return EFBIG;
+    }
+
+    if ( ( error_status = write_volume ( vol, FALSE ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    return reset_volume ( vol, vol->index + 1 );
+}
+
+/* Cut volume inside sector at given folder offset, files crossing it continue in next volume */
+static int continue_volume ( struct pack_volume *vol, size_t offset )
+{
+    int error_status;
+    size_t i;
+    size_t first;
+    size_t n_carry;
+    unsigned short type_compress = vol->folders[vol->n_folders - 1].typeCompress;
+
+    /* Entries are ordered, so files touching split sector form the tail */
+    for ( first = vol->folder_files; first < vol->n_files; first++ )
+    {
+        if ( vol->files[first].uoffFolderStart >= offset
+            || ( size_t ) vol->files[first].uoffFolderStart + vol->files[first].cbFile > offset )
         {
             break;
         }
-
-        schema = separator;
     }
 
-    return 0;
-}
+    for ( i = first; i < vol->n_files; i++ )
+    {
+        vol->files[i].iFolder = vol->files[i].iFolder == IFOLD_FROM_PREV ?
+            IFOLD_PREV_AND_NEXT : IFOLD_TO_NEXT;
+    }
 
-/* Skip slashes in file name */
-static void skip_slahses ( const char **filename )
-{
-    const char *slash_ptr;
-    const char *end_ptr;
+    n_carry = vol->n_files - first;
 
-  again:
+    if ( ( error_status = next_volume ( vol ) ) != 0 )
+    {
+        return error_status;
+    }
 
-    if ( ( slash_ptr = strchr ( *filename, '/' ) ) == NULL )
+    /* Folder goes on in next volume */
+    if ( ( error_status = add_volume_folder ( vol, type_compress ) ) != 0 )
     {
-        return;
+        return error_status;
     }
 
-    if ( ( end_ptr = strchr ( *filename, '\n' ) ) == NULL )
+    /* Crossing files are listed again */
+    memmove ( vol->files, vol->files + first, n_carry * sizeof ( struct CFFILE_FN ) );
+
+    for ( i = 0; i < n_carry; i++ )
     {
-        end_ptr = *filename + strlen ( *filename );
+        vol->files[i].iFolder = IFOLD_FROM_PREV;
+        vol->files_len +=
+            sizeof ( struct CFFILE ) + get_filename_len ( vol->files[i].filename ) + 1;
     }
 
-    if ( slash_ptr < end_ptr )
+    vol->n_files = n_carry;
+
+    plan_volume ( vol );
+
+    return 0;
+}
+
+/* Count file entries starting before given folder offset */
+static size_t count_entries ( const struct folder_pack_ctx *folder, size_t from, size_t offset,
+    int last, size_t *len )
+{
+    size_t i;
+
+    for ( i = from, *len = 0; i < folder->n_files && ( last
+            || folder->files[i].uoffFolderStart < offset ); i++ )
     {
-        *filename = slash_ptr + 1;
-        goto again;
+        *len += sizeof ( struct CFFILE ) + get_filename_len ( folder->files[i].filename ) + 1;
     }
+
+    return i - from;
 }
 
-/* Load signle file content */
-static int load_file ( const char *schema, unsigned short folder, unsigned char *uncompressed,
-    size_t uncompressed_size, struct CFFILE_FN *file, size_t * schema_off )
+/* List file entries in last folder of current volume */
+static int list_entries ( struct pack_volume *vol, struct folder_pack_ctx *folder,
+    size_t n_entries )
 {
-    int error_status = 0;
-    int fd;
-    size_t copy_len;
-    unsigned int chkfolder;
-    struct stat statbuf;
-    const char *base = schema;
-    const char *separator = NULL;
-    char path[2048];
+    int error_status;
+    size_t i;
 
-    for ( chkfolder = 0; *schema != '\0'; schema++ )
+    for ( i = 0; i < n_entries; i++ )
     {
-        if ( sscanf ( schema, "%u", &chkfolder ) <= 0 )
+        if ( ( error_status =
+                add_volume_file ( vol, folder->files + folder->next + i,
+                    vol->n_folders - 1 ) ) != 0 )
         {
-            return EINVAL;
+            return error_status;
         }
+    }
 
-        if ( chkfolder != folder )
-        {
-            if ( ( schema = strchr ( schema, '\n' ) ) == NULL )
-            {
-                break;
-            }
-            continue;
-        }
+    folder->next += n_entries;
 
-        if ( ( schema = strchr ( schema, ',' ) ) == NULL )
-        {
-            return ESRCH;
-        }
+    return 0;
+}
 
-        schema++;
+/* Obtain uncompressed length of given folder sector */
+static size_t get_sector_len ( const struct folder_pack_ctx *folder, size_t sector )
+{
+    size_t offset = sector * 32768;
 
-        if ( ( separator = strchr ( schema, '\n' ) ) == NULL )
+    return folder->size - offset < 32768 ? folder->size - offset : 32768;
+}
+
+/* Open folder in volume with its first entries and room for sector part, or in next volume */
+static int open_folder ( struct pack_volume *vol, struct folder_pack_ctx *folder )
+{
+    int error_status;
+    size_t n_entries;
+    size_t entries_len;
+
+    n_entries = count_entries ( folder, 0, folder->n_cfdata ? get_sector_len ( folder, 0 ) : 0,
+        folder->n_cfdata <= 1, &entries_len );
+
+    while ( get_volume_room ( vol, n_entries, entries_len + sizeof ( struct CFFOLDER ), 0 ) <
+        ( folder->n_cfdata ? ( ssize_t ) sizeof ( struct CFDATA ) + 1 : 0 ) )
+    {
+        if ( vol->split && !vol->n_folders )
         {
-            separator = schema + strlen ( schema );
+            fprintf ( stderr, "Volume size too small\n" );
+            return EFBIG;
         }
 
-        if ( ( copy_len = separator - schema ) >= sizeof ( path ) )
+        if ( ( error_status = next_volume ( vol ) ) != 0 )
         {
-            return ENOBUFS;
+            return error_status;
         }
-
-        memcpy ( path, schema, copy_len );
-        path[copy_len] = '\0';
-
-        file->filename = schema;
-        skip_slahses ( &file->filename );
-
-        break;
     }
 
-    if ( separator == NULL )
+    if ( ( error_status = add_volume_folder ( vol, folder->type_compress ) ) != 0 )
     {
-        return ESRCH;
+        return error_status;
     }
 
-    *schema_off = separator - base + 1;
+    vol->meta_left -= vol->meta_left < sizeof ( struct CFFOLDER ) ? vol->meta_left :
+        sizeof ( struct CFFOLDER );
 
-    if ( ( fd = open ( path, O_RDONLY ) ) < 0 )
+    /* Folder without data has only empty files */
+    if ( !folder->n_cfdata )
     {
-        fprintf ( stderr, "Failed to open file %s: %i\n", path, errno );
-        return errno;
+        return list_entries ( vol, folder, n_entries );
     }
 
-    if ( fstat ( fd, &statbuf ) < 0 )
-    {
-        error_status = errno;
-        goto exit;
-    }
+    return 0;
+}
 
-    if ( statbuf.st_size < 0 )
+/* Place next compressed sector of folder into volumes, it gets split at volume end */
+static int place_sector ( struct pack_volume *vol, struct folder_pack_ctx *folder,
+    struct CFDATA *record )
+{
+    int error_status;
+    int last;
+    size_t n_entries;
+    size_t entries_len;
+    size_t n_ahead = 0;
+    size_t ahead_len = 0;
+    size_t rest;
+    size_t len;
+    ssize_t room;
+    unsigned char *data = ( unsigned char * ) record + sizeof ( struct CFDATA );
+    struct CFDATA cfdata = *record;
+
+    rest = cfdata.cbData;
+    last = folder->sector + 1 == folder->n_cfdata;
+
+    /* Files starting in this sector and the following one */
+    n_entries = count_entries ( folder, folder->next, folder->offset + cfdata.cbUncomp, last,
+        &entries_len );
+
+    if ( !last )
     {
-        return EINVAL;
+        n_ahead = count_entries ( folder, folder->next + n_entries,
+            folder->offset + cfdata.cbUncomp + get_sector_len ( folder, folder->sector + 1 ),
+            folder->sector + 2 == folder->n_cfdata, &ahead_len );
     }
 
-    if ( ( size_t ) statbuf.st_size > uncompressed_size )
+    for ( ;; )
     {
-        error_status = ENOBUFS;
-        goto exit;
-    }
+        room = get_volume_room ( vol, n_entries, entries_len, 1 );
+
+        /* Whole part fits with room left to begin next sector, cut inside folder must
+           split sector so that some file crosses it */
+        if ( room >= ( ssize_t ) rest && ( last
+                || get_volume_room ( vol, n_entries + n_ahead, entries_len + ahead_len,
+                    2 ) > ( ssize_t ) rest ) )
+        {
+            break;
+        }
 
-    file->cbFile = statbuf.st_size;
+        if ( !vol->split )
+        {
+            return next_volume ( vol );
+        }
 
-    if ( read ( fd, uncompressed, statbuf.st_size ) != statbuf.st_size )
-    {
-        return errno ? errno : EIO;
-    }
+        if ( room < 1 || rest < 2 )
+        {
+            fprintf ( stderr, "Volume size too small\n" );
+            return EFBIG;
+        }
 
-  exit:
+        /* Split sector, its last part stays in next volume */
+        len = ( size_t ) room < rest - 1 ? ( size_t ) room : rest - 1;
 
-    close ( fd );
+        if ( ( error_status = list_entries ( vol, folder, n_entries ) ) != 0 )
+        {
+            return error_status;
+        }
 
-    return error_status;
-}
+        n_entries = 0;
+        entries_len = 0;
 
-#define GetUi32(p) ( \
-             ((const Byte *)(p))[0]        | \
-    ((unsigned int)((const Byte *)(p))[1] <<  8) | \
-    ((unsigned int)((const Byte *)(p))[2] << 16) | \
-((unsigned int)((const Byte *)(p))[3] << 24))
+        fix_volume_reserve ( vol, 0 );
 
+        if ( ( error_status = add_volume_sector ( vol, &cfdata, data, len, FALSE ) ) != 0 )
+        {
+            return error_status;
+        }
 
-/* Calculate cfdata checksum */
-static unsigned int checksum ( const unsigned char *p, unsigned int size )
-{
-    unsigned int sum = 0;
+        data += len;
+        rest -= len;
 
-    for ( ; size >= 8; size -= 8 )
+        if ( ( error_status = continue_volume ( vol, folder->offset ) ) != 0 )
+        {
+            return error_status;
+        }
+    }
+
+    if ( ( error_status = list_entries ( vol, folder, n_entries ) ) != 0 )
     {
-        sum ^= GetUi32 ( p ) ^ GetUi32 ( p + 4 );
-        p += 8;
+        return error_status;
     }
 
-    if ( size >= 4 )
+    fix_volume_reserve ( vol, last ? 0 : ahead_len );
+
+    if ( ( error_status = add_volume_sector ( vol, &cfdata, data, rest, TRUE ) ) != 0 )
     {
-        sum ^= GetUi32 ( p );
-        p += 4;
+        return error_status;
     }
 
-    size &= 3;
-    if ( size > 2 )
-        sum ^= ( unsigned int ) ( *p++ ) << 16;
-    if ( size > 1 )
-        sum ^= ( unsigned int ) ( *p++ ) << 8;
-    if ( size > 0 )
-        sum ^= ( unsigned int ) ( *p++ );
+    folder->offset += cfdata.cbUncomp;
+    folder->sector++;
+    folder->compressed_size += sizeof ( struct CFDATA ) + cfdata.cbData;
 
-    return sum;
+    return 0;
 }
 
-/* Pack files of single folder into cabinet archive */
-static int pack_folder ( const char *schema, unsigned short nfolder, struct CFFILE_FN *files,
-    size_t n_files, size_t files_off, size_t uncompressed_size, struct folder_mem_ctx *folder_mem,
-    unsigned int level )
+/* Pack files of single folder, each sector goes to volume as soon as it is compressed */
+static int pack_folder ( struct pack_volume *vol, struct folder_pack_ctx *folder,
+    unsigned int level, unsigned int window_bits )
 {
     int error_status = 0;
     int z_status;
     size_t i;
-    size_t osum;
-    size_t schema_off;
-    size_t uncompressed_off = 0;
     size_t length;
-    unsigned char *uncompressed = NULL;
-    z_stream stream;
+    size_t in_size;
+    size_t out_size;
+    size_t out_len;
+    unsigned int n_cfdata;
+    unsigned char *in = NULL;
+    unsigned char *out = NULL;
+    unsigned char *block;
+    unsigned char *record;
+    z_stream *stream = NULL;
+    struct lzx_encoder *lzx = NULL;
     struct CFDATA *cfdata;
-    int stream_freed = TRUE;
 
-    /* Reset folder memory context */
-    folder_mem->n_cfdata = 0;
-    folder_mem->compressed = NULL;
-
-    /* Calulcate maximal compressed data length */
-    folder_mem->compressed_size =
-        uncompressed_size + n_files * ( sizeof ( struct CFDATA ) + 2 ) + 32768;
-
-    /* Allocate uncompressed data buffer */
-    if ( ( uncompressed = ( unsigned char * ) malloc ( uncompressed_size ) ) == NULL )
+    /* Reset folder context, lzx frames and ms-zip blocks are both 32768 bytes */
+    folder->n_cfdata = ( folder->size + 32767 ) / 32768;
+    folder->sector = 0;
+    folder->offset = 0;
+    folder->next = 0;
+    folder->compressed_size = 0;
+    folder->fd = -1;
+    folder->file = 0;
+    folder->file_left = 0;
+
+    if ( ( error_status = open_folder ( vol, folder ) ) != 0 || !folder->n_cfdata )
     {
-        error_status = ENOMEM;
         goto exit;
     }
 
-    /* Allocate compressed data buffer */
-    if ( ( folder_mem->compressed =
-            ( unsigned char * ) malloc ( folder_mem->compressed_size ) ) == NULL )
+    /* Input holds lzx block of frames, or ms-zip dictionary and block */
+    in_size = window_bits ? LZX_BLOCK_FRAMES * LZX_FRAME_SIZE : 2 * 32768;
+
+    /* Stored deflate blocks add few bytes each */
+    out_size = window_bits ? lzx_compress_bound ( in_size ) :
+        sizeof ( struct CFDATA ) + 2 + 32768 + 64;
+
+    if ( ( in = ( unsigned char * ) malloc ( in_size ) ) == NULL
+        || ( out = ( unsigned char * ) malloc ( out_size ) ) == NULL )
     {
         error_status = ENOMEM;
         goto exit;
     }
 
-    /* Load each file into uncompressed buffer */
-    for ( i = 0; i < n_files; i++ )
+    /* Lzx encoder keeps window itself and cuts frames into sectors */
+    if ( window_bits )
     {
-        /* Prepare file structure */
-        files[files_off + i].uoffFolderStart = uncompressed_off;
-        files[files_off + i].iFolder = nfolder;
-        files[files_off + i].date = 0;
-        files[files_off + i].time = 0;
-        files[files_off + i].attribs = 0;
-        files[files_off + i].filename = NULL;
-
-        /* Load file name and content */
-        if ( ( error_status = load_file ( schema, nfolder, uncompressed + uncompressed_off,
-                    uncompressed_size - uncompressed_off, files + files_off + i,
-                    &schema_off ) ) != 0 )
+        if ( ( error_status = lzx_encoder_init ( &lzx, window_bits, level ) ) != 0 )
         {
             goto exit;
         }
 
-        /* Update uncompressed data offset */
-        uncompressed_off += files[files_off + i].cbFile;
+        for ( i = 0; i < folder->size; i += length )
+        {
+            length = folder->size - i < in_size ? folder->size - i : in_size;
 
-        /* Update schema offset */
-        schema += schema_off;
-    }
+            if ( ( error_status = read_folder ( folder, in, length ) ) != 0 )
+            {
+                goto exit;
+            }
 
-    /* Prepare zlib deflate stream */
-    memset ( &stream, '\0', sizeof ( stream ) );
-    stream.zalloc = ( alloc_func ) NULL;
-    stream.zfree = ( free_func ) NULL;
-    stream.opaque = ( voidpf ) NULL;
+            if ( ( error_status =
+                    lzx_compress ( lzx, in, length, out, out_size, &out_len,
+                        &n_cfdata ) ) != 0 )
+            {
+                goto exit;
+            }
+
+            for ( record = out; n_cfdata--; record = block )
+            {
+                cfdata = ( struct CFDATA * ) record;
+                block = record + sizeof ( struct CFDATA ) + cfdata->cbData;
+
+                if ( ( error_status = place_sector ( vol, folder, cfdata ) ) != 0 )
+                {
+                    goto exit;
+                }
+            }
+        }
 
-    /* Initialize deflate stream for raw data */
-    if ( ( error_status =
-            deflateInit2 ( &stream, level, Z_DEFLATED, -15, MAX_MEM_LEVEL,
-                Z_DEFAULT_STRATEGY ) ) != Z_OK )
-    {
         goto exit;
     }
 
-    /* Compress files data with deflate stream */
-    for ( i = 0, osum = 0; i < uncompressed_off;
-        i += length, osum += stream.total_out, folder_mem->n_cfdata += 1 )
+    /* Take raw deflate stream from thread pool */
+    if ( ( error_status = zpool_acquire ( ZPOOL_DEFLATE, level, &stream ) ) != 0 )
     {
-        /* Assign sector structure pointer */
-        cfdata = ( struct CFDATA * ) ( folder_mem->compressed + osum );
-        osum += sizeof ( struct CFDATA );
+        goto exit;
+    }
 
-        /* Place ms-zip header */
-        folder_mem->compressed[osum++] = 0x43;
-        folder_mem->compressed[osum++] = 0x4b;
+    /* Compress files data with deflate stream, blocks take turns in input halves */
+    for ( i = 0; i < folder->size; i += length )
+    {
+        block = in + ( folder->sector & 1 ) * 32768;
 
         /* Allow 32768 bytes max */
-        if ( ( length = uncompressed_off - i ) > 32768 )
+        if ( ( length = folder->size - i ) > 32768 )
         {
             length = 32768;
         }
 
-        /* Reset deflate stream and apply dictionary if needed */
+        if ( ( error_status = read_folder ( folder, block, length ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        /* Reset deflate stream and apply previous block as dictionary */
         if ( i )
         {
-            if ( ( error_status = deflateReset ( &stream ) ) != Z_OK )
+            if ( ( error_status = deflateReset ( stream ) ) != Z_OK )
             {
                 goto exit;
             }
 
             if ( ( error_status =
-                    deflateSetDictionary ( &stream, uncompressed + i - 32768, 32768 ) ) != Z_OK )
+                    deflateSetDictionary ( stream, in + ( ~folder->sector & 1 ) * 32768,
+                        32768 ) ) != Z_OK )
             {
                 goto exit;
             }
         }
 
+        /* Place ms-zip header */
+        cfdata = ( struct CFDATA * ) out;
+        out[sizeof ( struct CFDATA )] = 0x43;
+        out[sizeof ( struct CFDATA ) + 1] = 0x4b;
+
         /* Prepare compression parameters */
-        stream.next_out = folder_mem->compressed + osum;
-        stream.avail_out = folder_mem->compressed_size - osum;
-        stream.next_in = uncompressed + i;
-        stream.avail_in = length;
+        stream->next_out = out + sizeof ( struct CFDATA ) + 2;
+        stream->avail_out = out_size - sizeof ( struct CFDATA ) - 2;
+        stream->next_in = block;
+        stream->avail_in = length;
 
         /* Ccompress data with RFC 1951 deflate */
-        z_status = deflate ( &stream, Z_FINISH );
+        z_status = deflate ( stream, Z_FINISH );
         if ( z_status != Z_OK && z_status != Z_STREAM_END )
         {
             error_status = z_status;
             goto exit;
         }
 
+        /* Unfinished stream means output buffer ran out */
+        if ( z_status != Z_STREAM_END )
+        {
+            error_status = ENOBUFS;
+            goto exit;
+        }
+
         /* Update sectore structure */
-        cfdata->cbData = 2 + stream.total_out;
+        cfdata->cbData = 2 + stream->total_out;
         cfdata->cbUncomp = length;
         cfdata->csum =
-            checksum ( folder_mem->compressed + osum - sizeof ( unsigned int ) - 2,
-            stream.total_out + sizeof ( unsigned int ) + 2 );
-    }
+            checksum ( out + sizeof ( struct CFDATA ) - sizeof ( unsigned int ),
+            stream->total_out + sizeof ( unsigned int ) + 2 );
 
-    /* Free zlib deflate stream */
-    deflateEnd ( &stream );
-    stream_freed = TRUE;
+        if ( ( error_status = place_sector ( vol, folder, cfdata ) ) != 0 )
+        {
+            goto exit;
+        }
+    }
 
+  exit:
 
-    /* Update compressed block size */
-    folder_mem->compressed_size = osum;
+    /* Return deflate stream to pool */
+    if ( stream != NULL )
+    {
+        zpool_release ( stream );
+    }
 
-  exit:
+    /* Free lzx encoder */
+    if ( lzx != NULL )
+    {
+        lzx_encoder_free ( lzx );
+    }
 
-    /* Free zlib deflate stream if not done before */
-    if ( !stream_freed )
+    /* Close file being read on error */
+    if ( folder->fd >= 0 )
     {
-        deflateEnd ( &stream );
+        close ( folder->fd );
+        folder->fd = -1;
     }
 
-    /* Free uncompressed data buffer */
-    if ( uncompressed != NULL )
+    /* Free input and output buffers */
+    if ( in != NULL )
     {
-        free ( uncompressed );
+        free ( in );
     }
 
-    /* Free compressed data buffer on error */
-    if ( error_status && folder_mem->compressed != NULL )
+    if ( out != NULL )
     {
-        free ( folder_mem->compressed );
-        folder_mem->compressed = NULL;
+        free ( out );
     }
 
     return error_status;
 }
 
-/* Pack files into cabinet archive */
-int pack_files ( const char *schema, unsigned int level, int fd )
+/* Pack files into cabinet archive, volumes are saved as soon as they fill */
+int pack_files ( const char *schema, unsigned int level, unsigned int window_bits, int fd,
+    const char *path, size_t volume_size, int progress_mode, int progress_fd )
 {
     int error_status = 0;
-    unsigned char nullchr = '\0';
-    unsigned short f_files = 0;
+    size_t f_files = 0;
+    size_t n_folders;
+    size_t n_files;
     size_t i;
-    size_t folders_len;
-    size_t folders_mem_len;
     size_t files_len;
     size_t files_off = 0;
     size_t uncompressed_size;
-    size_t filename_len;
-    size_t cfdata_off;
-    const char *end_ptr;
-    struct CFHEADER header;
-    struct CFFOLDER *folders = NULL;
     struct CFFILE_FN *files = NULL;
     struct timeval tv;
-    struct folder_mem_ctx *folders_mem = NULL;
+    struct folder_pack_ctx folder;
+    struct pack_volume vol;
+    struct progress_t progress;
 
-    /* Prepare header structure */
-    memset ( &header, '\0', sizeof ( header ) );
+    /* Prepare volume and folder structures */
+    memset ( &vol, '\0', sizeof ( vol ) );
+    memset ( &folder, '\0', sizeof ( folder ) );
 
     /* Obtain current time */
     memset ( &tv, '\0', sizeof ( tv ) );
     gettimeofday ( &tv, NULL );
 
-    /* Obtain folders count */
-    header.signature[0] = 0x4d;
-    header.signature[1] = 0x53;
-    header.signature[2] = 0x43;
-    header.signature[3] = 0x46;
-    header.versionMinor = 3;
-    header.versionMajor = 1;
-    header.flags = 0;
-    header.cFolders = get_folders_count ( schema );
-    header.cFiles = get_files_count ( schema );
-    header.setID = tv.tv_usec;
-    header.iCabinet = 0;
+    /* Obtain folders and files count */
+    n_folders = get_folders_count ( schema );
+    n_files = get_files_count ( schema );
 
     /* Show folders count */
-    printf ( "Folders: %5u\n", header.cFolders );
+    printf ( "Folders: %5lu\n", ( unsigned long ) n_folders );
 
     /* Show files count */
-    printf ( "Files: %5u\n", header.cFiles );
+    printf ( "Files: %5lu\n", ( unsigned long ) n_files );
 
-    /* Allocate folders table */
-    folders_len = header.cFolders * sizeof ( struct CFFOLDER );
-    if ( ( folders = ( struct CFFOLDER * ) malloc ( folders_len ) ) == NULL )
+    /* File entries index folders below continuation markers */
+    if ( n_folders >= IFOLD_FROM_PREV )
     {
-        error_status = ENOMEM;
+        fprintf ( stderr, "Too many folders: %lu\n", ( unsigned long ) n_folders );
+        error_status = EFBIG;
         goto exit;
     }
 
-    /* Allocate folders table */
-    files_len = header.cFiles * sizeof ( struct CFFILE_FN );
+    /* Allocate files table */
+    files_len = n_files * sizeof ( struct CFFILE_FN );
     if ( ( files = ( struct CFFILE_FN * ) malloc ( files_len ) ) == NULL )
     {
         error_status = ENOMEM;
@@ -514,166 +1204,142 @@ int pack_files ( const char *schema, unsigned int level, int fd )
 
     memset ( files, '\0', files_len );
 
-    /* Allocate folders memory table */
-    folders_mem_len = header.cFolders * sizeof ( struct folder_mem_ctx );
-    if ( ( folders_mem = ( struct folder_mem_ctx * ) malloc ( folders_mem_len ) ) == NULL )
+    /* Prepare first volume */
+    vol.path = path;
+    vol.fd = fd;
+    vol.split = volume_size != 0;
+    vol.limit = volume_size ? volume_size : CAB_MAX_SIZE;
+    vol.set_id = tv.tv_usec;
+
+    /* Tables of whole cabinet, single cabinet reserves them exactly */
+    vol.meta_left = n_folders * sizeof ( struct CFFOLDER ) + get_entries_len ( schema );
+
+    /* Select lzx or ms-zip compression */
+    folder.type_compress = window_bits ? 3 | window_bits << 8 : 1;
+
+    if ( ( error_status = reset_volume ( &vol, 0 ) ) != 0 )
     {
-        error_status = ENOMEM;
         goto exit;
     }
 
-    memset ( folders_mem, '\0', folders_mem_len );
+    /* Prepare progress reporter */
+    progress_init ( &progress, progress_mode, progress_fd, n_files );
 
-    /* Obtain folder stats and pack files */
-    for ( i = 0; i < header.cFolders && f_files < header.cFiles; i++ )
+    /* Obtain folder stats, pack files and place them into volumes */
+    for ( i = 0; i < n_folders && f_files < n_files; i++ )
     {
-        if ( ( error_status = get_folder_stats ( schema, i, &f_files, &uncompressed_size ) ) != 0 )
+        if ( ( error_status =
+                get_folder_stats ( schema, i, files + files_off, n_files - files_off, &f_files,
+                    &uncompressed_size ) ) != 0 )
         {
+            progress_finish ( &progress );
             goto exit;
         }
 
-        if ( ( error_status =
-                pack_folder ( schema, i, files, f_files, files_off, uncompressed_size,
-                    &folders_mem[i], level ) ) != 0 )
+        folder.files = files + files_off;
+        folder.n_files = f_files;
+        folder.size = uncompressed_size;
+
+        if ( ( error_status = pack_folder ( &vol, &folder, level, window_bits ) ) != 0 )
         {
+            progress_finish ( &progress );
             goto exit;
         }
 
-        printf ( "Packed folder %u/%u (%u files)\n", ( unsigned short ) i, header.cFolders,
-            f_files );
+        progress_add ( &progress, f_files, uncompressed_size, folder.compressed_size, i );
 
         files_off += f_files;
     }
 
-    /* Set cabinet header total size and files offset */
-    header.cbCabinet = sizeof ( struct CFHEADER ) + header.cFolders * sizeof ( struct CFFOLDER );
-    header.coffFiles = header.cbCabinet;
-
-    /* Apply files structures length sum */
-    for ( i = 0; i < header.cFiles; i++ )
+    /* Report final progress */
+    progress_finish ( &progress );
+    if ( progress_mode == PROGRESS_TEXT )
     {
-        if ( ( end_ptr = strchr ( files[i].filename, '\n' ) ) == NULL )
-        {
-            filename_len = strlen ( files[i].filename );
-        } else
-        {
-            filename_len = end_ptr - files[i].filename;
-        }
-
-        header.cbCabinet += sizeof ( struct CFFILE ) + filename_len + 1;
+        putchar ( '\n' );
     }
 
-    /* Set cabinet sectors offset */
-    cfdata_off = header.cbCabinet;
-
-    /* Apply files content length sum */
-    for ( i = 0; i < header.cFolders; i++ )
+    /* Save last volume */
+    if ( ( error_status = write_volume ( &vol, TRUE ) ) != 0 )
     {
-        header.cbCabinet += folders_mem[i].compressed_size;
+        goto exit;
     }
 
-    /* Set folders structures */
-    for ( i = 0; i < header.cFolders; i++ )
+    /* Show volumes count */
+    if ( vol.split )
     {
-        /* Set folder offset, sectors count and compression type */
-        folders[i].coffCabStart = cfdata_off;
-        folders[i].cCFData = folders_mem[i].n_cfdata;
-        folders[i].typeCompress = 1;    /* ms-zip */
-
-        /* Skip sectors of current folder */
-        cfdata_off += folders_mem[i].compressed_size;
+        printf ( "Volumes: %5u\n", vol.index + 1 );
     }
 
-    /* Save header structure to file */
-    if ( ( size_t ) write ( fd, &header, sizeof ( header ) ) != sizeof ( header ) )
+  exit:
+
+    /* Free files table */
+    if ( files != NULL )
     {
-        error_status = errno ? errno : EIO;
-        goto exit;
+        free ( files );
     }
 
-    /* Save folders structures to file */
-    if ( ( size_t ) write ( fd, folders, folders_len ) != folders_len )
+    /* Free volume buffers */
+    if ( vol.folders != NULL )
     {
-        error_status = errno ? errno : EIO;
-        goto exit;
+        free ( vol.folders );
     }
 
-    /* Save files structures and file names to file */
-    for ( i = 0; i < header.cFiles; i++ )
+    if ( vol.files != NULL )
     {
-        if ( ( end_ptr = strchr ( files[i].filename, '\n' ) ) == NULL )
-        {
-            filename_len = strlen ( files[i].filename );
-
-        } else
-        {
-            filename_len = end_ptr - files[i].filename;
-        }
-
-        if ( ( size_t ) write ( fd, ( struct CFFILE * ) &files[i],
-                sizeof ( struct CFFILE ) ) != sizeof ( struct CFFILE ) )
-        {
-            error_status = errno ? errno : EIO;
-            goto exit;
-        }
-
-        if ( ( size_t ) write ( fd, files[i].filename, filename_len ) != filename_len )
-        {
-            error_status = errno ? errno : EIO;
-            goto exit;
-        }
-
-        if ( ( size_t ) write ( fd, &nullchr, 1 ) != 1 )
-        {
-            error_status = errno ? errno : EIO;
-            goto exit;
-        }
+        free ( vol.files );
     }
 
-    /* Save files content to file */
-    for ( i = 0; i < header.cFolders; i++ )
+    /* Close volume left open on error */
+    if ( vol.index && vol.fd >= 0 )
     {
-        if ( ( size_t ) write ( fd, folders_mem[i].compressed,
-                folders_mem[i].compressed_size ) != folders_mem[i].compressed_size )
-        {
-            error_status = errno ? errno : EIO;
-            goto exit;
-        }
+        close ( vol.fd );
     }
 
-  exit:
+    return error_status;
+}
 
-    /* Free folders table */
-    if ( folders != NULL )
-    {
-        free ( folders );
-    }
+/* Parse volume size with optional k, m or g suffix */
+static int parse_volume_size ( const char *str, size_t *size )
+{
+    unsigned int shift = 0;
+    unsigned long value;
+    char suffix = '\0';
+    char trail;
 
-    /* Free files table */
-    if ( files != NULL )
+    if ( *str < '0' || *str > '9' || sscanf ( str, "%lu%c%c", &value, &suffix, &trail ) > 2 )
     {
-        free ( files );
+        return EINVAL;
     }
 
-    /* Return if buffer not allocated */
-    if ( folders_mem == NULL )
+    switch ( suffix )
     {
-        return error_status;
+    case '\0':
+        break;
+    case 'k':
+    case 'K':
+        shift = 10;
+        break;
+    case 'm':
+    case 'M':
+        shift = 20;
+        break;
+    case 'g':
+    case 'G':
+        shift = 30;
+        break;
+    default:
+        return EINVAL;
     }
 
-    /* Free folders memory table buffers */
-    for ( i = 0; i < header.cFolders; i++ )
+    /* Cabinet size field is thirty two bits wide */
+    if ( value > CAB_MAX_SIZE >> shift || value << shift < PACK_MIN_VOLUME_SIZE )
     {
-        if ( folders_mem[i].compressed != NULL )
-        {
-            free ( folders_mem[i].compressed );
-        }
+        return ERANGE;
     }
 
-    /* Free folders memory table */
-    free ( folders_mem );
+    *size = value << shift;
 
-    return error_status;
+    return 0;
 }
 
 /* Load cabinet schema file content */
@@ -721,21 +1387,57 @@ int main ( int argc, char *argv[] )
 {
     int error_status = 0;
     int fd = -1;
+    int i;
+    int progress_mode = PROGRESS_TEXT;
+    int progress_fd = -1;
     unsigned int level = 0;
+    unsigned int window_bits = 0;
+    size_t volume_size = 0;
     char *schema = NULL;
 
     /* Show program logo */
     printf ( "CAB pack - ver. " ICAB_VERSION "\n" );
 
+    /* Parse options */
+    for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++ )
+    {
+        if ( !strcmp ( argv[i], "-q" ) )
+        {
+            progress_mode = PROGRESS_QUIET;
+
+        } else if ( !strcmp ( argv[i], "--progress-fd" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%d", &progress_fd ) > 0 && progress_fd >= 0 )
+        {
+            progress_mode = PROGRESS_JSON;
+            i++;
+
+        } else if ( !strcmp ( argv[i], "--lzx" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%u", &window_bits ) > 0
+            && window_bits >= LZX_MIN_WINDOW_BITS && window_bits <= LZX_MAX_WINDOW_BITS )
+        {
+            i++;
+
+        } else if ( !strcmp ( argv[i], "--volume-size" ) && i + 1 < argc
+            && parse_volume_size ( argv[i + 1], &volume_size ) == 0 )
+        {
+            i++;
+
+        } else
+        {
+            show_usage (  );
+            return 1;
+        }
+    }
+
     /* Validate arguments count */
-    if ( argc < 4 )
+    if ( argc - i < 3 )
     {
         show_usage (  );
         return 1;
     }
 
     /* Parse compression level */
-    if ( sscanf ( argv[2], "%u", &level ) <= 0 )
+    if ( sscanf ( argv[i + 1], "%u", &level ) <= 0 )
     {
         show_usage (  );
         return 1;
@@ -749,7 +1451,7 @@ int main ( int argc, char *argv[] )
     }
 
     /* Load folders schema */
-    if ( ( schema = load_schema ( argv[1] ) ) == NULL )
+    if ( ( schema = load_schema ( argv[i] ) ) == NULL )
     {
         fprintf ( stderr, "Failed to load schema: %i\n", errno );
         error_status = errno;
@@ -757,7 +1459,7 @@ int main ( int argc, char *argv[] )
     }
 
     /* Open output file for writing */
-    if ( ( fd = open ( argv[3], O_CREAT | O_WRONLY | O_TRUNC, 0644 ) ) < 0 )
+    if ( ( fd = open ( argv[i + 2], O_CREAT | O_WRONLY | O_TRUNC, 0644 ) ) < 0 )
     {
         fprintf ( stderr, "Failed to open output file: %i\n", errno );
         error_status = errno;
@@ -765,7 +1467,9 @@ int main ( int argc, char *argv[] )
     }
 
     /* Pack files into archive */
-    error_status = pack_files ( schema, level, fd );
+    error_status =
+        pack_files ( schema, level, window_bits, fd, argv[i + 2], volume_size, progress_mode,
+        progress_fd );
 
   exit:
 
@@ -0,0 +1,100 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - Rate Limited Progress Reporter
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+#include <time.h>
+
+/* Obtain coarse monotonic time in milliseconds */
+static long long progress_now ( void )
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC_COARSE, &ts );
+
+    return ( long long ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Prepare progress reporter */
+void progress_init ( struct progress_t *progress, int mode, int fd, unsigned int n_files )
+{
+    memset ( progress, '\0', sizeof ( struct progress_t ) );
+    progress->mode = mode;
+    progress->fd = fd;
+    progress->n_files = n_files;
+    progress->next_report = progress_now (  ) + PROGRESS_INTERVAL_MS;
+    pthread_mutex_init ( &progress->mutex, NULL );
+}
+
+/* Emit single progress report */
+static void progress_report ( struct progress_t *progress, int done )
+{
+    unsigned int file;
+
+    file = __atomic_load_n ( &progress->file, __ATOMIC_RELAXED );
+
+    if ( progress->mode == PROGRESS_TEXT && progress->n_files )
+    {
+        printf ( "\rDone %.2u%% file %u of %u\r",
+            100 * file / progress->n_files, file, progress->n_files );
+        fflush ( stdout );
+
+    } else if ( progress->mode == PROGRESS_JSON )
+    {
+        dprintf ( progress->fd,
+            "{\"files_done\":%u,\"files_total\":%u,\"bytes_in\":%llu,\"bytes_out\":%llu,"
+            "\"folder\":%u,\"done\":%s}\n", file, progress->n_files,
+            __atomic_load_n ( &progress->bytes_in, __ATOMIC_RELAXED ),
+            __atomic_load_n ( &progress->bytes_out, __ATOMIC_RELAXED ),
+            __atomic_load_n ( &progress->folder, __ATOMIC_RELAXED ), done ? "true" : "false" );
+    }
+}
+
+/* Account work done and report once interval passed */
+void progress_add ( struct progress_t *progress, unsigned int files, size_t bytes_in,
+    size_t bytes_out, unsigned int folder )
+{
+    long long now;
+
+    if ( progress->mode == PROGRESS_QUIET )
+    {
+        return;
+    }
+
+    /* Counters are shared by workers without locking */
+    __atomic_add_fetch ( &progress->file, files, __ATOMIC_RELAXED );
+    __atomic_add_fetch ( &progress->bytes_in, bytes_in, __ATOMIC_RELAXED );
+    __atomic_add_fetch ( &progress->bytes_out, bytes_out, __ATOMIC_RELAXED );
+    __atomic_store_n ( &progress->folder, folder, __ATOMIC_RELAXED );
+
+    /* Skip until next report is due */
+    if ( ( now = progress_now (  ) ) < __atomic_load_n ( &progress->next_report,
+            __ATOMIC_RELAXED ) )
+    {
+        return;
+    }
+
+    /* Single worker reports, others carry on */
+    if ( pthread_mutex_trylock ( &progress->mutex ) != 0 )
+    {
+        return;
+    }
+
+    if ( now >= progress->next_report )
+    {
+        progress_report ( progress, FALSE );
+        __atomic_store_n ( &progress->next_report, now + PROGRESS_INTERVAL_MS,
+            __ATOMIC_RELAXED );
+    }
+
+    pthread_mutex_unlock ( &progress->mutex );
+}
+
+/* Emit final report and release reporter */
+void progress_finish ( struct progress_t *progress )
+{
+    progress_report ( progress, TRUE );
+    pthread_mutex_destroy ( &progress->mutex );
+}
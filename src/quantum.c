@@ -0,0 +1,394 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - Quantum Folder Decoder
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+/* Bit stream and arithmetic coder over one cfdata block */
+struct quantum_stream
+{
+    const unsigned char *ptr;
+    const unsigned char *end;
+    unsigned int buf;
+    unsigned int left;
+    unsigned int overrun;
+    unsigned int high;
+    unsigned int low;
+    unsigned int code;
+};
+
+/* Match offset base per position slot */
+static const unsigned int quantum_position_base[] = {
+    0, 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536,
+    2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768, 49152, 65536, 98304, 131072,
+    196608, 262144, 393216, 524288, 786432, 1048576, 1572864
+};
+
+/* Verbatim bits per position slot */
+static const unsigned char quantum_extra_bits[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12,
+    13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 18, 18, 19, 19
+};
+
+/* Match length base per length slot */
+static const unsigned char quantum_length_base[] = {
+    0, 1, 2, 3, 4, 5, 6, 8, 10, 12, 14, 18, 22, 26, 30, 38, 46, 54, 62, 78, 94, 110, 126, 158,
+    190, 222, 254
+};
+
+/* Verbatim bits per length slot */
+static const unsigned char quantum_length_extra[] = {
+    0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/* Top up bit buffer with whole bytes */
+static inline void quantum_ensure ( struct quantum_stream *qs, unsigned int n )
+{
+    while ( qs->left < n )
+    {
+        /* Past input end zeros are fed, checked once frame is done */
+        if ( qs->ptr < qs->end )
+        {
+            qs->buf |= ( unsigned int ) *qs->ptr++ << ( 24 - qs->left );
+
+        } else
+        {
+            qs->overrun++;
+        }
+
+        qs->left += 8;
+    }
+}
+
+/* Read up to 19 bits from stream */
+static inline unsigned int quantum_read ( struct quantum_stream *qs, unsigned int n )
+{
+    unsigned int value;
+
+    if ( !n )
+    {
+        return 0;
+    }
+
+    quantum_ensure ( qs, n );
+    value = qs->buf >> ( 32 - n );
+    qs->buf <<= n;
+    qs->left -= n;
+
+    return value;
+}
+
+/* Set up model with flat frequencies */
+static void quantum_init_model ( struct quantum_model *model, int start, int len )
+{
+    int i;
+
+    model->shiftsleft = QTM_SHIFTS;
+    model->entries = len;
+
+    for ( i = 0; i <= len; i++ )
+    {
+        model->sym[i] = start + i;
+        model->cumfreq[i] = len - i;
+    }
+}
+
+/* Halve frequencies, every few rounds also reorder by frequency */
+static void quantum_update_model ( struct quantum_model *model )
+{
+    int i;
+    int j;
+    unsigned short tmp;
+
+    if ( --model->shiftsleft )
+    {
+        for ( i = model->entries - 1; i >= 0; i-- )
+        {
+            model->cumfreq[i] >>= 1;
+            if ( model->cumfreq[i] <= model->cumfreq[i + 1] )
+            {
+                model->cumfreq[i] = model->cumfreq[i + 1] + 1;
+            }
+        }
+        return;
+    }
+
+    model->shiftsleft = QTM_RESORT_SHIFTS;
+
+    /* Turn cumulative frequencies into halved frequencies */
+    for ( i = 0; i < model->entries; i++ )
+    {
+        model->cumfreq[i] -= model->cumfreq[i + 1];
+        model->cumfreq[i]++;
+        model->cumfreq[i] >>= 1;
+    }
+
+    /* Selection sort, its instability is part of the format */
+    for ( i = 0; i < model->entries - 1; i++ )
+    {
+        for ( j = i + 1; j < model->entries; j++ )
+        {
+            if ( model->cumfreq[i] < model->cumfreq[j] )
+            {
+                tmp = model->cumfreq[i];
+                model->cumfreq[i] = model->cumfreq[j];
+                model->cumfreq[j] = tmp;
+                tmp = model->sym[i];
+                model->sym[i] = model->sym[j];
+                model->sym[j] = tmp;
+            }
+        }
+    }
+
+    /* Back to cumulative frequencies */
+    for ( i = model->entries - 1; i >= 0; i-- )
+    {
+        model->cumfreq[i] += model->cumfreq[i + 1];
+    }
+}
+
+/* Decode one symbol and adapt model */
+static inline unsigned int quantum_symbol ( struct quantum_stream *qs,
+    struct quantum_model *model )
+{
+    int i;
+    int j;
+    unsigned int sym;
+    unsigned int range;
+    unsigned int symf;
+    unsigned int total;
+
+    /* Find symbol whose frequency interval holds code */
+    total = model->cumfreq[0];
+    range = ( ( qs->high - qs->low ) & 0xFFFF ) + 1;
+    symf = ( ( ( qs->code - qs->low + 1 ) * total - 1 ) / range ) & 0xFFFF;
+
+    /* Frequencies strictly decrease, so counting replaces the scan */
+    for ( i = 1, j = 1; j < QTM_LITERAL_SYMBOLS + 1; j++ )
+    {
+        i += model->cumfreq[j] > symf;
+    }
+
+    sym = model->sym[i - 1];
+
+    /* Narrow interval to symbol */
+    qs->high = ( qs->low + model->cumfreq[i - 1] * range / total - 1 ) & 0xFFFF;
+    qs->low = ( qs->low + model->cumfreq[i] * range / total ) & 0xFFFF;
+
+    /* Adapt frequencies */
+    for ( j = 0; j < i; j++ )
+    {
+        model->cumfreq[j] += 8;
+    }
+
+    if ( model->cumfreq[0] > QTM_FREQ_LIMIT )
+    {
+        quantum_update_model ( model );
+    }
+
+    /* Shift out settled bits, handle straddling interval */
+    for ( ;; )
+    {
+        if ( !( ( qs->low ^ qs->high ) & 0x8000 ) )
+        {
+            /* All leading bits shared by bounds go at once */
+            j = qs->low ^ qs->high ? __builtin_clz ( qs->low ^ qs->high ) - 16 : 16;
+            qs->low = ( qs->low << j ) & 0xFFFF;
+            qs->high = ( ( qs->high << j ) | ( ( 1u << j ) - 1 ) ) & 0xFFFF;
+            qs->code = ( ( qs->code << j ) | quantum_read ( qs, j ) ) & 0xFFFF;
+            continue;
+        }
+
+        if ( !( qs->low & 0x4000 ) || ( qs->high & 0x4000 ) )
+        {
+            break;
+        }
+
+        qs->code ^= 0x4000;
+        qs->low = ( qs->low & 0x3FFF ) << 1;
+        qs->high = ( ( ( qs->high | 0x4000 ) << 1 ) | 1 ) & 0xFFFF;
+        qs->code = ( ( qs->code << 1 ) | quantum_read ( qs, 1 ) ) & 0xFFFF;
+    }
+
+    return sym;
+}
+
+/* Emit window bytes from mark up to position */
+static inline void quantum_flush ( const struct quantum_state *quantum, unsigned int from,
+    unsigned char **out )
+{
+    memcpy ( *out, quantum->window + from, quantum->window_posn - from );
+    *out += quantum->window_posn - from;
+}
+
+/* Decode one cfdata block holding single Quantum frame */
+int quantum_decompress ( struct quantum_state *quantum, const unsigned char *in,
+    size_t in_len, unsigned char *out, size_t out_len )
+{
+    unsigned int i;
+    unsigned int sym;
+    unsigned int selector;
+    unsigned int length;
+    unsigned int offset;
+    unsigned int from;
+    unsigned int mask;
+    unsigned int todo;
+    unsigned char *window;
+    struct quantum_stream qs;
+
+    if ( !out_len || out_len > QTM_FRAME_SIZE )
+    {
+        return EINVAL;
+    }
+
+    qs.ptr = in;
+    qs.end = in + in_len;
+    qs.buf = 0;
+    qs.left = 0;
+    qs.overrun = 0;
+
+    /* Arithmetic coder restarts every frame, models carry on */
+    qs.high = 0xFFFF;
+    qs.low = 0;
+    qs.code = quantum_read ( &qs, 16 );
+
+    window = quantum->window;
+    mask = quantum->window_size - 1;
+    from = quantum->window_posn;
+    todo = out_len;
+
+    while ( todo )
+    {
+        selector = quantum_symbol ( &qs, &quantum->selector );
+
+        if ( selector < 4 )
+        {
+            /* Literal from one of four byte ranges */
+            window[quantum->window_posn++] =
+                quantum_symbol ( &qs, &quantum->literal[selector] );
+            todo--;
+
+            /* Small windows wrap within frame */
+            if ( quantum->window_posn == quantum->window_size )
+            {
+                quantum_flush ( quantum, from, &out );
+                quantum->window_posn = 0;
+                from = 0;
+            }
+            continue;
+        }
+
+        /* Matches of 3 and 4 bytes have own offset models */
+        if ( selector == 4 )
+        {
+            sym = quantum_symbol ( &qs, &quantum->position4 );
+            length = 3;
+
+        } else if ( selector == 5 )
+        {
+            sym = quantum_symbol ( &qs, &quantum->position5 );
+            length = 4;
+
+        } else
+        {
+            sym = quantum_symbol ( &qs, &quantum->length6 );
+            length = quantum_length_base[sym] + quantum_read ( &qs,
+                quantum_length_extra[sym] ) + 5;
+            sym = quantum_symbol ( &qs, &quantum->position6 );
+        }
+
+        offset = quantum_position_base[sym] + quantum_read ( &qs, quantum_extra_bits[sym] ) + 1;
+
+        /* Matches never cross frame end */
+        if ( length > todo || offset > quantum->window_size )
+        {
+            return EINVAL;
+        }
+
+        todo -= length;
+
+        if ( quantum->window_posn + length < quantum->window_size
+            && offset <= quantum->window_posn && offset >= length )
+        {
+            /* Plain match copied in one go */
+            memcpy ( window + quantum->window_posn, window + quantum->window_posn - offset,
+                length );
+            quantum->window_posn += length;
+            continue;
+        }
+
+        /* Overlapping or wrapping match goes byte by byte */
+        for ( i = 0; i < length; i++ )
+        {
+            window[quantum->window_posn] = window[( quantum->window_posn - offset ) & mask];
+            if ( ++quantum->window_posn == quantum->window_size )
+            {
+                quantum_flush ( quantum, from, &out );
+                quantum->window_posn = 0;
+                from = 0;
+            }
+        }
+    }
+
+    /* Lookahead of code register may run past data */
+    if ( qs.overrun * 8 > qs.left + 16 )
+    {
+        return ENODATA;
+    }
+
+    quantum_flush ( quantum, from, &out );
+
+    return 0;
+}
+
+/* Allocate decoder for folder window size */
+int quantum_init ( struct quantum_state **quantum, unsigned int window_bits )
+{
+    int i;
+    struct quantum_state *state;
+
+    if ( window_bits < QTM_MIN_WINDOW_BITS || window_bits > QTM_MAX_WINDOW_BITS )
+    {
+        return ENOTSUP;
+    }
+
+    if ( ( state =
+            ( struct quantum_state * ) calloc ( 1, sizeof ( struct quantum_state ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    /* Zeroed window keeps corrupt back references deterministic */
+    state->window_size = 1u << window_bits;
+    if ( ( state->window = ( unsigned char * ) calloc ( 1, state->window_size ) ) == NULL )
+    {
+        free ( state );
+        return ENOMEM;
+    }
+
+    /* Offset models grow with window size */
+    for ( i = 0; i < 4; i++ )
+    {
+        quantum_init_model ( &state->literal[i], i * QTM_LITERAL_SYMBOLS, QTM_LITERAL_SYMBOLS );
+    }
+
+    i = window_bits * 2;
+    quantum_init_model ( &state->position4, 0, i > 24 ? 24 : i );
+    quantum_init_model ( &state->position5, 0, i > 36 ? 36 : i );
+    quantum_init_model ( &state->position6, 0, i );
+    quantum_init_model ( &state->length6, 0, QTM_LENGTH_SYMBOLS );
+    quantum_init_model ( &state->selector, 0, QTM_SELECTOR_SYMBOLS );
+
+    *quantum = state;
+
+    return 0;
+}
+
+/* Release decoder */
+void quantum_free ( struct quantum_state *quantum )
+{
+    free ( quantum->window );
+    free ( quantum );
+}
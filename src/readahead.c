@@ -0,0 +1,133 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - Cabinet Input Read-Ahead Thread
+ --------------------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+#include "icab.h"
+
+/* Keep input read ahead of decoder position */
+static void *readahead_worker ( void *arg )
+{
+    size_t target;
+    size_t len;
+    size_t drop_len;
+    size_t position;
+    size_t dropped = 0;
+    struct readahead_t *ra = ( struct readahead_t * ) arg;
+
+    pthread_mutex_lock ( &ra->mutex );
+
+    while ( !ra->stop )
+    {
+        position = __atomic_load_n ( &ra->position, __ATOMIC_RELAXED );
+        target = ra->size - position > ra->distance ? position + ra->distance : ra->size;
+
+        /* Sleep until decoder moves on */
+        if ( ra->issued >= target )
+        {
+            pthread_cond_wait ( &ra->cond, &ra->mutex );
+            continue;
+        }
+
+        len = target - ra->issued < READAHEAD_CHUNK ? target - ra->issued : READAHEAD_CHUNK;
+        pthread_mutex_unlock ( &ra->mutex );
+
+        /* Read chunk into page cache, failure only costs latency */
+        readahead ( ra->fd, ra->issued, len );
+
+        /* Release input already decoded, chunk aligned to keep pages aligned */
+        if ( ra->drop && position >= dropped + READAHEAD_CHUNK )
+        {
+            drop_len = ( position - dropped ) & ~( ( size_t ) READAHEAD_CHUNK - 1 );
+            madvise ( ( void * ) ( ra->base + dropped ), drop_len, MADV_DONTNEED );
+            posix_fadvise ( ra->fd, dropped, drop_len, POSIX_FADV_DONTNEED );
+            dropped += drop_len;
+        }
+
+        pthread_mutex_lock ( &ra->mutex );
+        __atomic_store_n ( &ra->issued, ra->issued + len, __ATOMIC_RELAXED );
+    }
+
+    pthread_mutex_unlock ( &ra->mutex );
+
+    return NULL;
+}
+
+/* Start reading input ahead of decoder */
+int readahead_start ( struct readahead_t *ra, int fd, const unsigned char *base, size_t size,
+    size_t distance, int drop )
+{
+    memset ( ra, '\0', sizeof ( struct readahead_t ) );
+    ra->fd = fd;
+    ra->base = base;
+    ra->size = size;
+    ra->distance = distance;
+    ra->drop = drop;
+    pthread_mutex_init ( &ra->mutex, NULL );
+    pthread_cond_init ( &ra->cond, NULL );
+
+    /* Decoder faults pages one by one, reading ahead is left to the thread */
+    madvise ( ( void * ) base, size, MADV_RANDOM );
+
+    if ( pthread_create ( &ra->thread, NULL, readahead_worker, ra ) != 0 )
+    {
+        pthread_cond_destroy ( &ra->cond );
+        pthread_mutex_destroy ( &ra->mutex );
+        madvise ( ( void * ) base, size, MADV_NORMAL );
+        return EAGAIN;
+    }
+
+    ra->running = TRUE;
+
+    return 0;
+}
+
+/* Report decoder position in cabinet */
+void readahead_advance ( struct readahead_t *ra, size_t position )
+{
+    size_t current;
+
+    if ( ra == NULL || !ra->running )
+    {
+        return;
+    }
+
+    /* Workers may report out of order, keep furthest position */
+    current = __atomic_load_n ( &ra->position, __ATOMIC_RELAXED );
+    while ( position > current
+        && !__atomic_compare_exchange_n ( &ra->position, &current, position, FALSE,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+    {
+    }
+
+    /* Wake reader once a chunk of distance is free */
+    if ( position > current
+        && position + ra->distance >= __atomic_load_n ( &ra->issued,
+            __ATOMIC_RELAXED ) + READAHEAD_CHUNK )
+    {
+        pthread_mutex_lock ( &ra->mutex );
+        pthread_cond_signal ( &ra->cond );
+        pthread_mutex_unlock ( &ra->mutex );
+    }
+}
+
+/* Stop read-ahead thread */
+void readahead_stop ( struct readahead_t *ra )
+{
+    if ( !ra->running )
+    {
+        return;
+    }
+
+    pthread_mutex_lock ( &ra->mutex );
+    ra->stop = TRUE;
+    pthread_cond_signal ( &ra->cond );
+    pthread_mutex_unlock ( &ra->mutex );
+
+    pthread_join ( ra->thread, NULL );
+    pthread_cond_destroy ( &ra->cond );
+    pthread_mutex_destroy ( &ra->mutex );
+    ra->running = FALSE;
+}
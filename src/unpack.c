@@ -4,10 +4,13 @@
  --------------------------------------------------------------------------------------
  */
 
+#define _GNU_SOURCE
 #include "icab.h"
+#include <fnmatch.h>
+#include <sys/sendfile.h>
 
 /* Dump cabinet header details */
-static void dump_header ( const struct CFHEADER *header )
+static void dump_header ( const struct CFHEADER *header, const struct cab_layout *layout )
 {
     printf ( "cabinet header dump\n" );
     printf ( " |-signature: %.2x %.2x %.2x %.2x\n",
@@ -19,6 +22,14 @@ static void dump_header ( const struct CFHEADER *header )
     printf ( " |-files count: %u\n", header->cFiles );
     printf ( " |-flags: 0x%.4x\n", header->flags );
     printf ( " |-set id: 0x%.4x\n", header->setID );
+    if ( layout->prev_cabinet != NULL )
+    {
+        printf ( " |-prev cabinet: %s\n", layout->prev_cabinet );
+    }
+    if ( layout->next_cabinet != NULL )
+    {
+        printf ( " |-next cabinet: %s\n", layout->next_cabinet );
+    }
     printf ( " \\-seq number: 0x%.4x\n\n", header->iCabinet );
 }
 
@@ -129,22 +140,30 @@ static size_t dump_data ( const struct CFDATA *data, int sector, int lastone )
 }
 
 /* List cabinet file entries */
-static int list_files ( const unsigned char *base, size_t size )
+static int list_files ( const unsigned char *base, size_t size, int cab_fd, int sectors )
 {
+    int error_status;
     unsigned short i;
     unsigned short j;
+    size_t sector;
     const struct CFHEADER *header;
     const struct CFFOLDER *folder;
     const unsigned char *offset;
-    const unsigned char *sector;
+    struct CFDATA data;
+    struct cab_layout layout;
 
     /* Assign header structure pointer */
     header = ( const struct CFHEADER * ) base;
     PTR_ASSERT ( header, sizeof ( struct CFHEADER ), base, size );
-    offset = base + sizeof ( struct CFHEADER );
+
+    /* Locate folders past reserve area and set names */
+    if ( ( error_status = parse_layout ( base, size, &layout ) ) != 0 )
+    {
+        return error_status;
+    }
 
     /* Dump header structure */
-    dump_header ( header );
+    dump_header ( header, &layout );
 
     /* Show folder dump header */
     printf ( "cabinet folder dump\n" );
@@ -153,33 +172,45 @@ static int list_files ( const unsigned char *base, size_t size )
     for ( i = 0; i < header->cFolders; i++ )
     {
         /* Assign folder structure pointer */
-        PTR_ASSERT ( offset, sizeof ( struct CFFOLDER ), base, size );
-        folder = ( const struct CFFOLDER * ) offset;
+        if ( ( folder = layout_folder ( base, size, &layout, i ) ) == NULL )
+        {
+            return ERANGE;
+        }
 
         /* Dump folder structure */
         dump_folder ( folder, i, i + 1 == header->cFolders );
-        offset += sizeof ( struct CFFOLDER );
 
-        /* Assign sector strcuture pointer */
-        sector = base + folder->coffCabStart;
+        /* Sector headers are read on request only */
+        if ( !sectors )
+        {
+            continue;
+        }
+
+        /* Assign sector offset */
+        sector = folder->coffCabStart;
 
         /* Dump data structures */
         for ( j = 0; j < folder->cCFData; j++ )
         {
-            PTR_ASSERT ( sector, sizeof ( struct CFDATA ), base, size );
-            sector += dump_data ( ( const struct CFDATA * ) sector, j, j + 1 == folder->cCFData );
-            sector += sizeof ( struct CFDATA );
+            if ( ( error_status = read_cfdata ( cab_fd, sector, &data ) ) != 0 )
+            {
+                return error_status;
+            }
+
+            sector += dump_data ( &data, j, j + 1 == folder->cCFData );
+            sector += sizeof ( struct CFDATA ) + layout.data_reserve;
         }
     }
 
     /* Show file dump header */
     printf ( "\ncabinet file dump\n" );
+    offset = base + header->coffFiles;
 
     /* Dump all file structures */
     for ( i = 0; i < header->cFiles; i++ )
     {
         /* Assign file structure pointer */
-        PTR_ASSERT ( header, sizeof ( struct CFFILE ), base, size );
+        PTR_ASSERT ( offset, sizeof ( struct CFFILE ), base, size );
 
         /* Dump file structure */
         dump_file ( ( const struct CFFILE * ) offset, i + 1 == header->cFiles );
@@ -195,507 +226,2036 @@ static int list_files ( const unsigned char *base, size_t size )
     return 0;
 }
 
-/* Uncompress data */
-static int uncompress_data ( int type, const unsigned char *compressed, size_t compressed_size,
-    struct cfdata_ctx *sector, z_stream * stream )
+/* Mark file entries matching selection */
+static size_t select_files ( struct cffile_table *table, const struct selection_t *selection )
 {
-    int error_status;
+    size_t i;
+    size_t j;
+    size_t n_selected = 0;
+    struct cffile_entry *entry;
 
-    /* Supported compression types are none and ms-zip */
-    if ( !( type & 0x000F ) )
+    for ( i = 0; i < table->n_entries; i++ )
     {
-        /* On none compression type copy data */
-        if ( compressed_size > sector->uncompressed_size )
+        entry = &table->entries[i];
+
+        /* Select everything if no criteria given */
+        entry->selected = !selection->n_patterns && !selection->n_indices;
+
+        for ( j = 0; !entry->selected && j < selection->n_patterns; j++ )
         {
-            return ENOBUFS;
+            entry->selected =
+                !fnmatch ( selection->patterns[j], entry->filename, FNM_NOESCAPE );
         }
-        memcpy ( sector->uncompressed, compressed, compressed_size );
 
-    } else if ( ( type & 0x000F ) != 1 )
-    {
-        return ENOTSUP;
+        for ( j = 0; !entry->selected && j < selection->n_indices; j++ )
+        {
+            entry->selected = selection->indices[j] == entry->nfile;
+        }
+
+        if ( entry->selected )
+        {
+            n_selected++;
+        }
     }
 
-    /* Validate compressed data length */
-    if ( compressed_size < 2 )
+    return n_selected;
+}
+
+/* Prepare extraction context of folder files */
+static int prepare_files ( size_t nfolder, struct cffolder_ctx *folder_ctx,
+    const struct cffile_table *table )
+{
+    size_t i;
+    size_t first;
+    size_t last;
+    const struct cffile_entry *entry;
+    struct cffile_ctx *file_ctx;
+
+    /* Folder entries are already ordered by offset */
+    first = table->buckets[nfolder];
+    last = table->buckets[nfolder + 1];
+
+    /* Allocate files table */
+    if ( ( folder_ctx->files =
+            ( struct cffile_ctx * ) malloc ( ( last - first +
+                    1 ) * sizeof ( struct cffile_ctx ) ) ) == NULL )
     {
-        return ENODATA;
+        return ENOMEM;
     }
 
-    /* Validate ms-zip header */
-    if ( compressed[0] != 0x43 || compressed[1] != 0x4b )
+    /* Keep selected files only */
+    for ( i = first; i < last; i++ )
     {
-        return EINVAL;
-    }
+        entry = &table->entries[i];
+        if ( !entry->selected )
+        {
+            continue;
+        }
 
-    /* Prepare decompression parameters */
-    stream->avail_in = compressed_size - 2;
-    stream->next_in = ( unsigned char * ) compressed + 2;
+        file_ctx = &folder_ctx->files[folder_ctx->n_files++];
+        file_ctx->entry = entry;
+        file_ctx->fd = -1;
+        file_ctx->map = NULL;
+        file_ctx->done = FALSE;
+
+        /* Sectors range of streamed folder is found as sectors arrive */
+        if ( folder_ctx->index == NULL )
+        {
+            file_ctx->first_sector = ( size_t ) -1;
+            file_ctx->last_sector = ( size_t ) -1;
+            continue;
+        }
 
-    stream->avail_out = sector->uncompressed_size;
-    stream->next_out = sector->uncompressed;
+        /* Look up sectors range holding file data */
+        file_ctx->first_sector = find_sector ( folder_ctx, entry->offset );
+        file_ctx->last_sector =
+            entry->length ? find_sector ( folder_ctx,
+            ( size_t ) entry->offset + entry->length - 1 ) : file_ctx->first_sector;
 
-    /* Decompress data with RFC 1951 inflate */
-    error_status = inflate ( stream, Z_FINISH );
-    if ( error_status != Z_OK && error_status != Z_STREAM_END )
-    {
-        fprintf ( stderr, "Failed to inflate data: %s\n", stream->msg );
-        return error_status;
+        /* Track last sector needed by folder files */
+        if ( folder_ctx->n_needed <= file_ctx->last_sector )
+        {
+            folder_ctx->n_needed = file_ctx->last_sector + 1;
+        }
     }
 
-    if ( stream->total_out != sector->uncompressed_size )
+    /* Closing index entry is not a real sector */
+    if ( folder_ctx->n_needed > folder_ctx->n_sectors )
     {
-        return ENODATA;
+        folder_ctx->n_needed = folder_ctx->n_sectors;
     }
 
     return 0;
 }
 
-/* Calculate file name length */
-static size_t file_name_len ( const unsigned char *offset, const unsigned char *limit )
+/* Open single file for writing */
+static int open_file ( struct cffile_ctx *file_ctx, struct unpack_jobs_t *jobs )
 {
-    const unsigned char *finish = offset;
+    char path[2048];
 
-    while ( finish < limit && *finish != '\0' )
+    if ( jobs->pipe_fd >= 0 )
     {
-        finish++;
-    }
+        /* Stream file content into pipe */
+        file_ctx->fd = jobs->pipe_fd;
 
-    return finish - offset + 1;
-}
+    } else
+    {
+        /* Prepare unpack path */
+        snprintf ( path, sizeof ( path ), "%s/%s", jobs->prefix, file_ctx->entry->filename );
 
-/* Unpack single file */
-static int unpack_file ( const struct cffolder_ctx *folder_ctx, const struct CFFILE *file,
-    const unsigned char *limit, size_t * suboffset, const char *prefix,
-    const struct progress_t *progress )
-{
-    int fd;
-    int stop = FALSE;
-    size_t i;
-    size_t isum = 0;
-    size_t osum = 0;
-    size_t offset;
-    size_t ilen;
-    size_t olen;
-    const char *filename;
-    char path[2048];
+        /* Open file for writing */
+        if ( ( file_ctx->fd = open ( path, O_CREAT | O_WRONLY | O_TRUNC, 0644 ) ) < 0 )
+        {
+            return errno;
+        }
+
+        /* Reserve file space up front, ignore if not supported */
+        if ( file_ctx->entry->length
+            && fallocate ( file_ctx->fd, 0, 0, file_ctx->entry->length ) < 0
+            && errno != EOPNOTSUPP && errno != ENOSYS && errno != EINVAL )
+        {
+            return errno;
+        }
 
-    /* Calculate suboffset value */
-    *suboffset =
-        sizeof ( struct CFFILE ) + file_name_len ( ( const unsigned char * ) file +
-        sizeof ( struct CFFILE ), limit );
+        /* Map large output file so blocks can be inflated in place */
+        if ( jobs->map_output && file_ctx->entry->length >= MAP_OUTPUT_MIN )
+        {
+            if ( ftruncate ( file_ctx->fd, file_ctx->entry->length ) < 0 )
+            {
+                return errno;
+            }
 
-    /* Validate data range */
-    if ( ( const unsigned char * ) file + *suboffset >= limit )
-    {
-        return ERANGE;
+            /* Keep writing through file if mapping fails */
+            if ( ( file_ctx->map =
+                    ( unsigned char * ) mmap ( NULL, file_ctx->entry->length,
+                        PROT_READ | PROT_WRITE, MAP_SHARED, file_ctx->fd, 0 ) ) == MAP_FAILED )
+            {
+                file_ctx->map = NULL;
+            }
+        }
     }
 
-    /* Assign filename pointer */
-    filename = ( const char * ) file + sizeof ( struct CFFILE );
+    /* Update progress */
+    progress_add ( &jobs->progress, 1, 0, 0, file_ctx->entry->folder );
 
-    /* Prepare unpack path */
-    snprintf ( path, sizeof ( path ), "%s/%s", prefix, filename );
+    return 0;
+}
 
-    /* Open file for writing */
-    if ( ( fd = open ( path, O_CREAT | O_WRONLY | O_TRUNC, 0644 ) ) < 0 )
+/* Close single file once finished */
+static void close_file ( struct cffile_ctx *file_ctx, const struct unpack_jobs_t *jobs )
+{
+    if ( file_ctx->map != NULL )
     {
-        return errno;
+        munmap ( file_ctx->map, file_ctx->entry->length );
+        file_ctx->map = NULL;
     }
 
-    /* Extract data from sectors matching file range */
-    for ( i = 0; i < folder_ctx->n_sectors; i++ )
+    if ( file_ctx->fd >= 0 && file_ctx->fd != jobs->pipe_fd )
     {
-        printf ( "\rDone %.2u%% file %u of %u\r",
-            ( 100 * ( progress->file + 1 ) / progress->n_files ), ( progress->file + 1 ),
-            progress->n_files );
+        close ( file_ctx->fd );
+    }
 
-        if ( isum + folder_ctx->sectors[i].uncompressed_size < file->uoffFolderStart )
-        {
-            isum += folder_ctx->sectors[i].uncompressed_size;
-            continue;
-        }
+    file_ctx->fd = -1;
 
-        if ( file->uoffFolderStart > isum )
-        {
-            offset = file->uoffFolderStart - isum;
-        } else
-        {
-            offset = 0;
-        }
+    file_ctx->done = TRUE;
+}
 
-        if ( offset + file->cbFile - osum > folder_ctx->sectors[i].uncompressed_size )
-        {
-            ilen = folder_ctx->sectors[i].uncompressed_size - offset;
-            isum += folder_ctx->sectors[i].uncompressed_size;
-        } else
-        {
-            ilen = file->cbFile - osum;
-            stop = TRUE;
-        }
+/* Write whole buffer at file offset */
+static int write_data ( int fd, const unsigned char *data, size_t len, off_t offset,
+    int seekable )
+{
+    ssize_t len_written;
+
+    while ( len )
+    {
+        /* Pipe output has no offsets */
+        len_written = seekable ? pwrite ( fd, data, len, offset ) : write ( fd, data, len );
 
-        if ( ( ssize_t ) ( olen =
-                write ( fd, folder_ctx->sectors[i].uncompressed + offset, ilen ) ) < 0 )
+        if ( len_written < 0 )
         {
-            close ( fd );
+            if ( errno == EINTR )
+            {
+                continue;
+            }
             return errno;
         }
 
-        if ( stop )
+        if ( !len_written )
         {
-            break;
+            return EIO;
         }
 
-        osum += olen;
+        data += len_written;
+        len -= len_written;
+        offset += len_written;
     }
 
-    /* Free output file fd */
-    close ( fd );
-
     return 0;
 }
 
-#define GetUi32(p) ( \
-             ((const Byte *)(p))[0]        | \
-    ((unsigned int)((const Byte *)(p))[1] <<  8) | \
-    ((unsigned int)((const Byte *)(p))[2] << 16) | \
-((unsigned int)((const Byte *)(p))[3] << 24))
-
-
-/* Calculate cfdata checksum */
-static unsigned int checksum ( const unsigned char *p, unsigned int size )
+/* Write decoded folder range to files overlapping it */
+static int unpack_range ( struct cffolder_ctx *folder_ctx, const unsigned char *data,
+    size_t start, size_t end, size_t nsector, struct unpack_jobs_t *jobs )
 {
-    unsigned int sum = 0;
+    int error_status;
+    size_t i;
+    size_t from;
+    size_t to;
+    struct cffile_ctx *file_ctx;
 
-    for ( ; size >= 8; size -= 8 )
+    /* Files are ordered by first sector */
+    for ( i = folder_ctx->next_file;
+        i < folder_ctx->n_files && folder_ctx->files[i].first_sector <= nsector; i++ )
     {
-        sum ^= GetUi32 ( p ) ^ GetUi32 ( p + 4 );
-        p += 8;
-    }
+        file_ctx = &folder_ctx->files[i];
 
-    if ( size >= 4 )
-    {
-        sum ^= GetUi32 ( p );
-        p += 4;
-    }
+        /* Skip already finished files */
+        if ( file_ctx->done )
+        {
+            continue;
+        }
 
-    size &= 3;
-    if ( size > 2 )
-        sum ^= ( unsigned int ) ( *p++ ) << 16;
-    if ( size > 1 )
-        sum ^= ( unsigned int ) ( *p++ ) << 8;
-    if ( size > 0 )
-        sum ^= ( unsigned int ) ( *p++ );
+        /* Open file when its first sector is reached */
+        if ( file_ctx->fd < 0 )
+        {
+            if ( ( error_status = open_file ( file_ctx, jobs ) ) != 0 )
+            {
+                return error_status;
+            }
+        }
 
-    return sum;
-}
+        /* Write part of file placed in this sector */
+        from = file_ctx->entry->offset;
+        to = from + file_ctx->entry->length;
+        from = from > start ? from : start;
+        to = to < end ? to : end;
 
-/* Load and uncompress folder sectors */
-static int uncompress_folder ( size_t nfolder, const struct CFFOLDER *folder,
-    struct cffolder_ctx *folder_ctx, const unsigned char *base, size_t size, const char *prefix )
-{
-    int error_status = 0;
-    unsigned short i;
-    const struct CFHEADER *header;
-    const struct CFFILE *file;
-    const struct CFDATA *sector;
-    const unsigned char *offset;
-    size_t suboffset;
-    z_stream stream;
-    int stream_freed = TRUE;
-    struct progress_t progress;
+        if ( to > from
+            && ( error_status =
+                write_data ( file_ctx->fd, data + from - start, to - from,
+                    from - file_ctx->entry->offset, file_ctx->fd != jobs->pipe_fd ) ) != 0 )
+        {
+            return error_status;
+        }
 
-    /* Assign header structure pointer */
-    header = ( const struct CFHEADER * ) base;
-    PTR_ASSERT ( header, sizeof ( struct CFHEADER ), base, size );
+        progress_add ( &jobs->progress, 0, 0, to > from ? to - from : 0,
+            file_ctx->entry->folder );
 
-    /* Allocate sectors table */
-    if ( ( folder_ctx->sectors =
-            ( struct cfdata_ctx * ) malloc ( folder->cCFData * sizeof ( struct cfdata_ctx ) ) ) ==
-        NULL )
-    {
-        return ENOMEM;
+        /* Close file once its last sector is written */
+        if ( file_ctx->last_sector <= nsector )
+        {
+            close_file ( file_ctx, jobs );
+        }
     }
 
-    /* Reset each sector content pointer */
-    for ( i = 0; i < folder->cCFData; i++ )
+    /* Skip leading finished files */
+    while ( folder_ctx->next_file < folder_ctx->n_files
+        && folder_ctx->files[folder_ctx->next_file].done )
     {
-        folder_ctx->sectors[i].uncompressed = NULL;
+        folder_ctx->next_file++;
     }
 
-    /* Assign sector strcuture pointer */
-    sector = ( const struct CFDATA * ) ( base + folder->coffCabStart );
+    return 0;
+}
 
-    /* Prepare zlib inflate stream */
-    memset ( &stream, '\0', sizeof ( stream ) );
-    stream.zalloc = ( alloc_func ) NULL;
-    stream.zfree = ( free_func ) NULL;
-    stream.opaque = ( voidpf ) NULL;
+/* Copy cabinet byte range into output without user space buffer */
+static int copy_range ( int *mode, int in_fd, off_t offset, const unsigned char *data,
+    int out_fd, size_t len )
+{
+    ssize_t len_copied;
+    loff_t range_offset;
+    off_t file_offset;
 
-    /* Initialize inflate stream for raw data */
-    if ( ( error_status = inflateInit2 ( &stream, -15 ) ) != Z_OK )
+    while ( len )
     {
-        return error_status;
-    }
-
-    stream_freed = FALSE;
+        if ( *mode == COPY_RANGE )
+        {
+            /* Let file system share or copy extents */
+            range_offset = offset;
+            len_copied = copy_file_range ( in_fd, &range_offset, out_fd, NULL, len, 0 );
 
-    /* Load content each sector */
-    for ( i = 0; i < folder->cCFData; i++ )
-    {
-        /* Assert sector structure pointer */
-        PTR_ASSERT ( sector, sizeof ( struct CFDATA ), base, size );
+        } else if ( *mode == COPY_SENDFILE )
+        {
+            /* Splice page cache into output, works for pipes */
+            file_offset = offset;
+            len_copied = sendfile ( out_fd, in_fd, &file_offset, len );
 
-        /* Allocate sector buffer */
-        if ( ( folder_ctx->sectors[i].uncompressed =
-                ( unsigned char * ) malloc ( sector->cbUncomp ) ) == NULL )
+        } else
         {
-            error_status = ENOMEM;
-            goto exit;
+            /* Write straight from cabinet mapping */
+            len_copied = write ( out_fd, data + offset, len );
         }
 
-        /* Update sector buffer size */
-        folder_ctx->sectors[i].uncompressed_size = sector->cbUncomp;
-
-        /* Reset inflate stream and apply dictionary if needed */
-        if ( i )
+        if ( len_copied < 0 )
         {
-            if ( ( error_status = inflateReset ( &stream ) ) != Z_OK )
+            if ( errno == EINTR )
             {
-                goto exit;
+                continue;
             }
 
-            if ( ( error_status =
-                    inflateSetDictionary ( &stream, folder_ctx->sectors[i - 1].uncompressed,
-                        folder_ctx->sectors[i - 1].uncompressed_size ) ) != Z_OK )
+            /* Fall back to next method if not supported for these files */
+            if ( *mode != COPY_WRITE && ( errno == EINVAL || errno == EXDEV
+                    || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF ) )
             {
-                goto exit;
+                ( *mode )++;
+                continue;
             }
+
+            return errno;
         }
 
-        /* Uncompress data into sector buffer */
-        if ( ( error_status =
-                uncompress_data ( folder->typeCompress,
-                    ( const unsigned char * ) sector + sizeof ( struct CFDATA ), sector->cbData,
-                    &folder_ctx->sectors[i], &stream ) ) != 0 )
+        /* Cabinet ended before data did */
+        if ( !len_copied )
         {
-            goto exit;
+            return ENODATA;
         }
 
-        /* Verify checksum if not set to zero */
-        if ( sector->csum )
+        offset += len_copied;
+        len -= len_copied;
+    }
+
+    return 0;
+}
+
+/* Write output decoded since last flush */
+static int flush_window ( struct cffolder_ctx *folder_ctx, size_t nsector,
+    struct unpack_jobs_t *jobs )
+{
+    int error_status;
+
+    if ( folder_ctx->window_fill > folder_ctx->window_pending )
+    {
+        if ( ( error_status =
+                unpack_range ( folder_ctx, folder_ctx->window + folder_ctx->window_pending,
+                    folder_ctx->index[folder_ctx->pending_sector].folder_offset,
+                    folder_ctx->index[nsector].folder_offset, nsector - 1, jobs ) ) != 0 )
         {
-            if ( sector->csum !=
-                checksum ( ( const unsigned char * ) sector + sizeof ( struct CFDATA ) -
-                    sizeof ( unsigned int ), sector->cbData + sizeof ( unsigned int ) ) )
-            {
-                printf ( "! checksum is invalid at sector #%u\n", i );
-            }
+            return error_status;
         }
-
-        /* Load next sector offset */
-        sector =
-            ( const struct CFDATA * ) ( ( const unsigned char * ) sector +
-            sizeof ( struct CFDATA ) + sector->cbData );
     }
 
-    /* Update sectors count */
-    folder_ctx->n_sectors = folder->cCFData;
+    folder_ctx->window_pending = folder_ctx->window_fill;
+    folder_ctx->pending_sector = nsector;
+
+    return 0;
+}
 
-    /* Free zlib inflate stream */
-    inflateEnd ( &stream );
-    stream_freed = TRUE;
+/* Locate dictionary before folder offset split between window and mapped file */
+static size_t split_dictionary ( const struct cffolder_ctx *folder_ctx, size_t end,
+    const unsigned char **window, size_t *window_len, const unsigned char **map )
+{
+    size_t want;
+    size_t map_len;
+    const struct cffile_ctx *file_ctx = folder_ctx->direct;
+
+    /* Window holds output up to where file mapping took over */
+    want = end - ( folder_ctx->direct_from - folder_ctx->window_fill );
+    want = want < MSZIP_WINDOW_SIZE ? want : MSZIP_WINDOW_SIZE;
+    map_len = end - file_ctx->entry->offset;
+    map_len = map_len < want ? map_len : want;
+
+    *window_len = want - map_len;
+    *window =
+        folder_ctx->window + folder_ctx->window_fill - ( folder_ctx->direct_from - ( end -
+            want ) );
+    *map = file_ctx->map + end - map_len - file_ctx->entry->offset;
+
+    return map_len;
+}
+
+/* Move dictionary back to window once mapped file is left */
+static void leave_direct ( struct cffolder_ctx *folder_ctx, size_t end, size_t nsector )
+{
+    size_t window_len;
+    size_t map_len;
+    const unsigned char *window;
+    const unsigned char *map;
 
-    /* Calculate file table offset */
-    offset = base + sizeof ( struct CFHEADER ) + header->cFolders * sizeof ( struct CFFOLDER );
-    if ( offset >= base + size )
+    map_len = split_dictionary ( folder_ctx, end, &window, &window_len, &map );
+
+    if ( window_len )
     {
-        return ERANGE;
+        memmove ( folder_ctx->window, window, window_len );
     }
+    memcpy ( folder_ctx->window + window_len, map, map_len );
 
-    /* Prepare progress structure */
-    progress.n_files = header->cFiles;
+    /* Dictionary is already in file, nothing pending */
+    folder_ctx->window_fill = window_len + map_len;
+    folder_ctx->window_pending = folder_ctx->window_fill;
+    folder_ctx->pending_sector = nsector;
+    folder_ctx->direct = NULL;
+}
 
-    /* Extract each file from folder */
-    for ( i = 0; i < header->cFiles; i++ )
+/* Pick mapped file that fully holds sector output */
+static int select_direct ( struct cffolder_ctx *folder_ctx, size_t nsector,
+    struct unpack_jobs_t *jobs )
+{
+    int error_status;
+    size_t i;
+    size_t start;
+    size_t end;
+    struct cffile_ctx *file_ctx;
+    struct cffile_ctx *target = NULL;
+
+    start = folder_ctx->index[nsector].folder_offset;
+    end = folder_ctx->index[nsector + 1].folder_offset;
+
+    for ( i = folder_ctx->next_file;
+        i < folder_ctx->n_files && folder_ctx->files[i].first_sector <= nsector; i++ )
     {
-        /* Assign file structure pointer */
-        file = ( const struct CFFILE * ) offset;
-        PTR_ASSERT ( file, sizeof ( struct CFFILE ), base, size );
+        file_ctx = &folder_ctx->files[i];
 
-        /* Skip files of other folders */
-        if ( file->iFolder != nfolder )
+        if ( file_ctx->done || file_ctx->entry->offset > start
+            || file_ctx->entry->offset + ( size_t ) file_ctx->entry->length < end )
         {
-            offset +=
-                sizeof ( struct CFFILE ) + file_name_len ( offset + sizeof ( struct CFFILE ),
-                base + size );
             continue;
         }
 
-        /* Update progress structure */
-        progress.file = i;
-
-        /* Uncompress single file */
-        if ( ( error_status =
-                unpack_file ( folder_ctx, file, base + size, &suboffset, prefix,
-                    &progress ) ) != 0 )
+        /* Open file early to get its mapping */
+        if ( file_ctx->fd < 0 && ( error_status = open_file ( file_ctx, jobs ) ) != 0 )
         {
-            goto exit;
+            return error_status;
         }
 
-        offset += suboffset;
+        target = file_ctx->map != NULL ? file_ctx : NULL;
+        break;
     }
 
-  exit:
-
-    /* Free zlib inflate stream if not done before */
-    if ( !stream_freed )
+    /* Leave previous mapping */
+    if ( folder_ctx->direct != NULL && folder_ctx->direct != target )
     {
-        inflateEnd ( &stream );
+        leave_direct ( folder_ctx, start, nsector );
     }
 
-    /* Free buffer of each sector */
-    for ( i = 0; i < folder->cCFData; i++ )
+    /* Write pending output before file continues in mapping */
+    if ( target != NULL && folder_ctx->direct != target )
     {
-        if ( folder_ctx->sectors[i].uncompressed != NULL )
+        if ( ( error_status = flush_window ( folder_ctx, nsector, jobs ) ) != 0 )
         {
-            free ( folder_ctx->sectors[i].uncompressed );
+            return error_status;
         }
-    }
 
-    /* Free sectors table */
-    free ( folder_ctx->sectors );
+        folder_ctx->direct = target;
+        folder_ctx->direct_from = start;
+    }
 
-    return error_status;
+    return 0;
 }
 
-/* Unpack files to directory */
-static int unpack_files ( const unsigned char *base, size_t size, const char *prefix )
+/* Apply dictionary preceding block inflated in place */
+static int direct_dictionary ( const struct cffolder_ctx *folder_ctx, size_t end,
+    z_stream * stream )
 {
-    int error_status = 0;
-    unsigned short i;
-    const struct CFHEADER *header;
-    const struct CFFOLDER *folder;
-    const unsigned char *offset;
-    struct cffolder_ctx *folders;
-    struct stat statbuf;
+    int error_status;
+    size_t window_len;
+    size_t map_len;
+    const unsigned char *window;
+    const unsigned char *map;
 
-    /* Create directory if not exists */
-    if ( stat ( prefix, &statbuf ) < 0 && errno == ENOENT )
+    map_len = split_dictionary ( folder_ctx, end, &window, &window_len, &map );
+
+    /* Dictionary wholly in mapping is referenced in place */
+    if ( !window_len )
     {
-        mkdir ( prefix, 0755 );
+        stream->next_out = ( unsigned char * ) map + map_len;
+        return map_len ? inflateSetDictionaryRef ( stream, map, map_len ) : 0;
     }
 
-    /* Assign header structure pointer */
-    header = ( const struct CFHEADER * ) base;
-    PTR_ASSERT ( header, sizeof ( struct CFHEADER ), base, size );
-    offset = base + sizeof ( struct CFHEADER );
-
-    /* Verify header signature */
-    if ( header->signature[0] != 0x4d || header->signature[1] != 0x53
-        || header->signature[2] != 0x43 || header->signature[3] != 0x46 )
+    /* Second call extends dictionary set by first one */
+    if ( window_len
+        && ( error_status = inflateSetDictionary ( stream, window, window_len ) ) != Z_OK )
     {
-        fprintf ( stderr, "Error: Header signature is invalid\n" );
-        return EINVAL;
+        return error_status;
     }
 
-    /* Show folders count */
-    printf ( "Folders count: %5u\n", header->cFolders );
-
-    /* Allocate folders table */
-    if ( ( folders =
-            ( struct cffolder_ctx * ) malloc ( header->cFolders *
-                sizeof ( struct cffolder_ctx ) ) ) == NULL )
+    if ( map_len && ( error_status = inflateSetDictionary ( stream, map, map_len ) ) != Z_OK )
     {
-        fprintf ( stderr, "Failed to allocate folders table: %i\n", ENOMEM );
-        return ENOMEM;
+        return error_status;
     }
 
-    /* Uncompress each folder */
-    for ( i = 0; i < header->cFolders; i++ )
+    return 0;
+}
+
+/* Extract stored folder files directly from cabinet file */
+static int copy_folder ( struct cffolder_ctx *folder_ctx, struct unpack_jobs_t *jobs )
+{
+    int error_status;
+    int mode = COPY_RANGE;
+    size_t i;
+    size_t j;
+    size_t position;
+    size_t end;
+    size_t to;
+    const struct CFDATA *sector;
+    struct cffile_ctx *file_ctx;
+
+    for ( j = 0; j < folder_ctx->n_files; j++ )
     {
-        /* Assign folder structure pointer */
-        folder = ( const struct CFFOLDER * ) offset;
-        if ( offset + sizeof ( struct CFFOLDER ) >= base + size )
+        file_ctx = &folder_ctx->files[j];
+
+        if ( ( error_status = open_file ( file_ctx, jobs ) ) != 0 )
         {
-            error_status = ERANGE;
-            goto exit;
+            return error_status;
         }
 
-        /* Load and uncompress folder sectors */
-        if ( ( error_status =
-                uncompress_folder ( i, folder, &folders[i], base, size, prefix ) ) != 0 )
+        position = file_ctx->entry->offset;
+        end = position + file_ctx->entry->length;
+
+        /* Copy file part of each sector skipping sector headers */
+        for ( i = file_ctx->first_sector; position < end && i < folder_ctx->n_sectors; i++ )
         {
-            fprintf ( stderr, "Failed to uncompress folder: %i\n", error_status );
-            goto exit;
-        }
+            sector = ( const struct CFDATA * ) ( jobs->base + folder_ctx->index[i].cab_offset );
 
-        offset += sizeof ( struct CFFOLDER );
-    }
+            /* Stored sector holds data as is */
+            if ( sector->cbData != sector->cbUncomp )
+            {
+                return ENODATA;
+            }
 
-  exit:
+            to = folder_ctx->index[i + 1].folder_offset;
+            to = to < end ? to : end;
 
-    /* Print separator line */
-    putchar ( '\n' );
+            if ( ( error_status =
+                    copy_range ( &mode, jobs->cab_fd,
+                        folder_ctx->index[i].cab_offset + sizeof ( struct CFDATA ) + position -
+                        folder_ctx->index[i].folder_offset, jobs->base, file_ctx->fd,
+                        to - position ) ) != 0 )
+            {
+                return error_status;
+            }
 
-    /* Free folders table */
-    free ( folders );
+            progress_add ( &jobs->progress, 0, to - position, to - position,
+                file_ctx->entry->folder );
+            position = to;
+        }
 
-    return error_status;
-}
+        close_file ( file_ctx, jobs );
+    }
 
-/* Show program usage */
-static void show_usage ( void )
-{
-    printf ( "icab-unpack -lu file dest\n" );
+    return 0;
 }
 
-/* Unpack utility main function */
-int main ( int argc, char *argv[] )
+/* Check folder files lie within folder data */
+static int check_files ( size_t nfolder, const struct cffolder_ctx *folder_ctx,
+    const struct cffile_table *table )
 {
     int error_status = 0;
-    int fd = -1;
-    struct stat statbuf;
-    void *data = NULL;
-    int action;
+    size_t i;
+    const struct cffile_entry *entry;
 
-    /* Show program logo */
-    printf ( "CAB unpack - ver. " ICAB_VERSION "\n" );
+    for ( i = table->buckets[nfolder]; i < table->buckets[nfolder + 1]; i++ )
+    {
+        entry = &table->entries[i];
+
+        if ( ( size_t ) entry->offset + entry->length >
+            folder_ctx->index[folder_ctx->n_sectors].folder_offset )
+        {
+            fprintf ( stderr, "Error: File %s exceeds folder %u data\n", entry->filename,
+                ( unsigned int ) nfolder );
+            error_status = ERANGE;
+        }
+    }
+
+    return error_status;
+}
+
+/* Check files refer to existing folders */
+static int check_folders ( size_t n_folders, const struct cffile_table *table )
+{
+    int error_status = 0;
+    size_t i;
+    const struct cffile_entry *entry;
+
+    /* Entries past last bucket hold other folder indexes */
+    for ( i = table->buckets[n_folders]; i < table->n_entries; i++ )
+    {
+        entry = &table->entries[i];
+
+        /* Continued file markers refer to other cabinets */
+        if ( entry->folder < 0xFFFD )
+        {
+            fprintf ( stderr, "Error: File %s refers to missing folder %u\n", entry->filename,
+                entry->folder );
+            error_status = ERANGE;
+        }
+    }
+
+    return error_status;
+}
+
+/* Save dictionary window as sidecar checkpoint */
+static int save_checkpoint ( struct cffolder_ctx *folder_ctx, size_t nsector,
+    unsigned int interval, const unsigned char *window, size_t window_len )
+{
+    struct CABIDX_CHECKPOINT *checkpoint;
+
+    /* Allocate checkpoints table on first use */
+    if ( folder_ctx->checkpoints == NULL )
+    {
+        if ( ( folder_ctx->checkpoints =
+                ( struct CABIDX_CHECKPOINT * ) malloc ( ( folder_ctx->n_sectors / interval +
+                        1 ) * sizeof ( struct CABIDX_CHECKPOINT ) ) ) == NULL )
+        {
+            return ENOMEM;
+        }
+    }
+
+    checkpoint = &folder_ctx->checkpoints[folder_ctx->n_checkpoints++];
+    checkpoint->iCFData = nsector;
+    checkpoint->cbWindow = window_len;
+    memcpy ( checkpoint->window, window, window_len );
+
+    return 0;
+}
+
+/* Place next block in window after dictionary */
+static int prepare_block ( const struct CFFOLDER *folder, struct cffolder_ctx *folder_ctx,
+    size_t nsector, struct cfdata_ctx *block, z_stream * stream, struct unpack_jobs_t *jobs )
+{
+    int error_status;
+    size_t dict_len;
+    size_t keep_from;
+
+    /* Dictionary is the tail of output decoded so far */
+    dict_len =
+        folder_ctx->window_fill < MSZIP_WINDOW_SIZE ? folder_ctx->window_fill :
+        MSZIP_WINDOW_SIZE;
+
+    /* Flush pending output once write size would be exceeded */
+    if ( folder_ctx->window_fill - folder_ctx->window_pending + block->uncompressed_size >
+        jobs->write_size && ( error_status = flush_window ( folder_ctx, nsector, jobs ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    /* Keep only dictionary and pending output if block does not fit */
+    if ( folder_ctx->window_fill + block->uncompressed_size > folder_ctx->window_size )
+    {
+        keep_from = folder_ctx->window_fill - dict_len;
+        keep_from =
+            folder_ctx->window_pending < keep_from ? folder_ctx->window_pending : keep_from;
+        memmove ( folder_ctx->window, folder_ctx->window + keep_from,
+            folder_ctx->window_fill - keep_from );
+        folder_ctx->window_fill -= keep_from;
+        folder_ctx->window_pending -= keep_from;
+    }
+
+    /* Assign block buffer right after dictionary */
+    block->uncompressed = folder_ctx->window + folder_ctx->window_fill;
+
+    /* Let inflate refer back to preceding output in place */
+    stream->next_out = block->uncompressed;
+    if ( dict_len
+        && ( error_status =
+            inflateSetDictionaryRef ( stream, block->uncompressed - dict_len,
+                dict_len ) ) != Z_OK )
+    {
+        return error_status;
+    }
+
+    /* Record checkpoint every interval sectors, only ms-zip resumes from one */
+    if ( jobs->interval && ( folder->typeCompress & 0x000F ) == 1 && nsector
+        && !( nsector % jobs->interval )
+        && ( error_status =
+            save_checkpoint ( folder_ctx, nsector, jobs->interval,
+                block->uncompressed - dict_len, dict_len ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    return 0;
+}
+
+/* Create files placed beyond folder data */
+static int create_trailing ( struct cffolder_ctx *folder_ctx, struct unpack_jobs_t *jobs )
+{
+    int error_status;
+    size_t i;
+
+    for ( i = folder_ctx->next_file; i < folder_ctx->n_files; i++ )
+    {
+        if ( !folder_ctx->files[i].done && folder_ctx->files[i].fd < 0 )
+        {
+            if ( ( error_status = open_file ( &folder_ctx->files[i], jobs ) ) != 0 )
+            {
+                return error_status;
+            }
+        }
+
+        close_file ( &folder_ctx->files[i], jobs );
+    }
+
+    return 0;
+}
+
+/* Locate folder structure, set folder starts in first volume holding it */
+static const struct CFFOLDER *get_folder ( const struct unpack_jobs_t *jobs, size_t nfolder )
+{
+    if ( jobs->set != NULL )
+    {
+        return jobs->set->segments[jobs->set->folders[nfolder]].folder;
+    }
+
+    return layout_folder ( jobs->base, jobs->size, &jobs->layout, nfolder );
+}
+
+/* Locate sector data and check its checksum */
+static int locate_sector ( const struct cffolder_ctx *folder_ctx, size_t nsector,
+    const struct unpack_jobs_t *jobs, unsigned char *scratch, const unsigned char **data,
+    size_t *len, int *valid )
+{
+    const struct CFDATA *sector;
+
+    /* Set sectors lie in any volume, some split across two */
+    if ( jobs->set != NULL )
+    {
+        return gather_sector ( jobs->set, &folder_ctx->index[nsector], scratch, data, len,
+            valid );
+    }
+
+    sector = ( const struct CFDATA * ) ( jobs->base + folder_ctx->index[nsector].cab_offset );
+    *data = ( const unsigned char * ) sector + sizeof ( struct CFDATA );
+    *len = sector->cbData;
+    *valid = !sector->csum
+        || sector->csum == checksum ( *data - sizeof ( unsigned int ),
+        *len + sizeof ( unsigned int ) );
+
+    return 0;
+}
+
+/* Stream folder sectors into files */
+static int uncompress_folder ( size_t nfolder, const struct CFFOLDER *folder,
+    struct cffolder_ctx *folder_ctx, struct arena_t *arena, struct unpack_jobs_t *jobs )
+{
+    int error_status = 0;
+    size_t i;
+    size_t j;
+    size_t start = 0;
+    size_t compressed_len;
+    int valid;
+    struct cffile_ctx *file_ctx;
+    const struct CABIDX_CHECKPOINT *checkpoint = NULL;
+    const unsigned char *compressed;
+    unsigned char *scratch = NULL;
+    struct cfdata_ctx block;
+    struct decoder_ctx decoder = { NULL, NULL };
+    z_stream *stream = NULL;
+
+    /* Reset folder context */
+    memset ( folder_ctx, '\0', sizeof ( struct cffolder_ctx ) );
+
+    /* Index folder sectors, set folders over all their volumes */
+    if ( ( error_status = jobs->set != NULL ?
+            index_set_folder ( jobs->set, nfolder, folder_ctx ) :
+            index_folder ( folder, folder_ctx, jobs->base, jobs->size, jobs->cabidx,
+                nfolder ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Prepare files of this folder */
+    if ( ( error_status = prepare_files ( nfolder, folder_ctx, jobs->table ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Stored folders need sectors index only in sidecar */
+    if ( jobs->interval && !( folder->typeCompress & 0x000F ) )
+    {
+        goto exit;
+
+    } else if ( jobs->interval )
+    {
+        /* Building sidecar needs every sector decoded */
+        folder_ctx->n_needed = folder_ctx->n_sectors;
+
+    } else if ( jobs->test )
+    {
+        /* Test every sector once files fit in folder */
+        if ( ( error_status = check_files ( nfolder, folder_ctx, jobs->table ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        folder_ctx->n_needed = folder_ctx->n_sectors;
+
+    } else if ( !folder_ctx->n_files )
+    {
+        /* Nothing to decode if no file selected */
+        goto exit;
+
+    } else if ( !( folder->typeCompress & 0x000F ) && jobs->cab_fd >= 0 )
+    {
+        /* Stored data goes from cabinet file to output files */
+        error_status = copy_folder ( folder_ctx, jobs );
+        goto exit;
+
+    } else if ( ( folder->typeCompress & 0x000F ) == 1 )
+    {
+        /* Resume ms-zip stream at nearest checkpoint */
+        if ( ( checkpoint =
+                find_checkpoint ( jobs->cabidx, nfolder,
+                    folder_ctx->files[0].first_sector ) ) != NULL )
+        {
+            start = checkpoint->iCFData;
+        }
+    }
+
+    /* Allocate dictionary window followed by pending output */
+    folder_ctx->window_size = jobs->window_size;
+    arena_reset ( arena );
+    if ( ( folder_ctx->window =
+            ( unsigned char * ) arena_alloc ( arena, folder_ctx->window_size ) ) == NULL )
+    {
+        error_status = ENOMEM;
+        goto exit;
+    }
+
+    /* Blocks split across volumes are joined in scratch buffer */
+    if ( jobs->set != NULL
+        && ( scratch = ( unsigned char * ) arena_alloc ( arena, STREAM_SECTOR_SIZE ) ) == NULL )
+    {
+        error_status = ENOMEM;
+        goto exit;
+    }
+
+    /* Take raw inflate stream from thread pool */
+    if ( ( error_status = zpool_acquire ( ZPOOL_INFLATE, 0, &stream ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Lzx and quantum windows outlive single blocks */
+    if ( ( folder->typeCompress & 0x000F ) == 3
+        && ( error_status =
+            lzx_init ( &decoder.lzx, ( folder->typeCompress >> 8 ) & 0x001F ) ) != 0 )
+    {
+        goto exit;
+
+    } else if ( ( folder->typeCompress & 0x000F ) == 2
+        && ( error_status =
+            quantum_init ( &decoder.quantum, ( folder->typeCompress >> 8 ) & 0x001F ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Seed dictionary window with checkpoint output */
+    if ( checkpoint != NULL )
+    {
+        memcpy ( folder_ctx->window, checkpoint->window, checkpoint->cbWindow );
+        folder_ctx->window_fill = checkpoint->cbWindow;
+    }
+
+    /* Output starts after seeded dictionary */
+    folder_ctx->window_pending = folder_ctx->window_fill;
+    folder_ctx->pending_sector = start;
+
+    /* Stream sectors up to last one needed by selected files */
+    for ( i = start; i < folder_ctx->n_needed; i++ )
+    {
+        /* Locate sector data, block size comes from index */
+        if ( ( error_status =
+                locate_sector ( folder_ctx, i, jobs, scratch, &compressed, &compressed_len,
+                    &valid ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        block.uncompressed_size =
+            folder_ctx->index[i + 1].folder_offset - folder_ctx->index[i].folder_offset;
+        if ( block.uncompressed_size > CFDATA_MAX_UNCOMP )
+        {
+            error_status = ERANGE;
+            goto exit;
+        }
+
+        readahead_advance ( jobs->readahead, folder_ctx->index[i].cab_offset );
+
+        /* Reset inflate stream if needed */
+        if ( i > start && ( error_status = inflateReset ( stream ) ) != Z_OK )
+        {
+            goto exit;
+        }
+
+        /* Block lying inside mapped file is inflated in place */
+        if ( jobs->map_output && ( error_status = select_direct ( folder_ctx, i, jobs ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        if ( folder_ctx->direct != NULL )
+        {
+            block.uncompressed =
+                folder_ctx->direct->map + folder_ctx->index[i].folder_offset -
+                folder_ctx->direct->entry->offset;
+
+            if ( ( error_status =
+                    direct_dictionary ( folder_ctx, folder_ctx->index[i].folder_offset,
+                        stream ) ) != 0 )
+            {
+                goto exit;
+            }
+
+        } else if ( ( error_status =
+                prepare_block ( folder, folder_ctx, i, &block, stream, jobs ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        /* Uncompress data into block buffer */
+        if ( ( error_status =
+                uncompress_data ( folder->typeCompress, compressed, compressed_len, &block,
+                    stream, &decoder ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        /* Report checksum unless set to zero */
+        if ( !valid )
+        {
+            /* Checksum mismatch fails cabinet test */
+            if ( jobs->test )
+            {
+                fprintf ( stderr, "Error: Checksum mismatch at folder %u sector %u\n",
+                    ( unsigned int ) nfolder, ( unsigned int ) i );
+                error_status = EBADMSG;
+                goto exit;
+            }
+
+            printf ( "! checksum is invalid at sector #%u\n", ( unsigned int ) i );
+        }
+
+        /* Output inflated in place counts as written */
+        progress_add ( &jobs->progress, 0, compressed_len,
+            folder_ctx->direct != NULL ? block.uncompressed_size : 0, nfolder );
+
+        if ( folder_ctx->direct == NULL )
+        {
+            folder_ctx->window_fill += block.uncompressed_size;
+
+        } else if ( folder_ctx->direct->last_sector <= i )
+        {
+            /* Finish mapped file once its last block is in place */
+            file_ctx = folder_ctx->direct;
+            leave_direct ( folder_ctx, folder_ctx->index[i + 1].folder_offset, i + 1 );
+            close_file ( file_ctx, jobs );
+        }
+    }
+
+    /* Write output left in window */
+    if ( ( error_status = flush_window ( folder_ctx, i, jobs ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Account tested data */
+    if ( jobs->test )
+    {
+        pthread_mutex_lock ( &jobs->mutex );
+        jobs->n_bytes += folder_ctx->index[folder_ctx->n_sectors].folder_offset;
+        pthread_mutex_unlock ( &jobs->mutex );
+    }
+
+    /* Create files placed beyond folder data */
+    if ( ( error_status = create_trailing ( folder_ctx, jobs ) ) != 0 )
+    {
+        goto exit;
+    }
+
+  exit:
+
+    /* Return inflate stream to pool */
+    if ( stream != NULL )
+    {
+        zpool_release ( stream );
+    }
+
+    /* Release folder decoders */
+    if ( decoder.lzx != NULL )
+    {
+        lzx_free ( decoder.lzx );
+    }
+
+    if ( decoder.quantum != NULL )
+    {
+        quantum_free ( decoder.quantum );
+    }
+
+    /* Close files left open */
+    for ( j = 0; j < folder_ctx->n_files; j++ )
+    {
+        close_file ( &folder_ctx->files[j], jobs );
+    }
+
+    /* Free files table */
+    if ( folder_ctx->files != NULL )
+    {
+        free ( folder_ctx->files );
+    }
+
+    /* Sectors index and checkpoints are kept for sidecar */
+    if ( jobs->interval && !error_status )
+    {
+        return 0;
+    }
+
+    /* Free sectors index */
+    if ( folder_ctx->index != NULL )
+    {
+        free ( folder_ctx->index );
+        folder_ctx->index = NULL;
+    }
+
+    /* Free checkpoints table */
+    if ( folder_ctx->checkpoints != NULL )
+    {
+        free ( folder_ctx->checkpoints );
+        folder_ctx->checkpoints = NULL;
+    }
+
+    return error_status;
+}
+
+/* Uncompress folders picked from shared queue */
+static void *unpack_worker ( void *arg )
+{
+    int error_status;
+    unsigned short i;
+    const struct CFFOLDER *folder;
+    struct arena_t arena;
+    struct unpack_jobs_t *jobs = ( struct unpack_jobs_t * ) arg;
+
+    /* Worker arena is mapped on first folder */
+    arena.base = NULL;
+
+    for ( ;; )
+    {
+        /* Pick next folder unless done or failed, test goes through all */
+        pthread_mutex_lock ( &jobs->mutex );
+        if ( ( jobs->error_status && !jobs->test ) || jobs->next_folder >= jobs->n_folders )
+        {
+            pthread_mutex_unlock ( &jobs->mutex );
+            break;
+        }
+        i = jobs->order[jobs->next_folder++] & 0xFFFF;
+        pthread_mutex_unlock ( &jobs->mutex );
+
+        /* Load and uncompress folder sectors, sets need scratch for split blocks */
+        if ( ( folder = get_folder ( jobs, i ) ) == NULL )
+        {
+            error_status = ERANGE;
+
+        } else if ( arena.base == NULL
+            && ( error_status =
+                arena_init ( &arena, jobs->window_size + ( jobs->set != NULL ?
+                        STREAM_SECTOR_SIZE + ARENA_ALIGN : 0 ) ) ) != 0 )
+        {
+            fprintf ( stderr, "Failed to map worker arena: %i\n", error_status );
+
+        } else
+        {
+            error_status = uncompress_folder ( i, folder, &jobs->folders[i], &arena, jobs );
+        }
+
+        /* Keep error of the lowest failed folder */
+        if ( error_status )
+        {
+            pthread_mutex_lock ( &jobs->mutex );
+            fprintf ( stderr, "Failed to uncompress folder %u: %i\n", i, error_status );
+            if ( !jobs->error_status || i < jobs->failed_folder )
+            {
+                jobs->error_status = error_status;
+                jobs->failed_folder = i;
+            }
+            pthread_mutex_unlock ( &jobs->mutex );
+        }
+    }
+
+    /* Unmap worker arena */
+    arena_free ( &arena );
+
+    return NULL;
+}
+
+/* Assign streamed sector to files starting or ending in it */
+static void locate_files ( struct cffolder_ctx *folder_ctx, size_t nsector )
+{
+    size_t i;
+    size_t end;
+    struct cffile_ctx *file_ctx;
+
+    end = folder_ctx->index[nsector + 1].folder_offset;
+
+    /* Files are ordered by offset */
+    for ( i = folder_ctx->next_file; i < folder_ctx->n_files; i++ )
+    {
+        file_ctx = &folder_ctx->files[i];
+
+        if ( file_ctx->entry->offset >= end )
+        {
+            break;
+        }
+
+        if ( file_ctx->first_sector == ( size_t ) -1 )
+        {
+            file_ctx->first_sector = nsector;
+        }
+
+        if ( file_ctx->last_sector == ( size_t ) -1
+            && ( size_t ) file_ctx->entry->offset + file_ctx->entry->length <= end )
+        {
+            file_ctx->last_sector = nsector;
+        }
+    }
+}
+
+/* Skip stream bytes using sector buffer as scratch */
+static int skip_stream ( int fd, size_t len, unsigned char *scratch, size_t scratch_len )
+{
+    int error_status;
+    size_t chunk;
+
+    while ( len )
+    {
+        chunk = len < scratch_len ? len : scratch_len;
+        if ( ( error_status = read_stream ( fd, scratch, chunk ) ) != 0 )
+        {
+            return error_status;
+        }
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+/* Decode folder sectors in the order they arrive from stream */
+static int stream_folder ( size_t nfolder, const struct CFFOLDER *folder,
+    struct cffolder_ctx *folder_ctx, struct arena_t *arena, struct unpack_jobs_t *jobs,
+    size_t *position )
+{
+    int error_status = 0;
+    size_t i;
+    unsigned char *compressed;
+    const struct CFDATA *sector;
+    struct cfdata_ctx block;
+    struct decoder_ctx decoder = { NULL, NULL };
+    z_stream *stream = NULL;
+
+    /* Reset folder context */
+    memset ( folder_ctx, '\0', sizeof ( struct cffolder_ctx ) );
+
+    /* Prepare files of this folder before sectors index exists */
+    if ( ( error_status = prepare_files ( nfolder, folder_ctx, jobs->table ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Allocate sectors index filled as sectors arrive */
+    folder_ctx->n_sectors = folder->cCFData;
+    if ( ( folder_ctx->index =
+            ( struct cfdata_idx * ) calloc ( folder_ctx->n_sectors + 1,
+                sizeof ( struct cfdata_idx ) ) ) == NULL )
+    {
+        error_status = ENOMEM;
+        goto exit;
+    }
+
+    /* Allocate dictionary window and sector buffer */
+    folder_ctx->window_size = jobs->window_size;
+    arena_reset ( arena );
+    if ( ( folder_ctx->window =
+            ( unsigned char * ) arena_alloc ( arena, folder_ctx->window_size ) ) == NULL
+        || ( compressed =
+            ( unsigned char * ) arena_alloc ( arena, STREAM_SECTOR_SIZE ) ) == NULL )
+    {
+        error_status = ENOMEM;
+        goto exit;
+    }
+
+    /* Take raw inflate stream from thread pool */
+    if ( ( error_status = zpool_acquire ( ZPOOL_INFLATE, 0, &stream ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Lzx and quantum windows outlive single blocks */
+    if ( ( folder->typeCompress & 0x000F ) == 3
+        && ( error_status =
+            lzx_init ( &decoder.lzx, ( folder->typeCompress >> 8 ) & 0x001F ) ) != 0 )
+    {
+        goto exit;
+
+    } else if ( ( folder->typeCompress & 0x000F ) == 2
+        && ( error_status =
+            quantum_init ( &decoder.quantum, ( folder->typeCompress >> 8 ) & 0x001F ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Folder data cannot lie behind what was already read */
+    if ( folder->coffCabStart < *position )
+    {
+        fprintf ( stderr, "Error: Folder %u data precedes stream position\n",
+            ( unsigned int ) nfolder );
+        error_status = ESPIPE;
+        goto exit;
+    }
+
+    /* Skip bytes up to folder data */
+    if ( ( error_status =
+            skip_stream ( jobs->stream_fd, folder->coffCabStart - *position, compressed,
+                STREAM_SECTOR_SIZE ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    *position = folder->coffCabStart;
+
+    for ( i = 0; i < folder_ctx->n_sectors; i++ )
+    {
+        /* Read sector header and data */
+        sector = ( const struct CFDATA * ) compressed;
+        if ( ( error_status =
+                read_stream ( jobs->stream_fd, compressed, sizeof ( struct CFDATA ) ) ) != 0
+            || ( error_status =
+                read_stream ( jobs->stream_fd, compressed + sizeof ( struct CFDATA ),
+                    sector->cbData ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        /* Extend sectors index */
+        folder_ctx->index[i].cab_offset = *position;
+        folder_ctx->index[i + 1].folder_offset =
+            folder_ctx->index[i].folder_offset + sector->cbUncomp;
+        *position += sizeof ( struct CFDATA ) + sector->cbData;
+        locate_files ( folder_ctx, i );
+
+        progress_add ( &jobs->progress, 0, sector->cbData, 0, nfolder );
+
+        /* Rest of folder is read through once selected files are written */
+        if ( folder_ctx->next_file >= folder_ctx->n_files && !jobs->test )
+        {
+            continue;
+        }
+
+        /* Reset inflate stream if needed */
+        if ( i && ( error_status = inflateReset ( stream ) ) != Z_OK )
+        {
+            goto exit;
+        }
+
+        /* Place block after dictionary in window */
+        block.uncompressed_size = sector->cbUncomp;
+        if ( ( error_status =
+                prepare_block ( folder, folder_ctx, i, &block, stream, jobs ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        /* Uncompress data into block buffer */
+        if ( ( error_status =
+                uncompress_data ( folder->typeCompress, compressed + sizeof ( struct CFDATA ),
+                    sector->cbData, &block, stream, &decoder ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        /* Verify checksum if not set to zero */
+        if ( sector->csum
+            && sector->csum != checksum ( compressed + sizeof ( struct CFDATA ) -
+                sizeof ( unsigned int ), sector->cbData + sizeof ( unsigned int ) ) )
+        {
+            /* Checksum mismatch fails cabinet test */
+            if ( jobs->test )
+            {
+                fprintf ( stderr, "Error: Checksum mismatch at folder %u sector %u\n",
+                    ( unsigned int ) nfolder, ( unsigned int ) i );
+                error_status = EBADMSG;
+                goto exit;
+            }
+
+            printf ( "! checksum is invalid at sector #%u\n", ( unsigned int ) i );
+        }
+
+        folder_ctx->window_fill += block.uncompressed_size;
+    }
+
+    /* Write output left in window */
+    if ( ( error_status = flush_window ( folder_ctx, i, jobs ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Test files fit in folder and account tested data */
+    if ( jobs->test )
+    {
+        if ( ( error_status = check_files ( nfolder, folder_ctx, jobs->table ) ) != 0 )
+        {
+            goto exit;
+        }
+
+        jobs->n_bytes += folder_ctx->index[folder_ctx->n_sectors].folder_offset;
+    }
+
+    /* Create files placed beyond folder data */
+    error_status = create_trailing ( folder_ctx, jobs );
+
+  exit:
+
+    /* Return inflate stream to pool */
+    if ( stream != NULL )
+    {
+        zpool_release ( stream );
+    }
+
+    /* Release folder decoders */
+    if ( decoder.lzx != NULL )
+    {
+        lzx_free ( decoder.lzx );
+    }
+
+    if ( decoder.quantum != NULL )
+    {
+        quantum_free ( decoder.quantum );
+    }
+
+    /* Close files left open */
+    for ( i = 0; i < folder_ctx->n_files; i++ )
+    {
+        close_file ( &folder_ctx->files[i], jobs );
+    }
+
+    /* Free files table */
+    if ( folder_ctx->files != NULL )
+    {
+        free ( folder_ctx->files );
+        folder_ctx->files = NULL;
+    }
+
+    /* Free sectors index */
+    if ( folder_ctx->index != NULL )
+    {
+        free ( folder_ctx->index );
+        folder_ctx->index = NULL;
+    }
+
+    return error_status;
+}
+
+/* Order folders by cabinet offset */
+static int compare_folders ( const void *a, const void *b )
+{
+    unsigned long long key_a = *( const unsigned long long * ) a;
+    unsigned long long key_b = *( const unsigned long long * ) b;
+
+    return key_a < key_b ? -1 : key_a > key_b;
+}
+
+/* Sort folders by data offset keeping folder index in low bits, pipe keeps table order */
+static int sort_folders ( struct unpack_jobs_t *jobs, int *ordered )
+{
+    size_t i;
+    const struct CFFOLDER *folder;
+
+    if ( ( jobs->order =
+            ( unsigned long long * ) malloc ( ( jobs->n_folders +
+                    1 ) * sizeof ( unsigned long long ) ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    for ( *ordered = TRUE, i = 0; i < jobs->n_folders; i++ )
+    {
+        if ( ( folder = get_folder ( jobs, i ) ) == NULL )
+        {
+            return ERANGE;
+        }
+        jobs->order[i] = ( ( unsigned long long ) folder->coffCabStart << 16 ) | i;
+
+        /* Visiting data backwards would reread dropped pages */
+        if ( i && jobs->order[i] < jobs->order[i - 1] )
+        {
+            *ordered = FALSE;
+        }
+    }
+
+    if ( jobs->pipe_fd < 0 || jobs->stream_fd >= 0 )
+    {
+        qsort ( jobs->order, jobs->n_folders, sizeof ( unsigned long long ), compare_folders );
+        *ordered = TRUE;
+    }
+
+    return 0;
+}
+
+/* Uncompress folders in one forward pass over stream */
+static void stream_folders ( struct unpack_jobs_t *jobs )
+{
+    int error_status = 0;
+    size_t i;
+    size_t nfolder;
+    size_t position = jobs->size;
+    const struct CFFOLDER *folder;
+    struct arena_t arena;
+
+    /* Arena holds window and one sector */
+    if ( ( error_status =
+            arena_init ( &arena, jobs->window_size + STREAM_SECTOR_SIZE + ARENA_ALIGN ) ) != 0 )
+    {
+        fprintf ( stderr, "Failed to map stream arena: %i\n", error_status );
+        jobs->error_status = error_status;
+        return;
+    }
+
+    for ( i = 0; i < jobs->n_folders; i++ )
+    {
+        nfolder = jobs->order[i] & 0xFFFF;
+        folder = get_folder ( jobs, nfolder );
+
+        if ( ( error_status =
+                stream_folder ( nfolder, folder, &jobs->folders[nfolder], &arena, jobs,
+                    &position ) ) != 0 )
+        {
+            fprintf ( stderr, "Failed to uncompress folder %u: %i\n", ( unsigned int ) nfolder,
+                error_status );
+
+            if ( !jobs->error_status )
+            {
+                jobs->error_status = error_status;
+                jobs->failed_folder = nfolder;
+            }
+
+            /* Stream cannot go back, test reads on past bad data only */
+            if ( !jobs->test || ( error_status != EBADMSG && error_status != ENODATA
+                    && error_status >= 0 ) )
+            {
+                break;
+            }
+        }
+    }
+
+    arena_free ( &arena );
+}
+
+/* Write sidecar index from decoded folders */
+static int save_cabidx ( const char *path, const unsigned char *base, size_t size,
+    const struct cffolder_ctx *folders, unsigned int interval )
+{
+    int fd;
+    int error_status = 0;
+    size_t i;
+    size_t j;
+    size_t len;
+    unsigned long long offset;
+    struct CABIDX_HEADER cabidx_header;
+    struct CABIDX_FOLDER cabidx_folder;
+    struct CABIDX_SECTOR cabidx_sector;
+    const struct CFHEADER *header = ( const struct CFHEADER * ) base;
+
+    /* Prepare sidecar header */
+    memset ( &cabidx_header, '\0', sizeof ( cabidx_header ) );
+    memcpy ( cabidx_header.signature, "ICIX", 4 );
+    cabidx_header.version = CABIDX_VERSION;
+    cabidx_header.cbCabinet = header->cbCabinet;
+    cabidx_header.setID = header->setID;
+    cabidx_header.cFolders = header->cFolders;
+    cabidx_header.interval = interval;
+
+    if ( ( error_status = digest_cabinet ( base, size, &cabidx_header.digest ) ) != 0 )
+    {
+        return error_status;
+    }
+
+    /* Open sidecar file for writing */
+    if ( ( fd = open ( path, O_CREAT | O_WRONLY | O_TRUNC, 0644 ) ) < 0 )
+    {
+        return errno;
+    }
+
+    if ( write ( fd, &cabidx_header, sizeof ( cabidx_header ) ) != sizeof ( cabidx_header ) )
+    {
+        error_status = errno ? errno : EIO;
+        goto exit;
+    }
+
+    /* Save folder structures, tables follow them */
+    offset = sizeof ( struct CABIDX_HEADER ) + header->cFolders * sizeof ( struct CABIDX_FOLDER );
+    for ( i = 0; i < header->cFolders; i++ )
+    {
+        cabidx_folder.cSectors = folders[i].n_sectors;
+        cabidx_folder.cCheckpoints = folders[i].n_checkpoints;
+        cabidx_folder.coffSectors = offset;
+        offset += ( folders[i].n_sectors + 1 ) * sizeof ( struct CABIDX_SECTOR );
+        cabidx_folder.coffCheckpoints = offset;
+        offset += folders[i].n_checkpoints * sizeof ( struct CABIDX_CHECKPOINT );
+
+        if ( write ( fd, &cabidx_folder, sizeof ( cabidx_folder ) ) != sizeof ( cabidx_folder ) )
+        {
+            error_status = errno ? errno : EIO;
+            goto exit;
+        }
+    }
+
+    /* Save sectors index and checkpoints of each folder */
+    for ( i = 0; i < header->cFolders; i++ )
+    {
+        for ( j = 0; j <= folders[i].n_sectors; j++ )
+        {
+            cabidx_sector.coffCabData = folders[i].index[j].cab_offset;
+            cabidx_sector.uoffFolderData = folders[i].index[j].folder_offset;
+
+            if ( write ( fd, &cabidx_sector,
+                    sizeof ( cabidx_sector ) ) != sizeof ( cabidx_sector ) )
+            {
+                error_status = errno ? errno : EIO;
+                goto exit;
+            }
+        }
+
+        len = folders[i].n_checkpoints * sizeof ( struct CABIDX_CHECKPOINT );
+        if ( len && ( size_t ) write ( fd, folders[i].checkpoints, len ) != len )
+        {
+            error_status = errno ? errno : EIO;
+            goto exit;
+        }
+    }
+
+  exit:
+
+    close ( fd );
+
+    return error_status;
+}
+
+/* Unpack selected files to directory or pipe */
+static int unpack_files ( const unsigned char *base, size_t size,
+    const struct unpack_opts_t *opts )
+{
+    int cabidx_status;
+    int ordered;
+    unsigned int i;
+    unsigned int n_jobs = opts->n_jobs;
+    unsigned int n_threads = 0;
+    const struct CFHEADER *header;
+    pthread_t *threads = NULL;
+    struct cffile_table table;
+    struct cabidx_t cabidx;
+    struct readahead_t readahead;
+    struct unpack_jobs_t jobs;
+    struct stat statbuf;
+    struct timeval started;
+    struct timeval finished;
+    double elapsed;
+
+    /* Create directory if not exists */
+    if ( opts->prefix != NULL && stat ( opts->prefix, &statbuf ) < 0 && errno == ENOENT )
+    {
+        mkdir ( opts->prefix, 0755 );
+    }
+
+    /* No sidecar mapped yet */
+    memset ( &cabidx, '\0', sizeof ( cabidx ) );
+
+    /* Assign header structure pointer */
+    header = ( const struct CFHEADER * ) base;
+    PTR_ASSERT ( header, sizeof ( struct CFHEADER ), base, size );
+
+    /* Verify header signature */
+    if ( header->signature[0] != 0x4d || header->signature[1] != 0x53
+        || header->signature[2] != 0x43 || header->signature[3] != 0x46 )
+    {
+        fprintf ( stderr, "Error: Header signature is invalid\n" );
+        return EINVAL;
+    }
+
+    /* Prepare workers shared context */
+    memset ( &jobs, '\0', sizeof ( jobs ) );
+    jobs.base = base;
+    jobs.size = size;
+    jobs.set = opts->set;
+    jobs.n_folders = jobs.set != NULL ? jobs.set->n_folders : header->cFolders;
+    jobs.prefix = opts->prefix;
+    jobs.cab_fd = opts->cab_fd;
+    jobs.write_size = opts->write_size;
+    jobs.window_size = MSZIP_WINDOW_SIZE +
+        ( jobs.write_size > CFDATA_MAX_UNCOMP ? jobs.write_size : CFDATA_MAX_UNCOMP );
+    jobs.map_output = opts->map_output && opts->stream_fd < 0;
+    jobs.pipe_fd = opts->pipe_fd;
+    jobs.stream_fd = opts->stream_fd;
+    jobs.interval = opts->interval;
+    jobs.test = opts->test;
+    jobs.table = &table;
+    pthread_mutex_init ( &jobs.mutex, NULL );
+    progress_init ( &jobs.progress, opts->progress_mode, opts->progress_fd, 0 );
+    memset ( &table, '\0', sizeof ( table ) );
+
+    /* Show volumes and folders count */
+    if ( jobs.set != NULL )
+    {
+        printf ( "Volumes count: %5u\n", ( unsigned int ) jobs.set->n_volumes );
+    }
+    printf ( "Folders count: %5u\n", jobs.n_folders );
+
+    /* Locate folders past reserve area and set names */
+    if ( ( jobs.error_status = parse_layout ( base, size, &jobs.layout ) ) != 0 )
+    {
+        fprintf ( stderr, "Failed to parse cabinet header: %i\n", jobs.error_status );
+        goto exit;
+    }
+
+    /* Sector index assumes no per sector reserve */
+    if ( jobs.layout.data_reserve )
+    {
+        fprintf ( stderr, "Error: Reserved sector fields are not supported\n" );
+        jobs.error_status = ENOTSUP;
+        goto exit;
+    }
+
+    /* Other volumes of set cannot be read from same stream */
+    if ( jobs.stream_fd >= 0 && ( header->flags & ( CAB_FLAG_PREV | CAB_FLAG_NEXT ) ) )
+    {
+        fprintf ( stderr, "Error: Cabinet set cannot be streamed\n" );
+        jobs.error_status = ENOTSUP;
+        goto exit;
+    }
+
+    /* Parse file table once, continued files of set are listed once */
+    if ( ( jobs.error_status = jobs.set != NULL ? load_set_table ( jobs.set, &table ) :
+            load_file_table ( base, size, &table ) ) != 0 )
+    {
+        fprintf ( stderr, "Failed to load file table: %i\n", jobs.error_status );
+        goto exit;
+    }
+
+    /* Mark selected files unless only building sidecar */
+    if ( !jobs.interval && !jobs.test
+        && !( jobs.progress.n_files = select_files ( &table, opts->selection ) ) )
+    {
+        fprintf ( stderr, "Error: No files match selection\n" );
+        jobs.error_status = ENOENT;
+        goto exit;
+    }
+
+    /* Test files referring to missing folders */
+    if ( jobs.test && ( jobs.error_status = check_folders ( jobs.n_folders, &table ) ) != 0 )
+    {
+        goto exit;
+    }
+
+    /* Use sidecar index if one matches cabinet, test trusts cabinet only */
+    if ( !jobs.interval && !jobs.test && opts->cabidx_path != NULL && opts->stream_fd < 0
+        && jobs.set == NULL )
+    {
+        if ( ( cabidx_status = load_cabidx ( opts->cabidx_path, base, size, &cabidx ) ) == 0 )
+        {
+            jobs.cabidx = &cabidx;
+
+        } else if ( cabidx_status != ENOENT )
+        {
+            fprintf ( stderr, "Warning: Ignoring sidecar index: %i\n", cabidx_status );
+            unload_cabidx ( &cabidx );
+        }
+    }
+
+    /* Allocate folders table */
+    if ( ( jobs.folders =
+            ( struct cffolder_ctx * ) calloc ( jobs.n_folders,
+                sizeof ( struct cffolder_ctx ) ) ) == NULL )
+    {
+        fprintf ( stderr, "Failed to allocate folders table: %i\n", ENOMEM );
+        jobs.error_status = ENOMEM;
+        goto exit;
+    }
+
+    /* Visit folders in cabinet order so read-ahead and drop-behind move forward */
+    if ( ( jobs.error_status = sort_folders ( &jobs, &ordered ) ) != 0 )
+    {
+        fprintf ( stderr, "Failed to sort folders: %i\n", jobs.error_status );
+        goto exit;
+    }
+
+    /* Keep pipe output in file table order, stream is read in one pass */
+    if ( jobs.pipe_fd >= 0 || jobs.stream_fd >= 0 )
+    {
+        n_jobs = 1;
+    }
+
+    /* No more workers than folders */
+    if ( n_jobs > jobs.n_folders )
+    {
+        n_jobs = jobs.n_folders;
+    }
+
+    /* Measure test throughput */
+    gettimeofday ( &started, NULL );
+
+    /* Read mapped input ahead of decoders, single forward decoder releases what it passed */
+    if ( opts->readahead && jobs.stream_fd < 0 && jobs.cab_fd >= 0
+        && readahead_start ( &readahead, jobs.cab_fd, base, size, opts->readahead,
+            n_jobs <= 1 && ordered ) == 0 )
+    {
+        jobs.readahead = &readahead;
+    }
+
+    /* Allocate worker threads table */
+    if ( n_jobs > 1 )
+    {
+        if ( ( threads = ( pthread_t * ) malloc ( n_jobs * sizeof ( pthread_t ) ) ) == NULL )
+        {
+            jobs.error_status = ENOMEM;
+            goto exit;
+        }
+
+        /* Start worker threads */
+        for ( n_threads = 0; n_threads < n_jobs; n_threads++ )
+        {
+            if ( pthread_create ( &threads[n_threads], NULL, unpack_worker, &jobs ) != 0 )
+            {
+                break;
+            }
+        }
+    }
+
+    /* Uncompress folders in current thread if no worker started */
+    if ( !n_threads && jobs.stream_fd >= 0 )
+    {
+        stream_folders ( &jobs );
+
+    } else if ( !n_threads )
+    {
+        unpack_worker ( &jobs );
+    }
+
+    /* Wait for worker threads */
+    for ( i = 0; i < n_threads; i++ )
+    {
+        pthread_join ( threads[i], NULL );
+    }
+
+    /* Stop read-ahead */
+    if ( jobs.readahead != NULL )
+    {
+        readahead_stop ( jobs.readahead );
+    }
+
+    /* Report test result */
+    if ( jobs.test )
+    {
+        gettimeofday ( &finished, NULL );
+        elapsed =
+            ( finished.tv_sec - started.tv_sec ) + ( finished.tv_usec -
+            started.tv_usec ) / 1000000.0;
+        printf ( "Tested %llu bytes in %.3f s (%.1f MB/s): %s\n", jobs.n_bytes, elapsed,
+            elapsed > 0 ? jobs.n_bytes / elapsed / 1000000.0 : 0.0,
+            jobs.error_status ? "FAILED" : "OK" );
+    }
+
+    /* Write sidecar index once all folders are decoded */
+    if ( jobs.interval && !jobs.error_status )
+    {
+        if ( ( jobs.error_status =
+                save_cabidx ( opts->cabidx_path, base, size, jobs.folders, jobs.interval ) ) != 0 )
+        {
+            fprintf ( stderr, "Failed to save sidecar index: %i\n", jobs.error_status );
+        }
+    }
+
+  exit:
+
+    /* Report final progress and print separator line after text progress */
+    progress_finish ( &jobs.progress );
+    if ( opts->progress_mode == PROGRESS_TEXT )
+    {
+        putchar ( '\n' );
+    }
+
+    /* Stop read-ahead left running on error */
+    if ( jobs.readahead != NULL )
+    {
+        readahead_stop ( jobs.readahead );
+    }
+
+    /* Free worker threads table */
+    if ( threads != NULL )
+    {
+        free ( threads );
+    }
+
+    /* Free folders table with sidecar data kept in it */
+    if ( jobs.folders != NULL )
+    {
+        for ( i = 0; i < jobs.n_folders; i++ )
+        {
+            if ( jobs.folders[i].index != NULL )
+            {
+                free ( jobs.folders[i].index );
+            }
+
+            if ( jobs.folders[i].checkpoints != NULL )
+            {
+                free ( jobs.folders[i].checkpoints );
+            }
+        }
+
+        free ( jobs.folders );
+    }
+
+    /* Free folder order */
+    if ( jobs.order != NULL )
+    {
+        free ( jobs.order );
+    }
+
+    /* Free file table */
+    free_file_table ( &table );
+
+    /* Unmap sidecar index */
+    unload_cabidx ( &cabidx );
+
+    pthread_mutex_destroy ( &jobs.mutex );
+
+    return jobs.error_status;
+}
+
+/* Show program usage */
+static void show_usage ( void )
+{
+    printf ( "icab-unpack [-q] [--progress-fd fd] [-m] [-j jobs] [-k interval] [-w write_kb] "
+        "[-r readahead_kb] "
+        "[-x pattern] [-i index] [-s] [--format=json|csv] -lupbt file|- dest\n" );
+}
+
+/* Unpack utility main function */
+int main ( int argc, char *argv[] )
+{
+    int error_status = 0;
+    int fd = -1;
+    int i;
+    struct stat statbuf;
+    void *data = NULL;
+    int action = 0;
+    int format = LIST_FORMAT_TEXT;
+    int sectors = FALSE;
+    size_t meta_size = 0;
+    unsigned char *meta = NULL;
+    unsigned int interval = CABIDX_INTERVAL;
+    unsigned int write_kb;
+    unsigned int readahead_kb;
+    long n_cpus;
+    char cabidx_path[2048];
+    struct selection_t selection;
+    struct unpack_opts_t opts;
+    struct cab_set set;
 
     /* Reset file stats size */
     statbuf.st_size = 0;
+    memset ( &set, '\0', sizeof ( set ) );
+
+    /* Prepare selection tables */
+    memset ( &selection, '\0', sizeof ( selection ) );
+    memset ( &opts, '\0', sizeof ( opts ) );
+    opts.n_jobs = 0;
+    opts.write_size = UNPACK_WRITE_SIZE;
+    opts.readahead = READAHEAD_DISTANCE;
+    opts.cab_fd = -1;
+    opts.pipe_fd = -1;
+    opts.stream_fd = -1;
+    opts.selection = &selection;
+    selection.patterns = ( const char ** ) malloc ( argc * sizeof ( const char * ) );
+    selection.indices = ( unsigned int * ) malloc ( argc * sizeof ( unsigned int ) );
+    if ( selection.patterns == NULL || selection.indices == NULL )
+    {
+        fprintf ( stderr, "Failed to allocate selection: %i\n", ENOMEM );
+        error_status = ENOMEM;
+        goto cleanup;
+    }
 
-    /* Validate arguments count */
-    if ( argc < 3 )
+    /* Parse options and select operation type */
+    for ( i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++ )
     {
-        show_usage (  );
-        return 1;
+        if ( !strcmp ( argv[i], "-l" ) )
+        {
+            action = ACTION_LISTONLY;
+
+        } else if ( !strcmp ( argv[i], "--format=json" ) )
+        {
+            format = LIST_FORMAT_JSON;
+
+        } else if ( !strcmp ( argv[i], "--format=csv" ) )
+        {
+            format = LIST_FORMAT_CSV;
+
+        } else if ( !strcmp ( argv[i], "-s" ) )
+        {
+            sectors = TRUE;
+
+        } else if ( !strcmp ( argv[i], "-u" ) )
+        {
+            action = ACTION_UNPACK;
+
+        } else if ( !strcmp ( argv[i], "-p" ) )
+        {
+            action = ACTION_PIPE;
+
+        } else if ( !strcmp ( argv[i], "-b" ) )
+        {
+            action = ACTION_INDEX;
+
+        } else if ( !strcmp ( argv[i], "-t" ) )
+        {
+            action = ACTION_TEST;
+
+        } else if ( !strcmp ( argv[i], "-j" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%u", &opts.n_jobs ) > 0 && opts.n_jobs > 0 )
+        {
+            i++;
+
+        } else if ( !strcmp ( argv[i], "-k" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%u", &interval ) > 0 && interval > 0 )
+        {
+            i++;
+
+        } else if ( !strcmp ( argv[i], "-q" ) )
+        {
+            opts.progress_mode = PROGRESS_QUIET;
+
+        } else if ( !strcmp ( argv[i], "--progress-fd" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%d", &opts.progress_fd ) > 0 && opts.progress_fd >= 0 )
+        {
+            opts.progress_mode = PROGRESS_JSON;
+            i++;
+
+        } else if ( !strcmp ( argv[i], "-m" ) )
+        {
+            opts.map_output = TRUE;
+
+        } else if ( !strcmp ( argv[i], "-w" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%u", &write_kb ) > 0 && write_kb > 0 )
+        {
+            opts.write_size = ( size_t ) write_kb * 1024;
+            i++;
+
+        } else if ( !strcmp ( argv[i], "-r" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%u", &readahead_kb ) > 0 )
+        {
+            opts.readahead = ( size_t ) readahead_kb * 1024;
+            i++;
+
+        } else if ( !strcmp ( argv[i], "-x" ) && i + 1 < argc )
+        {
+            selection.patterns[selection.n_patterns++] = argv[++i];
+
+        } else if ( !strcmp ( argv[i], "-i" ) && i + 1 < argc
+            && sscanf ( argv[i + 1], "%u", &selection.indices[selection.n_indices] ) > 0 )
+        {
+            selection.n_indices++;
+            i++;
+
+        } else
+        {
+            action = 0;
+            break;
+        }
     }
 
-    /* Select operation type */
-    if ( !strcmp ( argv[1], "-l" ) )
+    /* Validate arguments count */
+    if ( !action || argc - i < ( action == ACTION_UNPACK ? 2 : 1 ) )
     {
-        action = ACTION_LISTONLY;
+        show_usage (  );
+        error_status = 1;
+        goto cleanup;
+    }
 
-    } else if ( !strcmp ( argv[1], "-u" ) )
+    /* Test mode checks folders on every cpu unless told otherwise, capped at folders count */
+    if ( !opts.n_jobs )
     {
-        action = ACTION_UNPACK;
+        n_cpus = action == ACTION_TEST ? sysconf ( _SC_NPROCESSORS_ONLN ) : 1;
+        opts.n_jobs = n_cpus > 0 ? ( unsigned int ) n_cpus : 1;
+    }
 
-    } else
+    /* Sidecar index needs seekable cabinet */
+    if ( !strcmp ( argv[i], "-" ) && action == ACTION_INDEX )
     {
         show_usage (  );
-        return 1;
+        error_status = 1;
+        goto cleanup;
     }
 
-    /* Validate arguments count again if neded */
-    if ( action == ACTION_UNPACK && argc < 4 )
+    /* Sidecar index sits next to cabinet */
+    snprintf ( cabidx_path, sizeof ( cabidx_path ), "%s.cabidx", argv[i] );
+    opts.cabidx_path = cabidx_path;
+
+    /* Keep stdout for file content or listing, report status on stderr */
+    if ( action == ACTION_PIPE || ( action == ACTION_LISTONLY && format != LIST_FORMAT_TEXT ) )
     {
-        show_usage (  );
-        return 1;
+        if ( ( opts.pipe_fd = dup ( STDOUT_FILENO ) ) < 0
+            || dup2 ( STDERR_FILENO, STDOUT_FILENO ) < 0 )
+        {
+            fprintf ( stderr, "Failed to redirect output: %i\n", errno );
+            error_status = errno;
+            goto exit;
+        }
     }
 
-    /* Open input file */
-    if ( ( fd = open ( argv[2], O_RDONLY ) ) < 0 )
+    /* Show program logo */
+    printf ( "CAB unpack - ver. " ICAB_VERSION "\n" );
+
+    /* Read cabinet from standard input in one forward pass */
+    if ( !strcmp ( argv[i], "-" ) )
+    {
+        fd = STDIN_FILENO;
+        opts.stream_fd = fd;
+
+        /* Read metadata regions up to first sector */
+        if ( ( error_status =
+                load_metadata ( opts.stream_fd, ( size_t ) -1, &meta, &meta_size ) ) != 0 )
+        {
+            fprintf ( stderr, "Failed to read cabinet metadata: %i\n", error_status );
+            goto exit;
+        }
+
+    } else if ( ( fd = open ( argv[i], O_RDONLY ) ) < 0 )
     {
         fprintf ( stderr, "Failed to open cabinet file: %i\n", errno );
         error_status = errno;
@@ -710,60 +2270,140 @@ int main ( int argc, char *argv[] )
         goto exit;
     }
 
-    /* Map memory for file content */
-    if ( ( data =
-            mmap ( NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0 ) ) == NULL )
+    /* Cabinet file holds at least its header */
+    if ( meta == NULL && ( size_t ) statbuf.st_size < sizeof ( struct CFHEADER ) )
     {
-        fprintf ( stderr, "Failed to map memory: %i\n", errno );
-        error_status = errno;
+        fprintf ( stderr, "Error: Cabinet file is too short\n" );
+        error_status = ERANGE;
         goto exit;
     }
 
-    /* Close input file fd (no longer needed) */
-    close ( fd );
-    fd = -1;
-
     /* Perform selected action */
     if ( action == ACTION_LISTONLY )
     {
+        /* Read metadata regions only */
+        if ( meta == NULL
+            && ( error_status = load_metadata ( fd, statbuf.st_size, &meta, &meta_size ) ) != 0 )
+        {
+            fprintf ( stderr, "Failed to read cabinet metadata: %i\n", error_status );
+            goto exit;
+        }
+
         /* List files */
-        if ( ( error_status = list_files ( ( unsigned char * ) data, statbuf.st_size ) ) != 0 )
+        if ( ( error_status = format == LIST_FORMAT_TEXT ?
+                list_files ( meta, meta_size, fd, sectors ) :
+                list_files_structured ( meta, meta_size, fd, sectors, format,
+                    opts.pipe_fd ) ) != 0 )
         {
             fprintf ( stderr, "Failed to list files: %i\n", error_status );
-            goto exit;
         }
 
-    } else if ( action == ACTION_UNPACK )
+        goto exit;
+    }
+
+    /* Map memory for file content unless streaming, populate only without read-ahead */
+    if ( meta == NULL && ( data =
+            mmap ( NULL, statbuf.st_size, PROT_READ,
+                MAP_PRIVATE | ( opts.readahead ? 0 : MAP_POPULATE ), fd, 0 ) ) == MAP_FAILED )
     {
-        /* Unpack files */
-        if ( ( error_status =
-                unpack_files ( ( unsigned char * ) data, statbuf.st_size, argv[3] ) ) != 0 )
+        fprintf ( stderr, "Failed to map memory: %i\n", errno );
+        error_status = errno;
+        data = NULL;
+        goto exit;
+    }
+
+    /* Map all volumes of cabinet set, sectors are read from them directly */
+    if ( meta == NULL && ( size_t ) statbuf.st_size > sizeof ( struct CFHEADER )
+        && ( ( const struct CFHEADER * ) data )->flags & ( CAB_FLAG_PREV | CAB_FLAG_NEXT ) )
+    {
+        if ( action == ACTION_INDEX )
         {
-            fprintf ( stderr, "Failed to unpack files: %i\n", error_status );
+            fprintf ( stderr, "Error: Sidecar index of cabinet set is not supported\n" );
+            error_status = ENOTSUP;
             goto exit;
         }
 
-    } else
+        if ( ( error_status = open_cabinet_set ( argv[i], &set ) ) != 0 )
+        {
+            fprintf ( stderr, "Failed to open cabinet set: %i\n", error_status );
+            goto exit;
+        }
+
+        opts.set = &set;
+
+    } else if ( opts.stream_fd < 0 )
     {
-        show_usage (  );
-        return 1;
+        /* Keep input file fd for copying stored folders */
+        opts.cab_fd = fd;
+    }
+
+    /* Select output of unpack or sidecar build */
+    if ( action == ACTION_UNPACK )
+    {
+        opts.prefix = argv[i + 1];
+
+    } else if ( action == ACTION_INDEX )
+    {
+        opts.interval = interval;
+
+    } else if ( action == ACTION_TEST )
+    {
+        opts.test = TRUE;
+    }
+
+    /* Unpack files */
+    if ( ( error_status = meta != NULL ? unpack_files ( meta, meta_size, &opts ) :
+            opts.set != NULL ? unpack_files ( set.volumes[0].base, set.volumes[0].size, &opts ) :
+            unpack_files ( ( unsigned char * ) data, statbuf.st_size, &opts ) ) != 0 )
+    {
+        fprintf ( stderr, "Failed to %s files: %i\n",
+            action == ACTION_TEST ? "test" : "unpack", error_status );
+        goto exit;
     }
 
   exit:
 
+    /* Free metadata buffer */
+    if ( meta != NULL )
+    {
+        free ( meta );
+    }
+
     /* Free mapped memory */
     if ( data != NULL )
     {
         munmap ( data, statbuf.st_size );
     }
 
+    /* Unmap cabinet set volumes */
+    close_cabinet_set ( &set );
+
     /* Close input file fd */
     if ( fd != -1 )
     {
         close ( fd );
     }
 
+    /* Close pipe output fd */
+    if ( opts.pipe_fd != -1 )
+    {
+        close ( opts.pipe_fd );
+    }
+
     printf ( "Exit status: %i\n", error_status );
 
+  cleanup:
+
+    /* Free selection tables */
+    if ( selection.patterns != NULL )
+    {
+        free ( selection.patterns );
+    }
+
+    if ( selection.indices != NULL )
+    {
+        free ( selection.indices );
+    }
+
     return error_status;
 }
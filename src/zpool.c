@@ -0,0 +1,233 @@
+/*
+ --------------------------------------------------------------------------------------
+                        iCAB - Thread Local zlib Stream Pool
+ --------------------------------------------------------------------------------------
+ */
+
+#include "icab.h"
+
+static pthread_key_t zpool_key;
+static pthread_once_t zpool_once = PTHREAD_ONCE_INIT;
+
+/* Allocate zlib memory from slot sub-arena */
+static voidpf zpool_alloc ( voidpf opaque, uInt items, uInt size )
+{
+    void *ptr;
+    struct zpool_slot *slot = ( struct zpool_slot * ) opaque;
+
+    /* Fall back to heap once sub-arena is used up */
+    if ( ( ptr = arena_alloc ( &slot->arena, ( size_t ) items * size ) ) == NULL )
+    {
+        ptr = malloc ( ( size_t ) items * size );
+    }
+
+    return ptr;
+}
+
+/* Free zlib memory, sub-arena chunks are rewound when slot is set up again */
+static void zpool_free ( voidpf opaque, voidpf ptr )
+{
+    struct zpool_slot *slot = ( struct zpool_slot * ) opaque;
+
+    if ( ( unsigned char * ) ptr < slot->arena.base
+        || ( unsigned char * ) ptr >= slot->arena.base + slot->arena.size )
+    {
+        free ( ptr );
+    }
+}
+
+/* End pool streams on thread exit */
+static void zpool_destroy ( void *arg )
+{
+    size_t i;
+    struct zpool_t *pool = ( struct zpool_t * ) arg;
+
+    for ( i = 0; i < ZPOOL_SLOTS; i++ )
+    {
+        if ( pool->slots[i].kind == ZPOOL_INFLATE )
+        {
+            inflateEnd ( &pool->slots[i].stream );
+
+        } else if ( pool->slots[i].kind == ZPOOL_DEFLATE )
+        {
+            deflateEnd ( &pool->slots[i].stream );
+        }
+    }
+
+    /* Slot sub-arenas are views of pool arena */
+    arena_free ( &pool->arena );
+    free ( pool );
+}
+
+/* Create pool thread key */
+static void zpool_key_init ( void )
+{
+    pthread_key_create ( &zpool_key, zpool_destroy );
+}
+
+/* Obtain pool of calling thread */
+static struct zpool_t *zpool_get ( void )
+{
+    size_t i;
+    struct zpool_t *pool;
+
+    pthread_once ( &zpool_once, zpool_key_init );
+
+    if ( ( pool = ( struct zpool_t * ) pthread_getspecific ( zpool_key ) ) != NULL )
+    {
+        return pool;
+    }
+
+    if ( ( pool = ( struct zpool_t * ) calloc ( 1, sizeof ( struct zpool_t ) ) ) == NULL )
+    {
+        return NULL;
+    }
+
+    /* Streams fall back to heap if arena cannot be mapped */
+    if ( arena_init ( &pool->arena, ZPOOL_ARENA_SIZE ) != 0 )
+    {
+        memset ( &pool->arena, '\0', sizeof ( pool->arena ) );
+    }
+
+    /* Split arena between slots so replaced stream gives its chunks back */
+    for ( i = 0; pool->arena.base != NULL && i < ZPOOL_SLOTS; i++ )
+    {
+        pool->slots[i].arena.base = pool->arena.base + i * ZPOOL_SLOT_ARENA_SIZE;
+        pool->slots[i].arena.size = ZPOOL_SLOT_ARENA_SIZE;
+    }
+
+    pthread_setspecific ( zpool_key, pool );
+
+    return pool;
+}
+
+/* Map zlib status to errno */
+static int zpool_status ( int status )
+{
+    return status == Z_MEM_ERROR ? ENOMEM : EINVAL;
+}
+
+/* Initialize pool slot stream */
+static int zpool_init ( struct zpool_slot *slot, int kind, int level )
+{
+    int error_status;
+
+    /* Previous stream of slot has ended, take sub-arena from start */
+    arena_reset ( &slot->arena );
+
+    /* Prepare zlib stream with slot allocator */
+    memset ( &slot->stream, '\0', sizeof ( slot->stream ) );
+    slot->stream.zalloc = zpool_alloc;
+    slot->stream.zfree = zpool_free;
+    slot->stream.opaque = ( voidpf ) slot;
+
+    /* Initialize stream for raw data */
+    if ( kind == ZPOOL_INFLATE )
+    {
+        error_status = inflateInit2 ( &slot->stream, -15 );
+
+    } else
+    {
+        error_status =
+            deflateInit2 ( &slot->stream, level, Z_DEFLATED, -15, MAX_MEM_LEVEL,
+            Z_DEFAULT_STRATEGY );
+    }
+
+    if ( error_status != Z_OK )
+    {
+        slot->kind = 0;
+        return zpool_status ( error_status );
+    }
+
+    slot->kind = kind;
+    slot->level = level;
+
+    return 0;
+}
+
+/* Take reset raw stream from thread pool */
+int zpool_acquire ( int kind, int level, z_stream ** stream )
+{
+    int error_status;
+    size_t i;
+    struct zpool_t *pool;
+    struct zpool_slot *slot = NULL;
+
+    if ( ( pool = zpool_get (  ) ) == NULL )
+    {
+        return ENOMEM;
+    }
+
+    /* Prefer free stream already set up the same way */
+    for ( i = 0; i < ZPOOL_SLOTS; i++ )
+    {
+        if ( !pool->slots[i].in_use && pool->slots[i].kind == kind
+            && ( kind == ZPOOL_INFLATE || pool->slots[i].level == level ) )
+        {
+            slot = &pool->slots[i];
+            break;
+        }
+    }
+
+    if ( slot != NULL )
+    {
+        /* Reset stream kept from previous use */
+        error_status =
+            kind == ZPOOL_INFLATE ? inflateReset ( &slot->stream ) : deflateReset ( &slot->stream );
+        if ( error_status != Z_OK )
+        {
+            return zpool_status ( error_status );
+        }
+
+    } else
+    {
+        /* Otherwise take empty slot or replace other free one */
+        for ( i = 0; i < ZPOOL_SLOTS && slot == NULL; i++ )
+        {
+            if ( !pool->slots[i].in_use && !pool->slots[i].kind )
+            {
+                slot = &pool->slots[i];
+            }
+        }
+
+        for ( i = 0; i < ZPOOL_SLOTS && slot == NULL; i++ )
+        {
+            if ( !pool->slots[i].in_use )
+            {
+                slot = &pool->slots[i];
+                if ( slot->kind == ZPOOL_INFLATE )
+                {
+                    inflateEnd ( &slot->stream );
+
+                } else
+                {
+                    deflateEnd ( &slot->stream );
+                }
+                slot->kind = 0;
+            }
+        }
+
+        if ( slot == NULL )
+        {
+            return EBUSY;
+        }
+
+        if ( ( error_status = zpool_init ( slot, kind, level ) ) != 0 )
+        {
+            return error_status;
+        }
+    }
+
+    slot->in_use = TRUE;
+    *stream = &slot->stream;
+
+    return 0;
+}
+
+/* Give stream back to thread pool */
+void zpool_release ( z_stream * stream )
+{
+    struct zpool_slot *slot = ( struct zpool_slot * ) stream;
+
+    slot->in_use = FALSE;
+}
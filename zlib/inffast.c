@@ -82,7 +82,7 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
     in = strm->next_in;
     last = in + (strm->avail_in - 5);
     out = strm->next_out;
-    beg = out - (start - strm->avail_out);
+    beg = out - (start - strm->avail_out) - state->ref;
     end = out + (strm->avail_out - 257);
 #ifdef INFLATE_STRICT
     dmax = state->dmax;
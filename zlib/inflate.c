@@ -151,6 +151,7 @@ z_streamp strm;
     state->wsize = 0;
     state->whave = 0;
     state->wnext = 0;
+    state->ref = 0;
     return inflateResetKeep(strm);
 }
 
@@ -1145,7 +1146,7 @@ int flush;
             state->mode = MATCH;
         case MATCH:
             if (left == 0) goto inf_leave;
-            copy = out - left;
+            copy = out - left + state->ref;
             if (state->offset > copy) {         /* copy from window */
                 copy = state->offset - copy;
                 if (copy > state->whave) {
@@ -1252,7 +1253,13 @@ int flush;
      */
   inf_leave:
     RESTORE();
-    if (state->wsize || (out != strm->avail_out && state->mode < BAD &&
+    if (state->ref) {
+        /* history stays in the caller's buffer, just extend it */
+        state->ref += out - strm->avail_out;
+        if (state->ref > (1U << state->wbits))
+            state->ref = 1U << state->wbits;
+    }
+    else if (state->wsize || (out != strm->avail_out && state->mode < BAD &&
             (state->mode < CHECK || flush != Z_FINISH)))
         if (updatewindow(strm, strm->next_out, out - strm->avail_out)) {
             state->mode = MEM;
@@ -1346,6 +1353,39 @@ uInt dictLength;
     return Z_OK;
 }
 
+int ZEXPORT inflateSetDictionaryRef(strm, dictionary, dictLength)
+z_streamp strm;
+const Bytef *dictionary;
+uInt dictLength;
+{
+    struct inflate_state FAR *state;
+    unsigned long dictid;
+
+    /* check state, history cannot be split with the window */
+    if (inflateStateCheck(strm)) return Z_STREAM_ERROR;
+    state = (struct inflate_state FAR *)strm->state;
+    if (state->wrap != 0 && state->mode != DICT)
+        return Z_STREAM_ERROR;
+    if (state->whave != 0 || dictionary + dictLength != strm->next_out)
+        return Z_STREAM_ERROR;
+
+    /* check for correct dictionary identifier */
+    if (state->mode == DICT) {
+        dictid = adler32(0L, Z_NULL, 0);
+        dictid = adler32(dictid, dictionary, dictLength);
+        if (dictid != state->check)
+            return Z_DATA_ERROR;
+    }
+
+    /* refer to the dictionary where it is instead of copying it */
+    if (dictLength > (1U << state->wbits))
+        dictLength = 1U << state->wbits;
+    state->ref = dictLength;
+    state->havedict = 1;
+    Tracev((stderr, "inflate:   dictionary referenced\n"));
+    return Z_OK;
+}
+
 int ZEXPORT inflateGetHeader(strm, head)
 z_streamp strm;
 gz_headerp head;
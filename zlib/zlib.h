@@ -904,6 +904,22 @@ ZEXTERN int ZEXPORT inflateSetDictionary OF((z_streamp strm,
    inflate().
 */
 
+ZEXTERN int ZEXPORT inflateSetDictionaryRef OF((z_streamp strm,
+                                                const Bytef *dictionary,
+                                                uInt  dictLength));
+/*
+     Like inflateSetDictionary() for raw inflate, but the dictionary is not
+   copied into the window.  It must be the dictLength bytes right before
+   strm->next_out, and they must stay there while inflate() is called.  Output
+   written by inflate() then extends the history in place, so back-references
+   are resolved directly against the caller's buffer.  The window must be empty,
+   as it is right after inflateReset().
+
+     inflateSetDictionaryRef returns Z_OK if success, or Z_STREAM_ERROR if the
+   stream state is inconsistent, the window is not empty or the dictionary does
+   not end at strm->next_out.
+*/
+
 ZEXTERN int ZEXPORT inflateGetDictionary OF((z_streamp strm,
                                              Bytef *dictionary,
                                              uInt  *dictLength));